@@ -0,0 +1,283 @@
+#include <arduino.h>
+#include <cstring>
+#include "binproto.h"
+#include "commands.h"
+#include "transmitter_PiPico.h"
+#include "prof.h"
+#include "idle.h"
+
+static uint8_t bin_frame[BIN_MAX_FRAME];     // The frame being received
+static size_t bin_pos = 0;                   // Bytes of it so far, 0 between frames
+static uint32_t bin_last_ms;                 // When the last byte came
+
+static bool bin_set_pending = false;         // Waiting for the settings of a BIN_SET to be in use
+static uint8_t bin_set_seq;
+static uint32_t bin_set_us;
+
+// Statistics
+static uint32_t bin_frames = 0;
+static uint32_t bin_crc_errors = 0;
+static uint32_t bin_timeouts = 0;
+static uint32_t bin_errors = 0;              // Requests answered with an error status
+static uint32_t bin_params = 0;              // Parameters set
+static uint32_t bin_events = 0;
+static uint32_t bin_superseded = 0;
+static uint32_t bin_done_us_max = 0;
+static uint64_t bin_done_us_total = 0;
+static uint64_t bin_cycles_total = 0;        // Handling the requests
+static uint32_t bin_cycles_max = 0;
+
+
+// CRC-16/CCITT-FALSE, polynomial 0x1021 and start value 0xffff, a bit at a time
+uint16_t bin_crc16(const uint8_t *data, size_t n)
+{
+  uint16_t crc = 0xffff;
+
+  for(size_t ii = 0; ii < n; ii++) {
+    crc ^= (uint16_t)data[ii] << 8;
+    for(int jj = 0; jj < 8; jj++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+
+// Build a frame of at most BIN_MAX_FRAME bytes. Returns its length.
+size_t bin_encode(uint8_t *frame, uint8_t seq, uint8_t type, const uint8_t *payload, size_t n)
+{
+  frame[0] = BIN_SYNC;
+  frame[1] = n;
+  frame[2] = seq;
+  frame[3] = type;
+  memcpy(frame + BIN_HEADER, payload, n);
+  uint16_t crc = bin_crc16(frame + 1, BIN_HEADER - 1 + n);
+  frame[BIN_HEADER + n] = crc & 0xff;
+  frame[BIN_HEADER + n + 1] = crc >> 8;
+  return BIN_HEADER + n + 2;
+}
+
+
+static void bin_send(uint8_t seq, uint8_t type, const uint8_t *payload, size_t n)
+{
+  uint8_t frame[BIN_MAX_FRAME];
+
+  Serial.write(frame, bin_encode(frame, seq, type, payload, n));
+}
+
+
+static void bin_send_done(uint8_t status)
+{
+  uint8_t payload[5];
+  uint32_t us = micros() - bin_set_us;
+
+  payload[0] = status;
+  memcpy(payload + 1, &us, 4); // Little-endian, like the RP2040 and RP2350
+  bin_send(bin_set_seq, BIN_EVT_DONE, payload, sizeof(payload));
+  bin_set_pending = false;
+  bin_events++;
+  if(status == BIN_OK) {
+    bin_done_us_total += us;
+    if(us > bin_done_us_max) {
+      bin_done_us_max = us;
+    }
+  } else {
+    bin_superseded++;
+  }
+}
+
+
+static void bin_set(uint8_t seq, const uint8_t *payload, size_t n)
+{
+  uint32_t t_us = micros();
+  uint8_t response[2] = {BIN_OK, 0xff};
+  int count = n/BIN_VALUE_SIZE;
+  double v;
+
+  if(n % BIN_VALUE_SIZE != 0) {
+    response[0] = BIN_ERR_LENGTH;
+  }
+  for(int ii = 0; ii < count && response[0] == BIN_OK; ii++) {
+    const uint8_t *entry = payload + ii*BIN_VALUE_SIZE;
+    memcpy(&v, entry + 1, sizeof(v));
+    if(entry[0] >= PARAM_N) {
+      response[0] = BIN_ERR_PARAM;
+      response[1] = ii;
+    } else if(!ParamValid(entry[0], v)) {
+      response[0] = BIN_ERR_RANGE;
+      response[1] = ii;
+    }
+  }
+  if(response[0] != BIN_OK) {
+    bin_errors++;
+    bin_send(seq, BIN_SET | BIN_RESPONSE, response, sizeof(response));
+    return;
+  }
+
+  for(int ii = 0; ii < count; ii++) {
+    const uint8_t *entry = payload + ii*BIN_VALUE_SIZE;
+    memcpy(&v, entry + 1, sizeof(v));
+    SetParam(entry[0], v);
+  }
+  bin_params += count;
+  if(bin_set_pending) {
+    bin_send_done(BIN_SUPERSEDED);
+  }
+  rf_synth->apply_settings();
+  bin_send(seq, BIN_SET | BIN_RESPONSE, response, sizeof(response));
+  bin_set_pending = true;
+  bin_set_seq = seq;
+  bin_set_us = t_us;
+}
+
+
+static void bin_get(uint8_t seq, const uint8_t *payload, size_t n)
+{
+  uint8_t response[1 + (BIN_MAX_PAYLOAD - 1)/BIN_VALUE_SIZE*BIN_VALUE_SIZE];
+
+  response[0] = BIN_OK;
+  if(1 + n*BIN_VALUE_SIZE > sizeof(response)) {
+    response[0] = BIN_ERR_LENGTH;
+  }
+  for(size_t ii = 0; ii < n && response[0] == BIN_OK; ii++) {
+    if(payload[ii] >= PARAM_N) {
+      response[0] = BIN_ERR_PARAM;
+      break;
+    }
+    double v = GetParam(payload[ii]);
+    response[1 + ii*BIN_VALUE_SIZE] = payload[ii];
+    memcpy(response + 2 + ii*BIN_VALUE_SIZE, &v, sizeof(v));
+  }
+  if(response[0] != BIN_OK) {
+    bin_errors++;
+    bin_send(seq, BIN_GET | BIN_RESPONSE, response, 1);
+    return;
+  }
+  bin_send(seq, BIN_GET | BIN_RESPONSE, response, 1 + n*BIN_VALUE_SIZE);
+}
+
+
+// A whole frame is in bin_frame
+static void bin_handle()
+{
+  uint32_t t_start = prof_cycles();
+  size_t n = bin_frame[1];
+  uint8_t seq = bin_frame[2];
+  uint8_t type = bin_frame[3];
+  const uint8_t *payload = bin_frame + BIN_HEADER;
+  uint16_t crc = payload[n] | (uint16_t)payload[n + 1] << 8;
+
+  bin_frames++;
+  if(crc != bin_crc16(bin_frame + 1, BIN_HEADER - 1 + n)) {
+    // The type may be wrong too, but the sender knows what it sent with this sequence number
+    uint8_t status = BIN_ERR_CRC;
+    bin_crc_errors++;
+    bin_send(seq, type | BIN_RESPONSE, &status, 1);
+    return;
+  }
+
+  switch(type) {
+    case BIN_PING: {
+      uint8_t response[BIN_MAX_PAYLOAD];
+      response[0] = BIN_OK;
+      n = n < BIN_MAX_PAYLOAD ? n : BIN_MAX_PAYLOAD - 1;
+      memcpy(response + 1, payload, n);
+      bin_send(seq, type | BIN_RESPONSE, response, 1 + n);
+      break;
+    }
+    case BIN_SET:
+      bin_set(seq, payload, n);
+      break;
+    case BIN_GET:
+      bin_get(seq, payload, n);
+      break;
+    default: {
+      uint8_t status = BIN_ERR_TYPE;
+      bin_errors++;
+      bin_send(seq, type | BIN_RESPONSE, &status, 1);
+      break;
+    }
+  }
+
+  uint32_t cycles = prof_cycles() - t_start;
+  bin_cycles_total += cycles;
+  if(cycles > bin_cycles_max) {
+    bin_cycles_max = cycles;
+  }
+}
+
+
+// Read the serial port, take the frames and pass the rest to the text console. Call from loop().
+void bin_poll()
+{
+  while(Serial.available()) {
+    uint8_t c = Serial.read();
+    if(bin_pos == 0 && c != BIN_SYNC) {
+      cmd.handler(c);
+      continue;
+    }
+    bin_frame[bin_pos++] = c;
+    bin_last_ms = millis();
+    if(bin_pos > 1 && bin_pos == BIN_HEADER + bin_frame[1] + 2u) {
+      bin_handle();
+      bin_pos = 0;
+    }
+  }
+
+  if(bin_pos > 0) {
+    if(millis() - bin_last_ms > BIN_TIMEOUT_MS) {
+      bin_timeouts++;
+      bin_pos = 0;
+    } else {
+      idle_wake_in_ms(BIN_TIMEOUT_MS + 1 - (millis() - bin_last_ms));
+    }
+  }
+
+  if(bin_set_pending) {
+    if(rf_synth->get_settings_progress() < 0) {
+      bin_send_done(BIN_OK);
+    } else {
+      // poll_settings() keeps the loop awake while it works, but not after the last slice
+      idle_wake_in_ms(1);
+    }
+  }
+}
+
+
+void bin_print_stats()
+{
+  double us_per_cycle = 1e6/rp2040.f_cpu();
+  uint32_t handled = bin_frames - bin_crc_errors;
+  uint32_t done = bin_events - bin_superseded;
+
+  Serial.printf("Frames: %lu, CRC errors: %lu, timeouts: %lu, error responses: %lu\n",
+                (unsigned long)bin_frames, (unsigned long)bin_crc_errors, (unsigned long)bin_timeouts,
+                (unsigned long)bin_errors);
+  Serial.printf("Parameters set: %lu, done events: %lu, superseded: %lu\n", (unsigned long)bin_params,
+                (unsigned long)bin_events, (unsigned long)bin_superseded);
+  if(handled > 0) {
+    double mean_us = bin_cycles_total*us_per_cycle/handled;
+    Serial.printf("Handling a frame: %.1f us mean, %.1f us max, %.0f frames/s\n", mean_us,
+                  bin_cycles_max*us_per_cycle, mean_us > 0 ? 1e6/mean_us : 0.0);
+  }
+  if(done > 0) {
+    Serial.printf("Request to settings in use: %.1f ms mean, %.1f ms max\n", bin_done_us_total/1e3/done,
+                  bin_done_us_max/1e3);
+  }
+}
+
+
+void bin_clear_stats()
+{
+  bin_frames = 0;
+  bin_crc_errors = 0;
+  bin_timeouts = 0;
+  bin_errors = 0;
+  bin_params = 0;
+  bin_events = 0;
+  bin_superseded = 0;
+  bin_done_us_max = 0;
+  bin_done_us_total = 0;
+  bin_cycles_total = 0;
+  bin_cycles_max = 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Binary control protocol for scripts, e.g. sweeps of the synth parameters. It shares the serial
+// port with the text console: a frame starts with BIN_SYNC, a byte that is not typed, and the other
+// bytes go on to the text commands. Frames are not echoed and get no prompt.
+//
+// Frame: BIN_SYNC, payload length, sequence number, type, payload, and the CRC-16/CCITT-FALSE of
+// the bytes from the length to the end of the payload, low byte first. A frame with a bad CRC, or
+// that stops for BIN_TIMEOUT_MS, is dropped. Values are little-endian doubles, parameters are the
+// param_id_t of commands.h.
+//
+// The response to a request has the type | BIN_RESPONSE, the same sequence number, and a status
+// byte first in the payload:
+//   BIN_PING  Any payload, echoed after the status.
+//   BIN_SET   n times {param_id_t, value}. All are checked before any is set, and then the synth
+//             is recalculated once. The response has the index of the bad entry after the status,
+//             0xff if none. When the new settings are in use, a BIN_EVT_DONE event follows.
+//   BIN_GET   n param_id_t. The response has n times {param_id_t, value}.
+// Events have the sequence number of the request they belong to:
+//   BIN_EVT_DONE  The status, BIN_OK or BIN_SUPERSEDED if a later BIN_SET came before the
+//                 settings were in use, and the time since the request in us, uint32.
+#define BIN_SYNC 0xa5
+#define BIN_HEADER 4
+#define BIN_MAX_PAYLOAD 255
+#define BIN_MAX_FRAME (BIN_HEADER + BIN_MAX_PAYLOAD + 2)
+#define BIN_TIMEOUT_MS 100
+#define BIN_VALUE_SIZE 9    // param_id_t and a double
+
+typedef enum {
+  BIN_PING = 0x01,
+  BIN_SET = 0x02,
+  BIN_GET = 0x03,
+  BIN_EVT_DONE = 0x40,
+  BIN_RESPONSE = 0x80
+} bin_type_t;
+
+typedef enum {
+  BIN_OK,
+  BIN_ERR_CRC,
+  BIN_ERR_TYPE,       // Unknown request
+  BIN_ERR_LENGTH,     // The payload does not fit the request
+  BIN_ERR_PARAM,      // Unknown parameter
+  BIN_ERR_RANGE,      // Value out of range
+  BIN_SUPERSEDED
+} bin_status_t;
+
+uint16_t bin_crc16(const uint8_t *data, size_t n);
+size_t bin_encode(uint8_t *frame, uint8_t seq, uint8_t type, const uint8_t *payload, size_t n);
+void bin_poll();
+void bin_print_stats();
+void bin_clear_stats();
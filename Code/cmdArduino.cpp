@@ -44,8 +44,8 @@
 static uint8_t msg[MAX_MSG_SIZE];
 static uint8_t *msg_ptr;
 
-// linked list for command table
-static cmd_t *cmd_tbl_list, *cmd_tbl;
+// command table, from set_index()
+static const cmd_index_t *cmd_index;
 
 // text strings for command prompt (stored in flash)
 const char cmd_banner[] PROGMEM = "*************** CMD *******************";
@@ -94,7 +94,7 @@ void Cmd::parse(char *cmd)
     uint8_t argc, i = 0;
     char *argv[30];
     char buf[50];
-    cmd_t *cmd_entry;
+    const cmd_t *cmd_entry;
 
     fflush(stdout);
 
@@ -109,16 +109,20 @@ void Cmd::parse(char *cmd)
     // save off the number of arguments for the particular command.
     argc = i;
 
-    // parse the command table for valid command. used argv[0] which is the
-    // actual command name typed in at the prompt
-    for (cmd_entry = cmd_tbl; cmd_entry != NULL; cmd_entry = cmd_entry->next)
+    // an empty line gives no tokens
+    if (argv[0] == NULL)
     {
-        if (!strcmp(argv[0], cmd_entry->cmd))
-        {
-            cmd_entry->func(argc, argv);
-            display_prompt();
-            return;
-        }
+        display_prompt();
+        return;
+    }
+
+    // look up argv[0], the actual command name typed in at the prompt
+    cmd_entry = find(argv[0]);
+    if (cmd_entry != NULL)
+    {
+        cmd_entry->func(argc, argv);
+        display_prompt();
+        return;
     }
 
     if(strlen(argv[0]) > 0) {
@@ -137,13 +141,12 @@ void Cmd::parse(char *cmd)
 /*!
     This function processes the individual characters typed into the command
     prompt. It saves them off into the message buffer unless its a "backspace"
-    or "enter" key. 
+    or "enter" key. It is public so that a caller that reads the serial port
+    itself can pass on the characters of the text console.
 */
 /**************************************************************************/
-void Cmd::handler()
+void Cmd::handler(char c)
 {
-    char c = _ser->read();
-
     switch (c)
     {
     case '\r':
@@ -191,7 +194,7 @@ void Cmd::poll()
 {
     while (_ser->available())
     {
-        handler();
+        handler(_ser->read());
     }
 }
 
@@ -206,8 +209,8 @@ void Cmd::begin(uint32_t speed, HardwareSerial *ser)
     // init the msg ptr
     msg_ptr = msg;
 
-    // init the command table
-    cmd_tbl_list = NULL;
+    // no commands until set_index()
+    cmd_index = NULL;
 
     // load in the serial pointer if it's passed in
     if (ser == NULL)
@@ -225,29 +228,34 @@ void Cmd::begin(uint32_t speed, HardwareSerial *ser)
 
 /**************************************************************************/
 /*!
-    Add a command to the command table. The commands should be added in
-    at the setup() portion of the sketch. 
+    Set the command table, an index built with cmd_make_index(). It is
+    constant, so it stays in flash and nothing is allocated. This should be
+    done at the setup() portion of the sketch.
 */
 /**************************************************************************/
-void Cmd::add(const char *name, void (*func)(int argc, char **argv))
+void Cmd::set_index(const cmd_index_t *index)
 {
-    // alloc memory for command struct
-    cmd_tbl = (cmd_t *)malloc(sizeof(cmd_t));
-
-    // alloc memory for command name
-    char *cmd_name = (char *)malloc(strlen(name)+1);
-
-    // copy command name
-    strcpy(cmd_name, name);
+    cmd_index = index;
+}
 
-    // terminate the command name
-    cmd_name[strlen(name)] = '\0';
+/**************************************************************************/
+/*!
+    Find the command table entry of a name. NULL if there is none.
+*/
+/**************************************************************************/
+const cmd_t *Cmd::find(const char *name)
+{
+    if (cmd_index == NULL || cmd_index->table == NULL)
+    {
+        return NULL;
+    }
 
-    // fill out structure
-    cmd_tbl->cmd = cmd_name;
-    cmd_tbl->func = func;
-    cmd_tbl->next = cmd_tbl_list;
-    cmd_tbl_list = cmd_tbl;
+    uint8_t i = cmd_index->slot[cmd_hash(name, cmd_index->seed) & (CMD_SLOTS - 1)];
+    if (i == 0 || strcmp(name, cmd_index->table[i - 1].name))
+    {
+        return NULL;
+    }
+    return &cmd_index->table[i - 1];
 }
 
 /**************************************************************************/
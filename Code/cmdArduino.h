@@ -51,14 +51,77 @@
 #define MAX_MSG_SIZE    60
 #include <stdint.h>
 
-// command line structure
-typedef struct _cmd_t
+// command table entry. help holds the lines of the help text, each
+// "usage\tdescription" or a continuation of the description. aliases have
+// help NULL and are not listed. page is the help page the entry is listed on.
+typedef struct
 {
-    char *cmd;
+    const char *name;
     void (*func)(int argc, char **argv);
-    struct _cmd_t *next;
+    const char *help;
+    uint8_t page;
 } cmd_t;
 
+// the command index is a perfect hash of the names into CMD_SLOTS slots, built
+// at compile time by cmd_make_index(), so a lookup is one hash and one strcmp.
+// a slot holds the table index + 1, 0 if empty. the slots are kept at four
+// times the number of commands or more, so a seed without collisions is found
+// after a few tries.
+#define CMD_SLOTS       256
+#define CMD_MAX         (CMD_SLOTS/4)
+#define CMD_MAX_SEED    100000
+
+typedef struct
+{
+    const cmd_t *table;     // NULL if no seed was found
+    uint8_t n;
+    uint32_t seed;
+    uint8_t slot[CMD_SLOTS];
+} cmd_index_t;
+
+// FNV-1a of the name, with the seed mixed into the start value
+constexpr uint32_t cmd_hash(const char *s, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    while (*s)
+    {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+constexpr cmd_index_t cmd_make_index(const cmd_t *table, size_t n)
+{
+    cmd_index_t index = {};
+
+    if (n > CMD_MAX)
+    {
+        return index;
+    }
+    for (uint32_t seed = 0; seed < CMD_MAX_SEED; seed++)
+    {
+        bool ok = true;
+        for (size_t i = 0; i < CMD_SLOTS; i++)
+        {
+            index.slot[i] = 0;
+        }
+        for (size_t i = 0; i < n && ok; i++)
+        {
+            uint32_t s = cmd_hash(table[i].name, seed) & (CMD_SLOTS - 1);
+            ok = index.slot[s] == 0;
+            index.slot[s] = i + 1;
+        }
+        if (ok)
+        {
+            index.table = table;
+            index.n = n;
+            index.seed = seed;
+            return index;
+        }
+    }
+    return index;
+}
+
 class Cmd
 {
 public:
@@ -67,13 +130,14 @@ public:
     Cmd();
     void begin(uint32_t speed, HardwareSerial *ser = NULL);
     void poll();
-    void add(const char *name, void (*func)(int argc, char **argv));
+    void handler(char c);
+    void set_index(const cmd_index_t *index);
+    const cmd_t *find(const char *name);
     uint32_t conv(char *str, uint8_t base=10);
     void display_prompt();
 
 private:
     void parse(char *cmd);
-    void handler();    
 };
 
 extern Cmd cmd;
@@ -1,6 +1,12 @@
 #include <pico/stdlib.h>
 #include "commands.h"
 #include "config.h"
+#include "morse.h"
+#include "log.h"
+#include "prof.h"
+#include "idle.h"
+#include "tempcomp.h"
+#include "binproto.h"
 #include "transmitter_PiPico.h"
 
 
@@ -19,9 +25,22 @@ void CmdPhaseHD3(int argc, char **argv);
 void CmdFreq(int argc, char **argv);
 void CmdMode(int argc, char **argv);
 void CmdBufsize(int argc, char **argv);
+void CmdAlign(int argc, char **argv);
+void CmdDual(int argc, char **argv);
+void CmdPark(int argc, char **argv);
+void CmdClock(int argc, char **argv);
+void CmdDmaStat(int argc, char **argv);
+void CmdLogStat(int argc, char **argv);
+void CmdProf(int argc, char **argv);
+void CmdCmdStat(int argc, char **argv);
+void CmdBinStat(int argc, char **argv);
+void CmdFareyTest(int argc, char **argv);
+void CmdMorseTest(int argc, char **argv);
 void CmdDefault(int argc, char **argv);
 void CmdOff(int argc, char **argv);
 void CmdStore(int argc, char **argv);
+void CmdCal(int argc, char **argv);
+void CmdTempComp(int argc, char **argv);
 void CmdLoad(int argc, char **argv);
 
 
@@ -30,29 +49,113 @@ int32_t Str2Num(const char *str, uint8_t base);
 double Str2Double(char *str);
 
 
-// Define all the commands that can be sent from a terminal.
+// All the commands that can be sent from a terminal, with their help text. The help pages list the
+// entries in this order. The index is a perfect hash built by the compiler, so the table and the
+// index are constant and take no heap.
+static constexpr cmd_t cmd_table[] = {
+  // Page 1
+  {"?", CmdPrintHelp, "? or help\tPrint this help text", 1},
+  {"help", CmdPrintHelp, NULL, 1},
+  {"?2", CmdPrintHelp2, "?2 or help2\tPrint help for additional commands", 1},
+  {"help2", CmdPrintHelp2, NULL, 1},
+  {"freq", CmdFreq, "freq <f>\tset the frequency to <f> Hz", 1},
+  {"rate", CmdMorseRate, "rate <wpm>\tset the morse rate to <wpm> words per minute", 1},
+  {"fox", CmdFox, "fox <str>\tset <str> as fox identifier, e.g. MOS\n"
+                  "fox <num>\tset 0 <= <num> <= 7 as fox number. 0 gives MO, 1 gives MOE etc\n"
+                  "fox\tprint the current fox string", 1},
+  {"call", CmdCall, "call <str>\tset <str> as call sign, e.g. SA5BYZ\n"
+                    "call\tsend no call sign", 1},
+  {"cal", CmdCal, "cal <f>\tcalibrate, <f> is the frequency measured with the key down\n"
+                  "cal ppm <v>\tset the calibration to <v> ppm, cal prints it", 1},
+  {"tc", CmdTempComp, "tc <t> <v>\tset the crystal drift at <t> C to <v> ppm, tc prints the curve,\n"
+                      "tc clear removes it", 1},
+  {"store", CmdStore, "store\tstore the current settings to the EEPROM", 1},
+  {"load", CmdLoad, "load\tload settings from the EEPROM", 1},
+  {"stat", CmdPrintStatus, "stat\tprint the current configuration", 1},
+  // Page 2
+  {"stat2", CmdPrintStatus2, "stat2\tPrint the current extended status information", 2},
+  {"keydown", CmdKeyDown, "keydown <val>\ttransmit continuously (<val> = 1) or normally (<val> = 0)", 2},
+  {"dither", CmdDither, "dither <val>\tset the amount of dither, 0.0 to 2.0", 2},
+  {"ampl", CmdAmpl, "ampl <val>\tset the amplitude, 0.0 to 2.0", 2},
+  {"ampl3", CmdAmplHD3, "ampl3 <val>\tset the amplitude of HD3, -0.5 to 0.5", 2},
+  {"ph3", CmdPhaseHD3, "ph3 <val>\tset the phase of HD3, degrees", 2},
+  {"mode", CmdMode, "mode <val>\tset the signal generation mode:\n"
+                    "0 - CLKDIV,\n"
+                    "1 - comparator,\n"
+                    "2 - binary sigma delta,\n"
+                    "3 - trinary sigma delta,\n"
+                    "4 - click free binary sigma delta,\n"
+                    "5 - click free trinary sigma delta", 2},
+  {"bufsize", CmdBufsize, "bufsize <val>\tset max number of words in buffer", 2},
+  {"align", CmdAlign, "align <m> <o>\tmake the number of words a multiple of <m>,\n"
+                      "and the number of periods odd if <o> = 1", 2},
+  {"dual", CmdDual, "dual <val>\talternate between two buffers for a more exact\n"
+                    "frequency (<val> = 1) or use one buffer (<val> = 0)", 2},
+  {"park", CmdPark, "park <val>\tstop the DMA streaming in long silences (<val> = 1) or not (<val> = 0)", 2},
+  {"clock", CmdClock, "clock <val>\tsystem clock: fixed (keep it), auto (choose per frequency),\n"
+                      "<MHz>, or list to show the best clocks for the settings", 2},
+  {"dmastat", CmdDmaStat, "dmastat [c]\tprint DMA streaming statistics, clear them with c", 2},
+  {"logstat", CmdLogStat, "logstat [c]\tprint logging statistics, clear them with c", 2},
+  {"prof", CmdProf, "prof\tprint the time spent in the parts of the main loop and idle,\n"
+                    "and reset it", 2},
+  {"cmdstat", CmdCmdStat, "cmdstat\tprint the size of the command table and time the lookups", 2},
+  {"binstat", CmdBinStat, "binstat [c]\tprint binary protocol statistics, clear them with c", 2},
+  {"ftest", CmdFareyTest, "ftest <n>\ttest the rational approximation with <n> random cases", 2},
+  {"mtest", CmdMorseTest, "mtest\ttest the morse schedule and its timing", 2},
+  {"default", CmdDefault, "default\tset all parameters to default values", 2},
+  {"off", CmdOff, "off <val>\tturn output off\n"
+                  "0 - turn output on\n"
+                  "1 - one high, one low\n"
+                  "2 - both low\n"
+                  "3 - both high\n"
+                  "4 - both high-Z", 2},
+};
+static const int cmd_count = sizeof(cmd_table)/sizeof(cmd_table[0]);
+
+static constexpr cmd_index_t cmd_index = cmd_make_index(cmd_table, cmd_count);
+static_assert(cmd_index.n == cmd_count, "No perfect hash of the command names, raise CMD_SLOTS");
+
+
 void RegisterCommands() {
-  cmd.add("?", CmdPrintHelp);
-  cmd.add("help", CmdPrintHelp);
-  cmd.add("?2", CmdPrintHelp2);
-  cmd.add("help2", CmdPrintHelp2);
-  cmd.add("stat", CmdPrintStatus);
-  cmd.add("stat2", CmdPrintStatus2);
-  cmd.add("keydown", CmdKeyDown);
-  cmd.add("rate", CmdMorseRate);
-  cmd.add("fox", CmdFox);
-  cmd.add("call", CmdCall);
-  cmd.add("dither", CmdDither);
-  cmd.add("ampl", CmdAmpl);
-  cmd.add("ampl3", CmdAmplHD3);
-  cmd.add("ph3", CmdPhaseHD3);
-  cmd.add("freq", CmdFreq);
-  cmd.add("mode", CmdMode);
-  cmd.add("bufsize", CmdBufsize);
-  cmd.add("default", CmdDefault);
-  cmd.add("off", CmdOff);
-  cmd.add("store", CmdStore);
-  cmd.add("load", CmdLoad);
+  cmd.set_index(&cmd_index);
+}
+
+
+// Print the help lines of the entries on a page, with the usage padded to the widest on the page
+static void PrintHelpPage(uint8_t page) {
+  int width = 0;
+
+  for(int ii = 0; ii < cmd_count; ii++) {
+    const char *help = cmd_table[ii].help;
+    if(cmd_table[ii].page != page || help == NULL) {
+      continue;
+    }
+    while(*help) {
+      const char *tab = strchr(help, '\t');
+      const char *end = help + strcspn(help, "\n");
+      if(tab != NULL && tab < end && tab - help > width) {
+        width = tab - help;
+      }
+      help = *end ? end + 1 : end;
+    }
+  }
+
+  for(int ii = 0; ii < cmd_count; ii++) {
+    const char *help = cmd_table[ii].help;
+    if(cmd_table[ii].page != page || help == NULL) {
+      continue;
+    }
+    while(*help) {
+      const char *tab = strchr(help, '\t');
+      const char *end = help + strcspn(help, "\n");
+      if(tab != NULL && tab < end) {
+        Serial.printf("  %-*.*s - %.*s\n", width, (int)(tab - help), help, (int)(end - tab - 1), tab + 1);
+      } else {
+        Serial.printf("  %*s   %.*s\n", width, "", (int)(end - help), help);
+      }
+      help = *end ? end + 1 : end;
+    }
+  }
 }
 
 
@@ -67,18 +170,7 @@ void CmdPrintHelp(int argc, char **argv) {
   Serial.println("******");
   Serial.println("Compiled: " __DATE__ ", " __TIME__ " ");
   Serial.println("Commands:");
-  Serial.println("  ? or help   - Print this help text");
-  Serial.println("  ?2 or help2 - Print help for additional commands");
-  Serial.println("  freq <f>    - set the frequency to <f> Hz");
-  Serial.println("  rate <wpm>  - set the morse rate to <wpm> words per minute");
-  Serial.println("  fox <str>   - set <str> as fox identifier, e.g. MOS");
-  Serial.println("  fox <num>   - set 0 <= <num> <= 7 as fox number. 0 gives MO, 1 gives MOE etc");
-  Serial.println("  fox         - print the current fox string");
-  Serial.println("  call <str>  - set <str> as call sign, e.g. SA5BYZ");
-  Serial.println("  call        - send no call sign");
-  Serial.println("  store       - store the current settings to the EEPROM");
-  Serial.println("  load        - load settings from the EEPROM");
-  Serial.println("  stat        - print the current configuration");
+  PrintHelpPage(1);
 }
 
 
@@ -91,27 +183,7 @@ void CmdPrintHelp2(int argc, char **argv) {
   }
 
   Serial.println("Additional commands for experimentation");
-  Serial.println("  stat2         - Print the current extended status information");
-  Serial.println("  keydown <val> - transmit continuously (<val> = 1) or normally (<val> = 0)");
-  Serial.println("  dither <val>  - set the amount of dither, 0.0 to 2.0");
-  Serial.println("  ampl <val>    - set the amplitude, 0.0 to 2.0");
-  Serial.println("  ampl3 <val>   - set the amplitude of HD3, -0.5 to 0.5");
-  Serial.println("  ph3 <val>     - set the phase of HD3, degrees");
-  Serial.println("  mode <val>    - set the signal generation mode:");
-  Serial.println("                  0 - CLKDIV,");
-  Serial.println("                  1 - comparator,");
-  Serial.println("                  2 - binary sigma delta,");
-  Serial.println("                  3 - trinary sigma delta,");
-  Serial.println("                  4 - click free binary sigma delta,");
-  Serial.println("                  5 - click free trinary sigma delta");
-  Serial.println("  bufsize <val> - set max number of words in buffer");
-  Serial.println("  default       - set all parameters to default values");
-  Serial.println("  off <val>     - turn output off");
-  Serial.println("                  0 - turn output on");
-  Serial.println("                  1 - one high, one low");
-  Serial.println("                  2 - both low");
-  Serial.println("                  3 - both high");
-  Serial.println("                  4 - both high-Z");
+  PrintHelpPage(2);
 }
 
 
@@ -141,6 +213,9 @@ void PrintStatus2()
   }
   Serial.print("CPU_freq: ");
   Serial.println(CPU_freq_actual);
+  Serial.print("Calibration: ");
+  Serial.print(rf_synth->get_ppm(), 3);
+  Serial.println(" ppm");
   if(rf_synth->get_mode() != 0) {
     Serial.print("Dither: ");
     Serial.println(rf_synth->get_dither_amplitude());
@@ -154,9 +229,11 @@ void PrintStatus2()
     Serial.println(rf_synth->get_n_words());
     Serial.print("N periods: ");
     Serial.println(rf_synth->get_n_periods());
+    Serial.print("Dual modulus: ");
+    rf_synth->get_dual_modulus() ? Serial.println("Yes") : Serial.println("No");
   } else {
     Serial.print("Divider: ");
-    float clkdiv = round(256.0*CPU_freq_actual/(2.0*rf_synth->get_frequency_exact()))/256.0;
+    float clkdiv = round(256.0*rf_synth->get_clock()/(2.0*rf_synth->get_frequency_exact()))/256.0;
     float intpart = floor(clkdiv);
     float numerator = (clkdiv - intpart)*256;
     Serial.print((int)intpart);
@@ -165,9 +242,17 @@ void PrintStatus2()
     Serial.println("/256");
   }
   Serial.print("RF frequency: ");
-  Serial.println(rf_synth->get_frequency_exact());
+  Serial.println(rf_synth->get_frequency_exact(), 4);
+  Serial.print("Frequency error: ");
+  Serial.println(rf_synth->get_frequency_exact() - rf_synth->get_frequency(), 4);
   Serial.print("Mode: ");
   Serial.println(rf_synth->get_mode_str());
+  int progress = rf_synth->get_settings_progress();
+  if(progress >= 0) {
+    Serial.print("Applying settings: ");
+    Serial.print(progress);
+    Serial.println("%");
+  }
 }
 
 
@@ -182,6 +267,58 @@ void CmdPrintStatus2(int argc, char **argv) {
 }
 
 
+// The parameters that the binary protocol (binproto.cpp) can set and read. The text commands use
+// the same checks and setters, so both consoles behave the same. The range is checked before any
+// cast to int, which is undefined for NaN or values that don't fit.
+bool ParamValid(int id, double v) {
+  switch(id) {
+    case PARAM_FREQ:    return v >= 100e3 && v <= 20e6;
+    case PARAM_AMPL:    return v >= 0 && v <= 2;
+    case PARAM_DITHER:  return v >= 0 && v <= 3;
+    case PARAM_AMPL3:   return v >= -0.5 && v <= 0.5;
+    case PARAM_PH3:     return v >= -400 && v <= 400;
+    case PARAM_MODE:    return v >= 0 && v <= 5 && v == (int)v;
+    case PARAM_RATE:    return v >= 5 && v <= 100 && v == (int)v;
+    case PARAM_KEYDOWN: return v == 0 || v == 1;
+    default:            return false;
+  }
+}
+
+
+// Set a parameter that ParamValid() accepts. The synth parameters take effect with
+// rf_synth->apply_settings(), so that several can be set with one recalculation.
+void SetParam(int id, double v) {
+  switch(id) {
+    case PARAM_FREQ:
+      rf_synth->set_frequency(v);
+      current_config.frequency = v;
+      break;
+    case PARAM_AMPL:    rf_synth->set_amplitude(v); break;
+    case PARAM_DITHER:  rf_synth->set_dither_amplitude(v); break;
+    case PARAM_AMPL3:   rf_synth->set_hd3_amplitude(v); break;
+    case PARAM_PH3:     rf_synth->set_hd3_phase(v*M_PI/180); break;
+    case PARAM_MODE:    rf_synth->set_mode((int)v); break;
+    case PARAM_RATE:    current_config.wpm = (int)v; break;
+    case PARAM_KEYDOWN: key_down = v != 0; break;
+  }
+}
+
+
+double GetParam(int id) {
+  switch(id) {
+    case PARAM_FREQ:    return rf_synth->get_frequency();
+    case PARAM_AMPL:    return rf_synth->get_amplitude();
+    case PARAM_DITHER:  return rf_synth->get_dither_amplitude();
+    case PARAM_AMPL3:   return rf_synth->get_hd3_amplitude();
+    case PARAM_PH3:     return rf_synth->get_hd3_phase()*180/M_PI;
+    case PARAM_MODE:    return rf_synth->get_mode();
+    case PARAM_RATE:    return current_config.wpm;
+    case PARAM_KEYDOWN: return key_down;
+    default:            return NAN;
+  }
+}
+
+
 void CmdKeyDown(int argc, char **argv) {
   if(argc > 2) {
     // More than one argument
@@ -190,14 +327,10 @@ void CmdKeyDown(int argc, char **argv) {
   }
   if(argc == 1) {
     // No arguments means key down
-    key_down = true;
+    SetParam(PARAM_KEYDOWN, 1);
     return;
   }
-  if(argv[1][0] == '1') {
-    key_down = true;
-  } else {
-    key_down = false;
-  }
+  SetParam(PARAM_KEYDOWN, argv[1][0] == '1');
 }
 
 
@@ -210,12 +343,11 @@ void CmdMorseRate(int argc, char **argv) {
     return;
   }
   rate = Str2Num(argv[1], 10);
-  if(rate < 5 || rate > 100) {
+  if(!ParamValid(PARAM_RATE, rate)) {
     Serial.print("Morse rate must be between 5 and 100");
     return;
   }
-  current_config.wpm = rate;
-  initMorseRate(current_config.wpm);
+  SetParam(PARAM_RATE, rate);
 }
 
 
@@ -282,8 +414,8 @@ void CmdDither(int argc, char **argv) {
   }
   // One argument
   double v = Str2Double(argv[1]);
-  if(v >= 0 && v <= 3) {
-    rf_synth->set_dither_amplitude(v);
+  if(ParamValid(PARAM_DITHER, v)) {
+    SetParam(PARAM_DITHER, v);
     rf_synth->apply_settings();
   } else {
     Serial.println("Invalid dither value");
@@ -303,8 +435,8 @@ void CmdAmpl(int argc, char **argv) {
   }
   // One argument
   double v = Str2Double(argv[1]);
-  if(v >= 0 && v <= 2) {
-    rf_synth->set_amplitude(v);
+  if(ParamValid(PARAM_AMPL, v)) {
+    SetParam(PARAM_AMPL, v);
     rf_synth->apply_settings();
   } else {
     Serial.println("Invalid amplitude value");
@@ -324,8 +456,8 @@ void CmdAmplHD3(int argc, char **argv) {
   }
   // One argument
   double v = Str2Double(argv[1]);
-  if(v >= -0.5 && v <= 0.5) {
-    rf_synth->set_hd3_amplitude(v);
+  if(ParamValid(PARAM_AMPL3, v)) {
+    SetParam(PARAM_AMPL3, v);
     rf_synth->apply_settings();
   } else {
     Serial.println("Invalid HD3 amplitude value");
@@ -345,8 +477,8 @@ void CmdPhaseHD3(int argc, char **argv) {
   }
   // One argument
   double v = Str2Double(argv[1]);
-  if(v >= -400 && v <= 400) {
-    rf_synth->set_hd3_phase(v*M_PI/180);
+  if(ParamValid(PARAM_PH3, v)) {
+    SetParam(PARAM_PH3, v);
     rf_synth->apply_settings();
   } else {
     Serial.println("Invalid HD3 amplitude value");
@@ -365,10 +497,9 @@ void CmdFreq(int argc, char **argv) {
   }
   // One argument
   double v = Str2Double(argv[1]);
-  if(v >= 100e3 && v <= 20e6) {
-    rf_synth->set_frequency(v);
+  if(ParamValid(PARAM_FREQ, v)) {
+    SetParam(PARAM_FREQ, v);
     rf_synth->apply_settings();
-    current_config.frequency = v;
   } else {
     Serial.println("Invalid frequency value");
   }
@@ -386,11 +517,11 @@ void CmdMode(int argc, char **argv) {
     return;
   }
   int m = Str2Num(argv[1], 10);
-  if(m > 5 || m < 0) {
+  if(!ParamValid(PARAM_MODE, m)) {
     Serial.print("Mode must be between 0 and 5");
     return;
   }
-  rf_synth->set_mode(m);
+  SetParam(PARAM_MODE, m);
   rf_synth->apply_settings();
 }
 
@@ -415,13 +546,311 @@ void CmdBufsize(int argc, char **argv) {
 }
 
 
+void CmdAlign(int argc, char **argv) {
+  if(argc == 1) {
+    // No argument, print current values
+    Serial.print(rf_synth->get_word_multiple());
+    Serial.print(" ");
+    Serial.println(rf_synth->get_odd_periods() ? 1 : 0);
+    return;
+  }
+  if(argc != 3) {
+    PrintNumArgError(argc, argv, 3);
+    return;
+  }
+  int m = Str2Num(argv[1], 10);
+  if(m < 1 || m > 1024) {
+    Serial.print("Multiple must be between 1 and 1024");
+    return;
+  }
+  rf_synth->set_alignment(m, argv[2][0] == '1');
+  rf_synth->apply_settings();
+}
+
+
+void CmdDual(int argc, char **argv) {
+  const int num_args = 2;
+
+  if(argc == 1) {
+    // No argument, print current value
+    Serial.println(rf_synth->get_dual_modulus() ? 1 : 0);
+    return;
+  }
+  if(argc != num_args) {
+    PrintNumArgError(argc, argv, num_args);
+    return;
+  }
+  rf_synth->set_dual_modulus(argv[1][0] == '1');
+  rf_synth->apply_settings();
+}
+
+
+void CmdPark(int argc, char **argv) {
+  const int num_args = 2;
+
+  if(argc == 1) {
+    // No argument, print current value
+    Serial.println(rf_synth->get_parking() ? 1 : 0);
+    return;
+  }
+  if(argc != num_args) {
+    PrintNumArgError(argc, argv, num_args);
+    return;
+  }
+  rf_synth->set_parking(argv[1][0] == '1');
+}
+
+
+void CmdClock(int argc, char **argv) {
+  const int num_args = 2;
+
+  if(argc == 1) {
+    // No argument, print current value
+    double plan = rf_synth->get_clock_plan();
+    Serial.printf("%.6f MHz, ", CPU_freq_actual*1e-6);
+    if(plan == 0) {
+      Serial.println("fixed");
+    } else if(plan < 0) {
+      Serial.println("auto");
+    } else {
+      Serial.printf("set to %.6f MHz\n", plan*1e-6);
+    }
+    return;
+  }
+  if(argc != num_args) {
+    PrintNumArgError(argc, argv, num_args);
+    return;
+  }
+  if(strcmp(argv[1], "list") == 0) {
+    rf_synth->print_clock_plan(5);
+    return;
+  }
+  if(strcmp(argv[1], "fixed") == 0) {
+    rf_synth->set_clock_plan(0);
+  } else if(strcmp(argv[1], "auto") == 0) {
+    rf_synth->set_clock_plan(-1);
+  } else {
+    double mhz = Str2Double(argv[1]);
+    if(mhz < 100 || mhz > 300) {
+      Serial.println("Clock must be between 100 and 300 MHz");
+      return;
+    }
+    rf_synth->set_clock_plan(mhz*1e6);
+  }
+  rf_synth->apply_settings();
+}
+
+
+void CmdDmaStat(int argc, char **argv) {
+  if(argc > 2) {
+    PrintNumArgError(argc, argv, 2);
+    return;
+  }
+  rf_synth->print_stats();
+  if(argc == 2 && argv[1][0] == 'c') {
+    rf_synth->clear_stats();
+    Serial.println("Cleared");
+  }
+}
+
+
+void CmdLogStat(int argc, char **argv) {
+  if(argc > 2) {
+    PrintNumArgError(argc, argv, 2);
+    return;
+  }
+  log_print_stats();
+  if(argc == 2 && argv[1][0] == 'c') {
+    log_clear_stats();
+    Serial.println("Cleared");
+  }
+}
+
+
+void CmdProf(int argc, char **argv) {
+  if(argc > 1) {
+    PrintNumArgError(argc, argv, 1);
+    return;
+  }
+  prof_print();
+  idle_print_stats();
+  prof_reset();
+  idle_clear_stats();
+}
+
+
+void CmdBinStat(int argc, char **argv) {
+  if(argc > 2) {
+    PrintNumArgError(argc, argv, 2);
+    return;
+  }
+  bin_print_stats();
+  if(argc == 2 && argv[1][0] == 'c') {
+    bin_clear_stats();
+    Serial.println("Cleared");
+  }
+}
+
+
+// Time the lookup of every command name in the hash index and with a walk of the table, like the
+// linked list of the old command parser did, and estimate the heap the list took.
+void CmdCmdStat(int argc, char **argv) {
+  const int n_rounds = 100;
+  uint32_t hash_total = 0, hash_max = 0, walk_total = 0, walk_max = 0;
+  uint32_t heap = 0;
+  int hits = 0;
+
+  if(argc > 1) {
+    PrintNumArgError(argc, argv, 1);
+    return;
+  }
+
+  for(int ii = 0; ii < cmd_count; ii++) {
+    const char *name = cmd_table[ii].name;
+
+    uint32_t t_start = prof_cycles();
+    for(int jj = 0; jj < n_rounds; jj++) {
+      hits += cmd.find(name) != NULL;
+    }
+    uint32_t cycles = (prof_cycles() - t_start)/n_rounds;
+    hash_total += cycles;
+    hash_max = max(hash_max, cycles);
+
+    // The list had the last added command first
+    t_start = prof_cycles();
+    for(int jj = 0; jj < n_rounds; jj++) {
+      for(int kk = cmd_count - 1; kk >= 0; kk--) {
+        if(!strcmp(name, cmd_table[kk].name)) {
+          hits++;
+          break;
+        }
+      }
+    }
+    cycles = (prof_cycles() - t_start)/n_rounds;
+    walk_total += cycles;
+    walk_max = max(walk_max, cycles);
+
+    // A 12 byte node and the name, each in a malloc chunk of at least 16 bytes with a 4 byte header
+    uint32_t chunk = (strlen(name) + 1 + 4 + 7) & ~7u;
+    heap += 16 + (chunk < 16 ? 16 : chunk);
+  }
+
+  double us_per_cycle = 1e6/rp2040.f_cpu();
+  Serial.printf("Commands: %d, slots: %d, seed: %lu, table: %u bytes, index: %u bytes\n", cmd_count,
+                CMD_SLOTS, (unsigned long)cmd_index.seed, (unsigned)sizeof(cmd_table), (unsigned)sizeof(cmd_index));
+  Serial.printf("Heap of the linked list: %lu bytes in %d allocations, now 0\n", (unsigned long)heap, 2*cmd_count);
+  Serial.printf("Hash lookup: mean %lu cyc (%.2f us), max %lu cyc\n", (unsigned long)(hash_total/cmd_count),
+                hash_total*us_per_cycle/cmd_count, (unsigned long)hash_max);
+  Serial.printf("List walk:   mean %lu cyc (%.2f us), max %lu cyc\n", (unsigned long)(walk_total/cmd_count),
+                walk_total*us_per_cycle/cmd_count, (unsigned long)walk_max);
+  if(hits != 2*n_rounds*cmd_count) {
+    Serial.println("#Error: not all commands were found");
+  }
+}
+
+
+void CmdFareyTest(int argc, char **argv) {
+  uint32_t n_tests = 100000;
+
+  if(argc > 2) {
+    PrintNumArgError(argc, argv, 2);
+    return;
+  }
+  if(argc == 2) {
+    n_tests = Str2Num(argv[1], 10);
+  }
+  test_rational_approx();
+  test_rational_approx_constrained();
+  uint32_t n_fail = test_rational_approx_random(n_tests);
+  n_fail += test_rational_approx_exact(n_tests);
+  if(n_fail > 0) {
+    Serial.printf("ftest: %lu failures\n", (unsigned long)n_fail);
+  } else {
+    Serial.println("ftest: passed");
+  }
+}
+
+
+void CmdMorseTest(int argc, char **argv) {
+  const int num_args = 1;
+  
+  if(argc != num_args) {
+    PrintNumArgError(argc, argv, num_args);
+    return;
+  }
+  test_morse_schedule();
+  test_morse_timing(100);
+}
+
+
 void CmdDefault(int argc, char **argv) {
   rf_synth->set_dither_amplitude(1.0);
   rf_synth->set_amplitude(1.0);
   rf_synth->set_frequency(3579900.0);
   rf_synth->set_mode(5);
   rf_synth->set_max_words(max_words);
+  rf_synth->set_alignment(1, false);
+  rf_synth->set_dual_modulus(false);
+  rf_synth->apply_settings();
+}
+
+
+// Calibrate the crystal. Put the key down, measure the frequency and give it to cal, which 
+// solves for the ppm that makes the frequency the synth reports match. The drift from the 
+// temperature compensation curve is not part of the calibration. Then store it.
+void CmdCal(int argc, char **argv) {
+  double ppm;
+
+  if(argc == 1) {
+    // No argument, print current value
+    Serial.printf("%.3f ppm\n", current_config.ppm);
+    return;
+  }
+  if(argc == 3 && strcmp(argv[1], "ppm") == 0) {
+    ppm = Str2Double(argv[2]);
+  } else if(argc == 2) {
+    double measured = Str2Double(argv[1]);
+    ppm = ((1.0 + rf_synth->get_ppm()*1e-6) * measured / rf_synth->get_frequency_exact() - 1.0) * 1e6;
+    ppm -= tc_curve_ppm(tc_temperature());
+  } else {
+    PrintNumArgError(argc, argv, 2);
+    return;
+  }
+  if(isnan(ppm) || fabs(ppm) > MAX_CAL_PPM) {
+    Serial.printf("The calibration must be within +-%.0f ppm\n", MAX_CAL_PPM);
+    return;
+  }
+  current_config.ppm = ppm;
+  rf_synth->set_ppm(tc_total_ppm());
   rf_synth->apply_settings();
+  Serial.printf("Calibration: %.3f ppm, use store to keep it\n", ppm);
+}
+
+
+void CmdTempComp(int argc, char **argv) {
+  if(argc == 1) {
+    tc_print_stats();
+    return;
+  }
+  if(argc == 2 && strcmp(argv[1], "clear") == 0) {
+    memset(current_config.tc_ppm, 0, sizeof(current_config.tc_ppm));
+  } else if(argc == 3) {
+    double t = Str2Double(argv[1]);
+    double ppm = Str2Double(argv[2]);
+    double pos = round((t - TC_T_MIN)/TC_T_STEP);
+    // Checked before the cast to int, and NaN fails the comparisons
+    if(!(pos >= 0 && pos < TC_POINTS) || !(fabs(ppm) <= MAX_CAL_PPM)) {
+      Serial.printf("The curve has points from %.0f to %.0f C every %.0f C, within +-%.0f ppm\n", 
+                    TC_T_MIN, TC_T_MIN + (TC_POINTS - 1)*TC_T_STEP, TC_T_STEP, MAX_CAL_PPM);
+      return;
+    }
+    current_config.tc_ppm[(int)pos] = ppm;
+  } else {
+    PrintNumArgError(argc, argv, 3);
+    return;
+  }
+  // tc_poll() corrects the frequency after the next temperature sample
+  tc_print_stats();
 }
 
 
@@ -442,6 +871,8 @@ void CmdLoad(int argc, char **argv) {
     return;
   }
   load_EEPROM_config();
+  rf_synth->set_ppm(tc_total_ppm());
+  rf_synth->apply_settings();
   Serial.println("Loaded:");
   print_config();
 }
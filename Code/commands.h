@@ -2,6 +2,24 @@
 #include "cmdArduino.h"
 
 
+// Parameters that can be set from the text commands and the binary protocol (binproto.h).
+// The numbers are used in the binary frames, so only add to the end.
+typedef enum {
+  PARAM_FREQ,     // Hz
+  PARAM_AMPL,
+  PARAM_DITHER,
+  PARAM_AMPL3,
+  PARAM_PH3,      // Degrees
+  PARAM_MODE,
+  PARAM_RATE,     // WPM
+  PARAM_KEYDOWN,  // 0 or 1
+  PARAM_N
+} param_id_t;
+
+
 void RegisterCommands();
 void PrintStatus2();
+bool ParamValid(int id, double v);
+void SetParam(int id, double v);
+double GetParam(int id);
 
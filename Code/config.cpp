@@ -5,6 +5,7 @@
 #include <arduino.h>
 #include "config.h"
 #include "transmitter_PiPico.h"
+#include "log.h"
 
 
 static const double MIN_FREQ =     3400000.0;
@@ -30,7 +31,7 @@ typedef struct {
 } switch2fox_t;
 
 
-switch2freq_t frequencies[] = 
+constexpr switch2freq_t frequencies[] = 
 {
   // 0 means use the value from the EEPROM
   { 1, 3510000.0},
@@ -53,7 +54,7 @@ switch2freq_t frequencies[] =
 
 
 // List of frequencies to cycle between when switches are set to 0b1111
-double cycle_frequencies[] = 
+constexpr double cycle_frequencies[] = 
 {
   3530000.0,
   3550000.0,
@@ -66,6 +67,79 @@ double cycle_frequencies[] =
 int cur_freq_cycle_index = 0;
 
 
+// Periods per word for the fixed frequencies above, calculated at compile time in the same way 
+// as synth::calculate_buffers() does at run time for the nominal CPU clock and the full buffer.
+// This lets switch-selected channels skip the rational approximation.
+
+static const int n_frequencies = sizeof(frequencies)/sizeof(frequencies[0]);
+static const int n_cycle_frequencies = sizeof(cycle_frequencies)/sizeof(cycle_frequencies[0]);
+
+typedef struct {
+  double freq;
+  rational_t plan;
+} channel_plan_t;
+
+typedef struct {
+  channel_plan_t entry[n_frequencies + n_cycle_frequencies];
+} channel_plans_t;
+
+
+constexpr rational_t calculate_channel_plan(double freq)
+{
+  return rational_approximation_exact(freq_to_mHz(freq) * 16, freq_to_mHz(CPU_freq_nominal), max_words);
+}
+
+
+constexpr channel_plans_t calculate_channel_plans()
+{
+  channel_plans_t plans = {};
+  int n = 0;
+
+  for(int ii = 0; ii < n_frequencies; ii++) {
+    plans.entry[n].freq = frequencies[ii].freq;
+    plans.entry[n++].plan = calculate_channel_plan(frequencies[ii].freq);
+  }
+  for(int ii = 0; ii < n_cycle_frequencies; ii++) {
+    plans.entry[n].freq = cycle_frequencies[ii];
+    plans.entry[n++].plan = calculate_channel_plan(cycle_frequencies[ii]);
+  }
+  return plans;
+}
+
+
+static constexpr channel_plans_t channel_plans = calculate_channel_plans();
+
+
+// Check that all fixed frequencies (except the 0 end markers) can be generated within tolerance.
+constexpr bool channel_plans_within_tolerance()
+{
+  for(const channel_plan_t &p : channel_plans.entry) {
+    if(p.freq != 0) {
+      double f = CPU_freq_nominal * p.plan.numerator / (16.0 * p.plan.denominator);
+      if(f - p.freq > CHANNEL_PLAN_TOLERANCE_HZ || p.freq - f > CHANNEL_PLAN_TOLERANCE_HZ) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(channel_plans_within_tolerance(), "A fixed frequency can not be generated within tolerance");
+
+
+// Look up the precomputed plan for a frequency. Returns false if there is none.
+bool lookup_channel_plan(double freq, rational_t *plan)
+{
+  for(const channel_plan_t &p : channel_plans.entry) {
+    if(p.freq != 0 && p.freq == freq) {
+      *plan = p.plan;
+      return true;
+    }
+  }
+  return false;
+}
+
+
 const char foxes[][MAX_FOX_LEN + 1] = 
 {
   "MO", "MOE", "MOI", "MOS", "MOH", "MO5", "MON", "MOD", ""
@@ -81,41 +155,52 @@ const int EEPROM_INITIALIZED_TOKEN = 0x600DF00D;
 void sanitize_config()
 {
   if(current_config.is_initialized_token != EEPROM_INITIALIZED_TOKEN) {
-    Serial.println("Setting initialized token");
+    LOG_WARN("Setting initialized token");
     current_config.is_initialized_token = EEPROM_INITIALIZED_TOKEN;
   }
   if(current_config.frequency < MIN_FREQ) {
-    Serial.println("Setting default frequency 1");
+    LOG_WARN("Setting default frequency 1");
     current_config.frequency = DEFAULT_FREQ;
   }
   if(current_config.frequency > MAX_FREQ) {
-    Serial.println("Setting default frequency 2");
+    LOG_WARN("Setting default frequency 2");
     current_config.frequency = DEFAULT_FREQ;
   }
   if(isnan(current_config.frequency)) {
-    Serial.println("Setting default frequency 3");
+    LOG_WARN("Setting default frequency 3");
     current_config.frequency = DEFAULT_FREQ;
   }
   if(current_config.wpm < MIN_WPM) {
-    Serial.println("Setting default WPM 1");
+    LOG_WARN("Setting default WPM 1");
     current_config.wpm = DEFAULT_WPM;
   }
   if(current_config.wpm > MAX_WPM) {
-    Serial.println("Setting default WPM 2");
+    LOG_WARN("Setting default WPM 2");
     current_config.wpm = DEFAULT_WPM;
   }
   if(strlen(current_config.fox_string) < 1) {
-    Serial.println("Setting default fox string 1");
+    LOG_WARN("Setting default fox string 1");
     strncpy(current_config.fox_string, "MO", sizeof(current_config.fox_string));
     current_config.fox_string[MAX_FOX_LEN] = '\0';
   }
   if(strlen(current_config.fox_string) > sizeof(current_config.fox_string)) {
-    Serial.println("Setting default fox string 2");
+    LOG_WARN("Setting default fox string 2");
     strncpy(current_config.fox_string, DEFAULT_FOX, sizeof(current_config.fox_string));
     current_config.fox_string[MAX_FOX_LEN] = '\0';
   }
+  if(isnan(current_config.ppm) || fabs(current_config.ppm) > MAX_CAL_PPM) {
+    LOG_WARN("Setting default calibration");
+    current_config.ppm = 0;
+  }
+  for(int ii = 0; ii < TC_POINTS; ii++) {
+    if(isnan(current_config.tc_ppm[ii]) || fabs(current_config.tc_ppm[ii]) > MAX_CAL_PPM) {
+      LOG_WARN("Setting default temperature compensation");
+      memset(current_config.tc_ppm, 0, sizeof(current_config.tc_ppm));
+      break;
+    }
+  }
   if(strlen(current_config.call) > MAX_CALL_LEN) {
-    Serial.println("Setting default call sign");
+    LOG_WARN("Setting default call sign");
     strncpy(current_config.call, DEFAULT_CALL, sizeof(current_config.call));
     current_config.call[MAX_CALL_LEN] = '\0';
   }
@@ -126,7 +211,13 @@ void store_EEPROM_config()
 {
   sanitize_config();
   EEPROM.put(EEPROM_BASE_ADDR, current_config);
+  if(rf_synth) {
+    rf_synth->flash_write_begin();
+  }
   EEPROM.commit();
+  if(rf_synth) {
+    rf_synth->flash_write_end();
+  }
 }
 
 
@@ -138,7 +229,7 @@ bool load_EEPROM_config()
 
   EEPROM.get(EEPROM_BASE_ADDR, current_config);
   if(current_config.is_initialized_token != EEPROM_INITIALIZED_TOKEN) {
-    Serial.println("The EEPROM does not seem to be initialized!");
+    LOG_WARN("The EEPROM does not seem to be initialized!");
     retval = false;
   }
   sanitize_config();
@@ -169,6 +260,7 @@ void print_config()
   Serial.printf("Speed: %d WPM\n", current_config.wpm);
   Serial.printf("Fox: '%s' (%d)\n", current_config.fox_string, fox_string_to_num(current_config.fox_string));
   Serial.printf("Call: '%s'\n", current_config.call);
+  Serial.printf("Calibration: %.3f ppm\n", current_config.ppm);
 }
 
 
@@ -203,7 +295,7 @@ void fox_num_to_config(int n)
     strncpy(current_config.fox_string, foxes[n], sizeof(current_config.fox_string));
     current_config.fox_string[MAX_FOX_LEN] = '\0';
   } else {
-    Serial.printf("Warning: Invalid fox number: %d", n);
+    LOG_WARN("Invalid fox number: %d", n);
   }
 }
 
@@ -278,7 +370,7 @@ void read_switches()
   freq_switch = (sw[7]<<3) + (sw[6]<<2) + (sw[5]<<1) + sw[4];
   if(freq_switch == 0) {
     // 0 means use what was in the EEPROM
-    Serial.print("Switches set to load EEPROM");
+    LOG_INFO("Switches set to load EEPROM");
     load_EEPROM_config(); 
     return;
   }
@@ -301,7 +393,7 @@ void read_switches()
       freq = cycle_frequencies[cur_freq_cycle_index++];
     }
     current_config.frequency = freq;
-    Serial.printf("\n*** Switching to f = %.5g MHz ***\n\n", freq/1e6);
+    LOG_INFO("*** Switching to f = %.5g MHz ***", freq/1e6);
     // Flash the LED based on the index to the frequency vector
     int ii = 0;
     while (ii++<cur_freq_cycle_index) {
@@ -1,8 +1,15 @@
 #pragma once
 
+#include "farey.h"
+
 const int MAX_FOX_LEN = 15;
 const int MAX_CALL_LEN = 31;
 const int MIN_FAST_WPM = 14; // Minimum morse rate that is counted as fast
+const double MAX_CAL_PPM = 200.0; // Largest calibration that is accepted
+const int TC_POINTS = 9;           // Points of the temperature compensation curve,
+const float TC_T_MIN = -20.0;      // at TC_T_MIN, TC_T_MIN + TC_T_STEP, ... degrees C
+const float TC_T_STEP = 10.0;
+constexpr double CHANNEL_PLAN_TOLERANCE_HZ = 1.0; // Max allowed error of a fixed frequency
 
 typedef struct {
   double frequency;
@@ -10,6 +17,9 @@ typedef struct {
   char fox_string[MAX_FOX_LEN+1];      // E.g. "MOS"
   char call[MAX_CALL_LEN+1];            // E.g. "SA5BYZ"
   int is_initialized_token;
+  double ppm;                           // Error of the crystal, see the cal command. After the 
+                                        // token so that older stored configurations stay valid.
+  float tc_ppm[TC_POINTS];              // Drift of the crystal with the temperature, see tempcomp.h
 } eeprom_data_t;
 
 extern const int EEPROM_INITIALIZED_TOKEN;
@@ -26,3 +36,4 @@ int fox_string_to_num(const char *fox);
 void setup_switch_pins_power_save();
 void setup_switch_pins_readable();
 void read_switches();
+bool lookup_channel_plan(double freq, rational_t *plan);
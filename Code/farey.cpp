@@ -33,6 +33,9 @@
 #include <arduino.h>
 
 
+uint32_t rational_max_iter_hits = 0; // Number of times rational_approximation() has hit maxIter
+
+
 rational_t rational_approximation(double target, uint32_t maxdenom)
 {
   rational_t retval;
@@ -43,6 +46,7 @@ rational_t rational_approximation(double target, uint32_t maxdenom)
   uint32_t a = 0, b = 1, c = 1, d = 1, ac, bd, Nint;
   const int maxIter = 100;
 
+  retval.iterations = 0;
   if(target > 1) {
     // Invalid
     retval.numerator = 1;
@@ -69,8 +73,8 @@ rational_t rational_approximation(double target, uint32_t maxdenom)
     if(bd > maxdenom || ii > maxIter) {
       // The denominator has become too big, or too many iterations.  
     	// Select the best of a/b and c/d.
-      if(ii > maxIter) { // ###################################
-        Serial.println("Hit max iterations!");
+      if(ii > maxIter) {
+        rational_max_iter_hits++;
       }
       if(target - a/(double)b < c/(double)d - target) {
         ac = a;
@@ -155,6 +159,291 @@ rational_t rational_approximation(double target, uint32_t maxdenom)
 }
 
 
+// A minimal unsigned 128-bit integer, enough to compare rational numbers exactly.
+// The Arm Cortex-M compilers do not provide __int128.
+typedef struct {
+  uint32_t w[4]; // Least significant word first
+} u128_t;
+
+
+static u128_t u128_mul(uint64_t a, uint64_t b)
+{
+  u128_t r = {{0, 0, 0, 0}};
+  uint32_t x[2] = {(uint32_t)a, (uint32_t)(a >> 32)};
+  uint32_t y[2] = {(uint32_t)b, (uint32_t)(b >> 32)};
+
+  for(int ii = 0; ii < 2; ii++) {
+    uint64_t carry = 0;
+    for(int jj = 0; jj < 2; jj++) {
+      uint64_t t = (uint64_t)x[ii]*y[jj] + r.w[ii+jj] + carry;
+      r.w[ii+jj] = (uint32_t)t;
+      carry = t >> 32;
+    }
+    r.w[ii+2] = (uint32_t)carry;
+  }
+  return r;
+}
+
+
+// a*b, where the result is assumed to fit in 128 bits.
+static u128_t u128_mul32(u128_t a, uint32_t b)
+{
+  u128_t r;
+  uint64_t carry = 0;
+
+  for(int ii = 0; ii < 4; ii++) {
+    uint64_t t = (uint64_t)a.w[ii]*b + carry;
+    r.w[ii] = (uint32_t)t;
+    carry = t >> 32;
+  }
+  return r;
+}
+
+
+static int u128_cmp(u128_t a, u128_t b)
+{
+  for(int ii = 3; ii >= 0; ii--) {
+    if(a.w[ii] != b.w[ii]) {
+      return a.w[ii] < b.w[ii] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+
+// |a - b|
+static u128_t u128_absdiff(u128_t a, u128_t b)
+{
+  u128_t r;
+  int64_t borrow = 0;
+
+  if(u128_cmp(a, b) < 0) {
+    r = a;
+    a = b;
+    b = r;
+  }
+  for(int ii = 0; ii < 4; ii++) {
+    int64_t t = (int64_t)a.w[ii] - b.w[ii] - borrow;
+    borrow = t < 0;
+    r.w[ii] = (uint32_t)(t + (borrow << 32));
+  }
+  return r;
+}
+
+
+// Find the modular inverse of x modulo m (m > 1, gcd(x, m) = 1) using the extended Euclidean algorithm.
+static int64_t mod_inverse(int64_t x, int64_t m)
+{
+  int64_t r0 = m, r1 = x % m, s0 = 0, s1 = 1, q, tmp;
+
+  while(r1 != 0) {
+    q = r0 / r1;
+    tmp = r0 - q*r1; r0 = r1; r1 = tmp;
+    tmp = s0 - q*s1; s0 = s1; s1 = tmp;
+  }
+  if(s0 < 0) {
+    s0 += m;
+  }
+  return s0;
+}
+
+
+// Find the neighbors a/b < p/q < c/d of the reduced fraction p/q in the Farey sequence of order 
+// maxdenom (q <= maxdenom), extended to all fractions. They satisfy p*b - a*q = 1 and c*q - p*d = 1.
+void farey_neighbors(int64_t p, int64_t q, int64_t maxdenom, int64_t *a, int64_t *b, int64_t *c, int64_t *d)
+{
+  int64_t inv, j;
+
+  if(q == 1) {
+    *b = maxdenom;
+    *d = maxdenom;
+    *a = p*maxdenom - 1;
+    *c = p*maxdenom + 1;
+    return;
+  }
+  inv = mod_inverse(p % q, q);        // p*inv = 1 (mod q)
+  *b = inv + ((maxdenom - inv)/q)*q;  // maxdenom-q < b <= maxdenom
+  *a = (p*(*b) - 1)/q;
+  j = (q - inv) % q;                  // p*d = -1 (mod q)
+  *d = j + ((maxdenom - j)/q)*q;      // maxdenom-q < d <= maxdenom
+  *c = (p*(*d) + 1)/q;
+}
+
+
+// Distance between p/q and target.
+static double frac_dist(int64_t p, int64_t q, double target)
+{
+  return fabs(p/(double)q - target);
+}
+
+
+// Find the best rational approximation p/q to a number between 0 and 1 under constraints
+// on p and q that are useful when laying out the DMA buffers.
+//
+// target - a number between 0 and 1 (inclusive)
+// maxdenom - the maximum allowed denominator
+// denom_multiple - the denominator must be a multiple of this (e.g. a DMA ring size or 4)
+// odd_numerator - if true, the numerator must be odd
+//
+// The returned fraction is in general not reduced when denom_multiple > 1.
+// If no denominator is allowed (maxdenom < denom_multiple), the smallest allowed 
+// denominator, denom_multiple, is used.
+//
+// The denominator constraint is handled by noting that p/(m*k) is close to target exactly
+// when p/k is close to m*target, so the problem is the unconstrained one for m*target with
+// the maximum denominator maxdenom/m. The integer part of m*target is split off so that
+// rational_approximation() can be used for the fractional part.
+//
+// The parity constraint is handled using the Farey sequence F_K (all fractions with
+// denominators up to K). Neighboring fractions a/b < c/d in F_K satisfy b*c - a*d = 1, so
+// they can not both have even numerators. The closest fraction with an odd numerator on
+// each side of the target is therefore either the closest Farey fraction on that side or
+// the one next to it. The neighbors can be found in constant time once the best
+// approximation is known, so this costs little more than the unconstrained search.
+rational_t rational_approximation_constrained(double target, uint32_t maxdenom, 
+                                              uint32_t denom_multiple, bool odd_numerator)
+{
+  rational_t retval, best;
+  int64_t m, K, whole, P, k, a, b, c, d, e, f, g, h, j;
+  double x;
+
+  if(denom_multiple < 1) {
+    denom_multiple = 1;
+  }
+  if(target > 1) {
+    target = 1;
+  }
+  if(target < 0) {
+    target = 0;
+  }
+  m = denom_multiple;
+  K = maxdenom / denom_multiple;
+  if(K < 1) {
+    K = 1;
+  }
+
+  // Approximate x = m*target by P/k with k <= K
+  x = m*target;
+  whole = (int64_t)floor(x);
+  if(whole >= m) {
+    whole = m - 1; // target == 1, let the fractional part be 1
+  }
+  best = rational_approximation(x - whole, K);
+  k = best.denominator;
+  P = whole*k + best.numerator;
+  retval.iterations = best.iterations;
+
+  if(odd_numerator && (P & 1) == 0) {
+    // Left neighbor a/b and right neighbor c/d of P/k in F_K
+    farey_neighbors(P, k, K, &a, &b, &c, &d);
+    // The fraction before a/b and the one after c/d
+    j = (K + k)/b;
+    e = j*a - P;
+    f = j*b - k;
+    j = (K + k)/d;
+    g = j*c - P;
+    h = j*d - k;
+
+    // P is even, so of the candidates a, c are odd (from the determinant property) 
+    // and possibly e, g. Pick the best one with an odd, non-negative numerator 
+    // that does not exceed the denominator times m.
+    int64_t cand_p[4] = {a, c, e, g};
+    int64_t cand_q[4] = {b, d, f, h};
+    double best_dist = INFINITY;
+    for(int ii = 0; ii < 4; ii++) {
+      if((cand_p[ii] & 1) && cand_p[ii] >= 0 && cand_p[ii] <= m*cand_q[ii] && 
+         cand_q[ii] >= 1 && cand_q[ii] <= K) {
+        double dist = frac_dist(cand_p[ii], cand_q[ii], x);
+        if(dist < best_dist) {
+          best_dist = dist;
+          P = cand_p[ii];
+          k = cand_q[ii];
+        }
+      }
+    }
+  }
+
+  retval.numerator = P;
+  retval.denominator = m*k;
+  return retval;
+}
+
+
+// Exhaustive reference for rational_approximation_constrained(). Tries all allowed denominators.
+static rational_t rational_approximation_constrained_ref(double target, uint32_t maxdenom, 
+                                                         uint32_t denom_multiple, bool odd_numerator)
+{
+  rational_t retval = {0, denom_multiple, 0};
+  double best_dist = INFINITY;
+
+  for(uint32_t q = denom_multiple; q <= maxdenom; q += denom_multiple) {
+    int64_t p0 = (int64_t)floor(target*q);
+    int64_t cand[2];
+    if(odd_numerator) {
+      cand[0] = (p0 & 1) ? p0 : p0 - 1;
+      cand[1] = cand[0] + 2;
+    } else {
+      cand[0] = p0;
+      cand[1] = p0 + 1;
+    }
+    for(int ii = 0; ii < 2; ii++) {
+      if(cand[ii] >= 0 && cand[ii] <= q) {
+        double dist = frac_dist(cand[ii], q, target);
+        if(dist < best_dist) {
+          best_dist = dist;
+          retval.numerator = cand[ii];
+          retval.denominator = q;
+        }
+      }
+    }
+  }
+  return retval;
+}
+
+
+// Compare rational_approximation_constrained() against the exhaustive reference for random
+// targets and constraints and print the results and the time per call of both.
+void test_rational_approx_constrained()
+{
+  const uint32_t n_tests = 2000;
+  const uint32_t multiples[] = {1, 2, 4, 8, 16, 3};
+  const uint32_t n_multiples = sizeof(multiples)/sizeof(multiples[0]);
+  uint32_t n_fail = 0;
+  uint32_t t_fast = 0, t_ref = 0, t0;
+  rational_t result, expected;
+
+  srand(1);
+  for(uint32_t ii = 0; ii < n_tests; ii++) {
+    double target = rand()/(double)RAND_MAX;
+    uint32_t maxdenom = 1 + rand() % 15000;
+    uint32_t mult = multiples[ii % n_multiples];
+    bool odd = (ii / n_multiples) & 1;
+
+    t0 = micros();
+    result = rational_approximation_constrained(target, maxdenom, mult, odd);
+    t_fast += micros() - t0;
+    t0 = micros();
+    expected = rational_approximation_constrained_ref(target, maxdenom, mult, odd);
+    t_ref += micros() - t0;
+
+    // Equally good solutions are accepted, so compare the distances
+    if(maxdenom >= mult && 
+       (result.denominator % mult != 0 || result.denominator > maxdenom || 
+        (odd && (result.numerator & 1) == 0) ||
+        frac_dist(result.numerator, result.denominator, target) > 
+        frac_dist(expected.numerator, expected.denominator, target))) {
+      n_fail++;
+      Serial.printf("target = %.12g, maxdenom = %lu, multiple = %lu, odd = %d: got %lu/%lu, expected %lu/%lu\n", 
+                    target, maxdenom, mult, odd, result.numerator, result.denominator, 
+                    expected.numerator, expected.denominator);
+    }
+  }
+  Serial.printf("Constrained rational approximation: %lu tests, %lu failures\n", n_tests, n_fail);
+  Serial.printf("Time per call: %.2f us (exhaustive reference %.2f us)\n", 
+                t_fast/(double)n_tests, t_ref/(double)n_tests);
+}
+
+
 typedef struct {
   double target;
   uint32_t maxdenom;
@@ -205,3 +494,271 @@ void test_rational_approx()
     }
   }
 }
+
+
+// Returns -1 if p1/q1 is closer, 1 if p2/q2 is closer and 0 if they are equally close.
+static int rational_dist_cmp(uint64_t p1, uint32_t q1, uint64_t p2, uint32_t q2, uint64_t num, uint64_t den)
+{
+  // |p1/q1 - num/den| < |p2/q2 - num/den|  <=>  |p1*den - num*q1|*q2 < |p2*den - num*q2|*q1
+  u128_t e1 = u128_absdiff(u128_mul(p1, den), u128_mul(num, q1));
+  u128_t e2 = u128_absdiff(u128_mul(p2, den), u128_mul(num, q2));
+  return u128_cmp(u128_mul32(e1, q2), u128_mul32(e2, q1));
+}
+
+
+// Exact reference for rational_approximation(). Walks down the Stern-Brocot tree towards
+// num/den (num <= den) taking all steps in the same direction at once, i.e. follows the 
+// continued fraction expansion, using only integer arithmetic. When the next convergent 
+// would have a too large denominator, the last convergent and the best semiconvergent are 
+// the two candidates.
+static rational_t rational_reference(uint64_t num, uint64_t den, uint32_t maxdenom)
+{
+  rational_t retval = {0, 1, 0};
+  uint64_t p0 = 0, q0 = 1, p1 = 1, q1 = 0, p2, q2, n = num, d = den, a, t;
+
+  if(maxdenom < 1) {
+    maxdenom = 1;
+  }
+  while(d != 0) {
+    a = n / d;
+    if(q1 != 0 && a > (maxdenom - q0)/q1) {
+      // The next convergent has a too large denominator, try the semiconvergent
+      t = (maxdenom - q0)/q1;
+      p2 = t*p1 + p0;
+      q2 = t*q1 + q0;
+      if(rational_dist_cmp(p2, q2, p1, q1, num, den) < 0) {
+        p1 = p2;
+        q1 = q2;
+      }
+      break;
+    }
+    p2 = a*p1 + p0;
+    q2 = a*q1 + q0;
+    p0 = p1;
+    q0 = q1;
+    p1 = p2;
+    q1 = q2;
+    t = n - a*d;
+    n = d;
+    d = t;
+  }
+  retval.numerator = p1;
+  retval.denominator = q1;
+  return retval;
+}
+
+
+// Results of timed calls are added to this so that the calls are not optimized away.
+static volatile uint32_t timing_sink;
+
+
+// Random number generator for the tests (xorshift64*).
+static uint64_t test_rand_state = 1;
+
+static uint64_t test_rand()
+{
+  test_rand_state ^= test_rand_state >> 12;
+  test_rand_state ^= test_rand_state << 25;
+  test_rand_state ^= test_rand_state >> 27;
+  return test_rand_state * 0x2545F4914F6CDD1Dull;
+}
+
+
+// Property based test of rational_approximation() against the exact reference for n_tests 
+// random targets and denominator limits. The targets are of the form M/2^53 so that they 
+// are exactly representable as doubles. Half of them are uniformly distributed and half 
+// are placed very close to fractions with small denominators, which is where the 
+// floating point shortcuts in rational_approximation() are most likely to fail.
+// The denominator limits of three quarters of the cases are within RATIONAL_DOUBLE_MAX_DENOM,
+// where any result that is not optimal is a failure. The rest go up to 2^31 and only show
+// how often the double arithmetic loses precision there.
+// Prints the failures, the worst case number of iterations and the time per call, and
+// returns the number of failures.
+uint32_t test_rational_approx_random(uint32_t n_tests)
+{
+  const uint32_t batch = 256;
+  const uint64_t D = 1ull << 53;
+  double targets[batch];
+  uint32_t maxdenoms[batch];
+  uint64_t Ms[batch];
+  uint32_t n_fail = 0, n_fail_printed = 0, max_iter = 0, max_iter_denom = 0;
+  uint32_t n_wide = 0, n_wide_loss = 0, min_loss_denom = UINT32_MAX;
+  uint32_t max_iter_hits_before = rational_max_iter_hits;
+  uint32_t n_fail_exact = 0;
+  double max_iter_target = 0;
+  uint64_t t_total_cycles = 0;
+  uint32_t n_done = 0;
+  rational_t result, expected, exact;
+
+  test_rand_state = 0x9E3779B97F4A7C15ull;
+  while(n_done < n_tests) {
+    uint32_t n_batch = min(batch, n_tests - n_done);
+    // Generate the test cases
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      uint64_t M;
+      if(ii & 1) {
+        // Close to a fraction with a small denominator
+        uint64_t q = 1 + test_rand() % 1000;
+        uint64_t p = test_rand() % (q + 1);
+        int64_t offset = (int64_t)(test_rand() % 2001) - 1000;
+        M = (p*D + q/2)/q;
+        if(offset < 0 && (uint64_t)(-offset) > M) {
+          M = 0;
+        } else {
+          M += offset;
+        }
+        if(M > D) {
+          M = D;
+        }
+      } else {
+        M = test_rand() % (D + 1);
+      }
+      Ms[ii] = M;
+      targets[ii] = ldexp((double)M, -53);
+      uint32_t r = test_rand() & 3;
+      if(r == 0) {
+        // Outside the supported range, up to 2^31
+        maxdenoms[ii] = RATIONAL_DOUBLE_MAX_DENOM + 1 + test_rand() % ((1ull << 31) - RATIONAL_DOUBLE_MAX_DENOM);
+      } else if(r == 1) {
+        // Log-uniform up to RATIONAL_DOUBLE_MAX_DENOM
+        maxdenoms[ii] = 1 + test_rand() % min((uint64_t)1 << (1 + test_rand() % 21), (uint64_t)RATIONAL_DOUBLE_MAX_DENOM);
+      } else {
+        maxdenoms[ii] = 1 + test_rand() % 20000;
+      }
+    }
+
+    // Time the algorithm
+    uint32_t t0 = rp2040.getCycleCount();
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      result = rational_approximation(targets[ii], maxdenoms[ii]);
+      timing_sink += result.denominator;
+    }
+    t_total_cycles += rp2040.getCycleCount() - t0;
+
+    // Check against the reference
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      result = rational_approximation(targets[ii], maxdenoms[ii]);
+      expected = rational_reference(Ms[ii], D, maxdenoms[ii]);
+      exact = rational_approximation_exact(Ms[ii], D, maxdenoms[ii]);
+      if(rational_dist_cmp(exact.numerator, exact.denominator, 
+                           expected.numerator, expected.denominator, Ms[ii], D) != 0) {
+        n_fail_exact++;
+      }
+      if(result.iterations > max_iter) {
+        max_iter = result.iterations;
+        max_iter_target = targets[ii];
+        max_iter_denom = maxdenoms[ii];
+      }
+      bool optimal = result.denominator >= 1 && result.denominator <= maxdenoms[ii] &&
+                     rational_dist_cmp(result.numerator, result.denominator, 
+                                       expected.numerator, expected.denominator, Ms[ii], D) <= 0;
+      if(maxdenoms[ii] > RATIONAL_DOUBLE_MAX_DENOM) {
+        n_wide++;
+        if(!optimal) {
+          n_wide_loss++;
+          min_loss_denom = min(min_loss_denom, maxdenoms[ii]);
+        }
+      } else if(!optimal) {
+        n_fail++;
+        if(n_fail_printed < 10) {
+          n_fail_printed++;
+          Serial.printf("target = %.17g, maxdenom = %lu: got %lu/%lu, expected %lu/%lu\n", 
+                        targets[ii], maxdenoms[ii], result.numerator, result.denominator, 
+                        expected.numerator, expected.denominator);
+        }
+      }
+    }
+    n_done += n_batch;
+  }
+  Serial.printf("Random rational approximation: %lu tests with maxdenom <= %lu, %lu failures\n", 
+                n_tests - n_wide, (uint32_t)RATIONAL_DOUBLE_MAX_DENOM, n_fail);
+  Serial.printf("Outside the supported range (maxdenom up to 2^31): %lu of %lu results not optimal", 
+                n_wide_loss, n_wide);
+  if(n_wide_loss > 0) {
+    Serial.printf(", the smallest maxdenom %lu", min_loss_denom);
+  }
+  Serial.println();
+  Serial.printf("Max iterations: %lu (target = %.17g, maxdenom = %lu)\n", max_iter, max_iter_target, max_iter_denom);
+  Serial.printf("Failures of the exact integer version: %lu\n", n_fail_exact);
+  // Each case is run twice, once for timing and once for checking
+  Serial.printf("Calls that hit the iteration limit: %lu\n", (rational_max_iter_hits - max_iter_hits_before)/2);
+  Serial.printf("Time per call: %.0f ns\n", 1e9*t_total_cycles/rp2040.f_cpu()/n_tests);
+  return n_fail + n_fail_exact;
+}
+
+
+// Check that rational_approximation_exact() gives the optimal result and compare it with 
+// rational_approximation() for n_tests random frequencies (100 kHz - 6.25 MHz, in mHz) and 
+// clock frequencies (100 - 300 MHz), i.e. the targets the synth uses.
+// Prints the number of non-optimal results, the number of cases where the two versions 
+// disagree and the time per call of both. Returns the number of non-optimal results.
+uint32_t test_rational_approx_exact(uint32_t n_tests)
+{
+  const uint32_t batch = 256;
+  uint64_t nums[batch], dens[batch];
+  double targets[batch];
+  uint32_t maxdenoms[batch];
+  uint32_t n_fail = 0, n_fail_printed = 0, n_disagree = 0, n_double_worse = 0, max_iter = 0;
+  uint64_t t_exact_cycles = 0, t_double_cycles = 0;
+  uint32_t n_done = 0, t0;
+  rational_t exact, approx, expected;
+
+  test_rand_state = 0xD1B54A32D192ED03ull;
+  while(n_done < n_tests) {
+    uint32_t n_batch = min(batch, n_tests - n_done);
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      uint64_t freq_mHz = 100000000ull + test_rand() % 6150000000ull;
+      uint64_t clock_Hz = 100000000ull + test_rand() % 200000001ull;
+      nums[ii] = freq_mHz * 16;
+      dens[ii] = clock_Hz * 1000;
+      targets[ii] = nums[ii]/(double)dens[ii];
+      maxdenoms[ii] = 1 + test_rand() % ((test_rand() & 1) ? 20000 : 1048575);
+    }
+
+    t0 = rp2040.getCycleCount();
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      exact = rational_approximation_exact(nums[ii], dens[ii], maxdenoms[ii]);
+      timing_sink += exact.denominator;
+    }
+    t_exact_cycles += rp2040.getCycleCount() - t0;
+    t0 = rp2040.getCycleCount();
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      approx = rational_approximation(targets[ii], maxdenoms[ii]);
+      timing_sink += approx.denominator;
+    }
+    t_double_cycles += rp2040.getCycleCount() - t0;
+
+    for(uint32_t ii = 0; ii < n_batch; ii++) {
+      exact = rational_approximation_exact(nums[ii], dens[ii], maxdenoms[ii]);
+      approx = rational_approximation(targets[ii], maxdenoms[ii]);
+      expected = rational_reference(nums[ii], dens[ii], maxdenoms[ii]);
+      max_iter = max(max_iter, exact.iterations);
+      if(exact.denominator > maxdenoms[ii] ||
+         rational_dist_cmp(exact.numerator, exact.denominator, 
+                           expected.numerator, expected.denominator, nums[ii], dens[ii]) != 0) {
+        n_fail++;
+        if(n_fail_printed < 10) {
+          n_fail_printed++;
+          Serial.printf("%llu/%llu, maxdenom = %lu: got %lu/%lu, expected %lu/%lu\n", 
+                        nums[ii], dens[ii], maxdenoms[ii], exact.numerator, exact.denominator, 
+                        expected.numerator, expected.denominator);
+        }
+      }
+      if(exact.numerator != approx.numerator || exact.denominator != approx.denominator) {
+        n_disagree++;
+        if(rational_dist_cmp(approx.numerator, approx.denominator, 
+                             exact.numerator, exact.denominator, nums[ii], dens[ii]) > 0) {
+          n_double_worse++;
+        }
+      }
+    }
+    n_done += n_batch;
+  }
+  Serial.printf("Exact rational approximation: %lu tests, %lu non-optimal results, max iterations %lu\n", 
+                n_tests, n_fail, max_iter);
+  Serial.printf("Disagreements with the double version: %lu (double version worse in %lu)\n", 
+                n_disagree, n_double_worse);
+  Serial.printf("Time per call: %.0f ns (double version %.0f ns)\n", 
+                1e9*t_exact_cycles/rp2040.f_cpu()/n_tests, 1e9*t_double_cycles/rp2040.f_cpu()/n_tests);
+  return n_fail;
+}
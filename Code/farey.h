@@ -10,6 +10,112 @@ typedef struct {
   uint32_t iterations;   // Just for debugging of the Farey algorithm
 } rational_t;
 
+extern uint32_t rational_max_iter_hits;
+
+
+// Compare x1*y1 < x2*y2 without overflow, for x1, x2 < 2^63 and y1, y2 < 2^32.
+constexpr bool mul_less(uint64_t x1, uint64_t y1, uint64_t x2, uint64_t y2)
+{
+  uint64_t lo1 = (x1 & 0xFFFFFFFFu) * y1;
+  uint64_t lo2 = (x2 & 0xFFFFFFFFu) * y2;
+  uint64_t hi1 = (x1 >> 32) * y1 + (lo1 >> 32);
+  uint64_t hi2 = (x2 >> 32) * y2 + (lo2 >> 32);
+  return hi1 < hi2 || (hi1 == hi2 && (lo1 & 0xFFFFFFFFu) < (lo2 & 0xFFFFFFFFu));
+}
+
+
+// Find the best rational approximation to num/den (0 <= num <= den) using only integer arithmetic.
+//
+// num, den - the target as a rational number, e.g. frequency in mHz * 16 over clock in Hz * 1000
+// maxdenom - the maximum allowed denominator
+//
+// This is the same Farey algorithm as in rational_approximation(), but all quantities are 
+// exact. With a/b <= num/den <= c/d and b*c - a*d = 1 (which holds throughout), the scaled 
+// distances to the endpoints
+//   e_lo = num*b - a*den and e_hi = c*den - num*d
+// are both in [0, den], so they can be computed in 64 bits even if the products overflow.
+// The mediant is above the target exactly when e_hi > e_lo, and the number of steps to take
+// from one side is simply e_hi/e_lo or e_lo/e_hi. A zero distance means that an endpoint 
+// is the target itself, so no epsilon is needed. Ties in the final selection are resolved 
+// towards c/d, like in the double version.
+//
+// The function is constexpr so that it can also be used to calculate tables at compile time.
+constexpr rational_t rational_approximation_exact(uint64_t num, uint64_t den, uint32_t maxdenom)
+{
+  rational_t retval = {0, 1, 0};
+  uint64_t a = 0, b = 1, c = 1, d = 1, e_lo = 0, e_hi = 0, N = 0;
+  uint32_t ii = 0;
+
+  retval.iterations = 0;
+  if(den == 0 || num > den) {
+    // Invalid
+    retval.numerator = 1;
+    retval.denominator = 1;
+    return retval;
+  }
+  if(maxdenom < 1) {
+    maxdenom = 1;
+  }
+
+  while(1) {
+    e_lo = num*b - a*den;
+    e_hi = c*den - num*d;
+    if(b + d > maxdenom) {
+      // Select the best of a/b and c/d, i.e. compare e_lo/b with e_hi/d
+      if(mul_less(e_lo, d, e_hi, b)) {
+        c = a;
+        d = b;
+      }
+      break;
+    }
+    if(e_hi > e_lo) {
+      // The target is below the mediant, discard c/d
+      if(e_lo == 0) {
+        // a/b is exact
+        c = a;
+        d = b;
+        break;
+      }
+      N = e_hi / e_lo;
+      if(N > (maxdenom - d)/b) {
+        // The denominator would become too large (checked without overflowing)
+        N = (maxdenom - d)/b;
+      }
+      c = c + N*a;
+      d = d + N*b;
+    } else {
+      // The target is at or above the mediant, discard a/b
+      if(e_hi == 0) {
+        // c/d is exact
+        break;
+      }
+      N = e_lo / e_hi;
+      if(N > (maxdenom - b)/d) {
+        // The denominator would become too large (checked without overflowing)
+        N = (maxdenom - b)/d;
+      }
+      a = a + N*c;
+      b = b + N*d;
+    }
+    ii++;
+  }
+
+  retval.numerator = c;
+  retval.denominator = d;
+  retval.iterations = ii;
+  return retval;
+}
+
+
+// rational_approximation() gives the best approximation for maxdenom up to this. Above it the
+// double arithmetic loses precision, ftest finds the first non-optimal results at about 2.8 million.
+#define RATIONAL_DOUBLE_MAX_DENOM 2000000
 
 rational_t rational_approximation(double target, uint32_t maxdenom);
+void farey_neighbors(int64_t p, int64_t q, int64_t maxdenom, int64_t *a, int64_t *b, int64_t *c, int64_t *d);
+rational_t rational_approximation_constrained(double target, uint32_t maxdenom, 
+                                              uint32_t denom_multiple, bool odd_numerator);
 void test_rational_approx();
+void test_rational_approx_constrained();
+uint32_t test_rational_approx_random(uint32_t n_tests);
+uint32_t test_rational_approx_exact(uint32_t n_tests);
@@ -0,0 +1,78 @@
+// Host mock of the Arduino core API used by the firmware. Time is virtual, see host.h.
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdarg>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include "pico/stdlib.h"
+
+using std::isnan;
+using std::min;
+using std::max;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#define F(s) (s)
+#define CHANGE 2
+#define FALLING 3
+#define RISING 4
+#define digitalPinToInterrupt(pin) (pin)
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int val);
+int digitalRead(int pin);
+int analogRead(int pin);
+void analogReadResolution(int bits);
+float analogReadTemp();
+void delay(uint32_t ms);
+uint32_t micros();
+uint32_t millis();
+void attachInterrupt(int pin, void (*callback)(), int mode);
+
+// Serial port. Output goes to stdout, input is queued with host_serial_input().
+class HardwareSerial {
+  public:
+    void begin(unsigned long baud) {(void)baud;};
+    int available();
+    int read();
+    int availableForWrite();
+    void flush() {fflush(stdout);};
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buf, size_t n);
+    size_t print(const char *s);
+    size_t print(char c) {return write(c);};
+    size_t print(double v, int digits = 2);
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    size_t print(T v, int base = DEC) {return print_integer((long long)v, std::is_signed<T>::value, base);};
+    size_t println() {return print("\r\n");};
+    template<typename T> size_t println(T v) {size_t n = print(v); return n + println();};
+    template<typename T> size_t println(T v, int arg) {size_t n = print(v, arg); return n + println();};
+    size_t printf(const char *format, ...);
+  private:
+    size_t print_integer(long long v, bool is_signed, int base);
+};
+
+extern HardwareSerial Serial;
+
+// The rp2040 object of the core. Virtual time stands still during loop(), so the cycle count
+// comes from the host clock, scaled to HOST_CLOCK_HZ.
+class RP2040 {
+  public:
+    uint32_t getCycleCount() {return (uint32_t)getCycleCount64();};
+    uint64_t getCycleCount64();
+    uint32_t f_cpu();
+};
+
+extern RP2040 rp2040;
@@ -0,0 +1,19 @@
+// Host mock of the Bounce2 push button library, without the debouncing
+#pragma once
+#include "Arduino.h"
+
+class Bounce {
+  public:
+    void attach(int pin, int mode) {m_pin = pin; pinMode(pin, mode); m_state = digitalRead(pin);};
+    void interval(uint16_t ms) {(void)ms;};
+    bool update() {int s = digitalRead(m_pin); m_fell = m_state && !s; m_rose = !m_state && s; 
+                   bool changed = s != m_state; m_state = s; return changed;};
+    bool fell() {return m_fell;};
+    bool rose() {return m_rose;};
+    int read() {return m_state;};
+  private:
+    int m_pin = 0;
+    int m_state = HIGH;
+    bool m_fell = false;
+    bool m_rose = false;
+};
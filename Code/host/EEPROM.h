@@ -0,0 +1,20 @@
+// Host mock of the emulated EEPROM, kept in memory
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+class EEPROMClass {
+  public:
+    void begin(size_t size) {m_size = size < sizeof(m_data) ? size : sizeof(m_data);};
+    template<typename T> T &get(int addr, T &t) {memcpy(&t, m_data + addr, sizeof(T)); return t;};
+    template<typename T> const T &put(int addr, const T &t) {memcpy(m_data + addr, &t, sizeof(T)); return t;};
+    bool commit();
+    uint32_t commits() {return m_commits;};
+  private:
+    uint8_t m_data[4096];
+    size_t m_size = 0;
+    uint32_t m_commits = 0;
+};
+
+extern EEPROMClass EEPROM;
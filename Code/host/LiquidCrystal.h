@@ -0,0 +1,21 @@
+// Host mock of the LiquidCrystal library. Keeps the text in memory, see host_lcd_line().
+#pragma once
+#include "Arduino.h"
+
+class LiquidCrystal {
+  public:
+    LiquidCrystal(uint8_t rs, uint8_t en, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7) {};
+    void begin(int cols, int rows) {m_cols = cols < 40 ? cols : 40; clear();};
+    void clear();
+    void setCursor(int col, int row) {m_col = col; m_row = row & 1;};
+    void print(const char *s);
+    void print(char c) {char s[2] = {c, '\0'}; print(s);};
+    void print(int v) {char s[16]; snprintf(s, sizeof(s), "%d", v); print(s);};
+    void print(double v) {char s[32]; snprintf(s, sizeof(s), "%.2f", v); print(s);};
+    const char *line(int row) {return m_text[row & 1];};
+  private:
+    int m_cols = 16;
+    int m_col = 0;
+    int m_row = 0;
+    char m_text[2][41];
+};
@@ -0,0 +1,3 @@
+// Host mock of the I2C library, not used by the firmware yet
+#pragma once
+#include "Arduino.h"
@@ -0,0 +1,3 @@
+// Some of the sources include the Arduino header in lower case
+#pragma once
+#include "Arduino.h"
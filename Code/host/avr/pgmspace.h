@@ -0,0 +1,5 @@
+// Host mock of the AVR program memory macros
+#pragma once
+#include <cstring>
+#define PROGMEM
+#define strcpy_P strcpy
@@ -0,0 +1,12 @@
+// Host mock of elapsedMillis, running on virtual time
+#pragma once
+#include "Arduino.h"
+
+class elapsedMillis {
+  public:
+    elapsedMillis() {m_start = millis();};
+    operator uint32_t() const {return millis() - m_start;};
+    elapsedMillis &operator=(uint32_t v) {m_start = millis() - v; return *this;};
+  private:
+    uint32_t m_start;
+};
@@ -0,0 +1,15 @@
+// Host mock of the pico SDK register types and bit access, shared by the hardware mocks
+#pragma once
+#include <cstdint>
+
+typedef volatile uintptr_t io_rw_32;
+
+// A status register where writing a one clears the bit
+struct host_w1c_reg {
+  volatile uint32_t bits;
+  void operator=(uint32_t mask) volatile {bits &= ~mask;};
+  operator uint32_t() const volatile {return bits;};
+};
+
+static inline void hw_clear_bits(io_rw_32 *addr, uint32_t mask) {*addr &= ~(uintptr_t)mask;}
+static inline void hw_set_bits(io_rw_32 *addr, uint32_t mask) {*addr |= mask;}
@@ -0,0 +1,11 @@
+// Host mock of the pico SDK clocks. The virtual time is counted in cycles of a fixed system
+// clock, so it can not be changed, see host_mock.cpp.
+#pragma once
+#include <cstdint>
+
+typedef unsigned int uint;
+
+enum clock_index {clk_gpout0 = 0, clk_gpout1, clk_gpout2, clk_gpout3, clk_ref, clk_sys, clk_peri, clk_hstx, clk_usb, clk_adc};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+void set_sys_clock_pll(uint32_t vco_freq, uint post_div1, uint post_div2);
@@ -0,0 +1,78 @@
+// Host mock of the pico SDK DMA API. The channel registers are plain memory, wide enough 
+// to hold host pointers, and are the live state of the DMA model in host_hw.cpp. Channel 
+// configurations are kept decoded.
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "hardware/address_mapped.h"
+
+typedef unsigned int uint;
+
+typedef struct {
+  io_rw_32 read_addr;
+  io_rw_32 write_addr;
+  io_rw_32 transfer_count;
+  io_rw_32 ctrl_trig;
+  io_rw_32 al1_ctrl;
+  io_rw_32 al1_read_addr;
+  io_rw_32 al1_write_addr;
+  io_rw_32 al1_transfer_count_trig;
+  io_rw_32 al2_ctrl;
+  io_rw_32 al2_transfer_count;
+  io_rw_32 al2_read_addr;
+  io_rw_32 al2_write_addr_trig;
+  io_rw_32 al3_ctrl;
+  io_rw_32 al3_write_addr;
+  io_rw_32 al3_transfer_count;
+  io_rw_32 al3_read_addr_trig;
+} dma_channel_hw_t;
+
+#define NUM_DMA_CHANNELS 16
+
+typedef struct {
+  dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+  io_rw_32 intr;
+  io_rw_32 inte0;
+  io_rw_32 intf0;
+  host_w1c_reg ints0;
+} dma_hw_t;
+
+extern dma_hw_t *dma_hw;
+
+#define DMA_CH0_CTRL_TRIG_EN_BITS 0x1u
+
+enum dma_channel_transfer_size {DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2};
+
+typedef struct {
+  uint32_t ctrl;
+  enum dma_channel_transfer_size size;
+  bool read_increment;
+  bool write_increment;
+  bool ring_write;
+  uint ring_size_bits;
+  uint chain_to;
+  uint dreq;
+  bool irq_quiet;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+void dma_channel_cleanup(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits);
+void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, 
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_channel_start(uint channel);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq0_status(uint channel);
+void dma_channel_acknowledge_irq0(uint channel);
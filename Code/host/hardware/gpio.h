@@ -0,0 +1,8 @@
+// Host mock of the pico SDK GPIO functions
+#pragma once
+#include <cstdint>
+
+typedef unsigned int uint;
+
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
@@ -0,0 +1,13 @@
+// Host mock of the pico SDK interrupt controller functions
+#pragma once
+#include <cstdint>
+
+typedef unsigned int uint;
+typedef void (*irq_handler_t)(void);
+
+enum {TIMER0_IRQ_0 = 0, DMA_IRQ_0 = 10, DMA_IRQ_1 = 11, HOST_NUM_IRQS = 64};
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_remove_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+void irq_set_priority(uint num, uint8_t hardware_priority);
@@ -0,0 +1,63 @@
+// Host mock of the pico SDK PIO API. The pio_serialiser and toggle programs are modelled 
+// in host_hw.cpp, other programs do nothing.
+#pragma once
+#include <cstdint>
+#include "hardware/dma.h"
+
+typedef struct {
+  io_rw_32 ctrl;
+  io_rw_32 fstat;
+  host_w1c_reg fdebug;
+  io_rw_32 flevel;
+  io_rw_32 txf[4];
+  io_rw_32 rxf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t host_pio_hw[2];
+#define pio0 (&host_pio_hw[0])
+#define pio1 (&host_pio_hw[1])
+
+#define PIO_FDEBUG_TXSTALL_LSB 24
+
+typedef struct pio_program {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+} pio_program_t;
+
+typedef struct {
+  uint32_t execctrl;
+  uint32_t shiftctrl;
+  uint8_t out_base;
+  uint8_t out_count;
+  uint8_t set_base;
+  uint8_t set_count;
+  uint8_t fifo_join;
+  float clkdiv;
+} pio_sm_config;
+
+enum pio_fifo_join {PIO_FIFO_JOIN_NONE = 0, PIO_FIFO_JOIN_TX = 1, PIO_FIFO_JOIN_RX = 2};
+
+static inline pio_sm_config pio_get_default_sm_config() {pio_sm_config c = {0, 0, 0, 32, 0, 5, 0, 1.0f}; return c;}
+static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {c->execctrl = (wrap_target << 8) | wrap;}
+static inline void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) {c->out_base = out_base; c->out_count = out_count;}
+static inline void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count) {c->set_base = set_base; c->set_count = set_count;}
+static inline void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) {c->fifo_join = join;}
+static inline void sm_config_set_clkdiv(pio_sm_config *c, float div) {c->clkdiv = div;}
+static inline void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold) 
+  {c->shiftctrl = shift_right | (autopull << 1) | (pull_threshold << 2);}
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_sm_unclaim(PIO pio, uint sm);
+void pio_gpio_init(PIO pio, uint pin);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
@@ -0,0 +1,10 @@
+// Host mock of the pico SDK interrupt masking. The host simulation is single threaded and 
+// interrupts only run from host_advance_us() and __wfi(), so there is nothing to mask.
+#pragma once
+#include <cstdint>
+
+static inline uint32_t save_and_disable_interrupts() {return 0;}
+static inline void restore_interrupts(uint32_t status) {(void)status;}
+
+// Waits for an interrupt on virtual time, see host_mock.cpp
+void __wfi();
@@ -0,0 +1,36 @@
+// Host mock of the pico SDK hardware alarms. Writing an alarm register arms it on virtual time, 
+// see host_mock.cpp. When it fires, its bit in intr is set and, if enabled in inte, the 
+// interrupt TIMER0_IRQ_0 + n is raised. Writing a one to armed disarms.
+#pragma once
+#include <cstdint>
+#include "hardware/address_mapped.h"
+#include "hardware/irq.h"
+
+#define NUM_ALARMS 4
+
+struct host_timer_alarm_reg {
+  void operator=(uint32_t target) volatile;
+};
+
+struct host_timer_armed_reg {
+  void operator=(uint32_t mask) volatile;
+  operator uint32_t() const volatile;
+};
+
+struct host_timer_time_reg {
+  operator uint32_t() const volatile;
+};
+
+typedef struct {
+  host_timer_alarm_reg alarm[NUM_ALARMS];
+  host_timer_armed_reg armed;
+  host_timer_time_reg timerawl;
+  io_rw_32 inte;
+  host_w1c_reg intr;
+} timer_hw_t;
+
+extern timer_hw_t *timer_hw;
+
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_unclaim(uint alarm_num);
+static inline uint hardware_alarm_get_irq_num(uint alarm_num) {return TIMER0_IRQ_0 + alarm_num;}
@@ -0,0 +1,6 @@
+// Host mock of the pico SDK voltage regulator
+#pragma once
+
+enum vreg_voltage {VREG_VOLTAGE_1_05 = 11, VREG_VOLTAGE_1_10, VREG_VOLTAGE_1_15, VREG_VOLTAGE_1_20, VREG_VOLTAGE_1_25, VREG_VOLTAGE_1_30};
+
+static inline void vreg_set_voltage(enum vreg_voltage voltage) {(void)voltage;}
@@ -0,0 +1,83 @@
+// Control of the host simulation. Time only moves when host_advance_us() is called, when the 
+// firmware sleeps, or while it polls the DMA. Due alarms and raised interrupts run from there.
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+const int HOST_NUM_PINS = 48;
+const uint64_t HOST_CLOCK_HZ = 200000000; // System clock, the unit of the virtual time
+const uint64_t HOST_CLOCKS_PER_US = HOST_CLOCK_HZ/1000000;
+const uint64_t host_flash_write_us = 45000; // EEPROM.commit(), a sector erase and program
+
+// A change of an output pin
+typedef struct {
+  uint64_t t_us;
+  uint8_t pin;
+  bool level;
+} host_edge_t;
+
+// A piece of the RF output of a state machine. Two bits per clock cycle, the first pin in the
+// low bit, 16 clock cycles per word starting from the least significant end. When words is 
+// NULL the pins stay at 'hold' during the span, e.g. when the TX FIFO has run empty.
+// Pins that are not driven read as 0. Between spans the state machine is not running.
+// If the words come from a buffer that is sent as a whole, like a DMA buffer, source points 
+// at it, so that results for the buffer can be reused for the next time it is sent.
+typedef struct {
+  uint64_t clock;          // Clock cycle of the first sample
+  uint64_t n_clocks;
+  const uint32_t *words;   // Only valid during the call
+  uint8_t hold;
+  uint8_t first_pin;
+  const uint32_t *source;  // The buffer, or NULL
+  uint64_t source_words;
+  uint64_t source_clock;   // Clock cycle of the first sample of the buffer
+} host_rf_span_t;
+
+typedef void (*host_rf_sink_t)(const host_rf_span_t *span, void *user);
+
+uint64_t host_time_us();
+uint64_t host_time_clk();
+void host_advance_us(uint64_t us);
+void host_advance_to_clk(uint64_t t_clk);
+void host_spin(uint64_t clocks);
+// Something outside the firmware, like console input, happens at t_clk, so a WFI ends there
+void host_wake_at_clk(uint64_t t_clk);
+uint64_t host_wake_clk();
+uint64_t host_sleep_clocks();
+
+// The console. Input becomes available to Serial.read() at the current virtual time.
+void host_serial_input(const char *s);
+void host_serial_input_bytes(const uint8_t *data, size_t n);
+size_t host_serial_pending();
+uint64_t host_serial_last_read_us();
+void host_serial_quiet(bool quiet);
+// The rate the PC reads the console output at. Negative is without limit, the default, and 0 is
+// a port that is not read. Returns the number of bytes written when the transmit buffer was full.
+void host_serial_tx_rate(double bytes_per_s);
+uint64_t host_serial_tx_full();
+// Called with every byte of console output, e.g. to read the binary frames (binproto.h)
+void host_serial_set_sink(void (*sink)(uint8_t c, void *user), void *user);
+
+// The on-chip temperature sensor reads celsius plus celsius_per_s times the virtual time
+void host_set_temperature(double celsius, double celsius_per_s);
+
+// Pins
+void host_set_pin_input(int pin, bool level);
+bool host_pin_level(int pin);
+void host_set_pin_level(int pin, bool level);
+const host_edge_t *host_edges(size_t *n);
+void host_clear_edges();
+
+// Interrupts
+void host_raise_irq(unsigned int num);
+bool host_irq_enabled(unsigned int num);
+
+// DMA and PIO model
+uint64_t host_hw_run(uint64_t until_clk);
+void host_set_rf_sink(host_rf_sink_t sink, void *user);
+uint64_t host_pio_stalls();
+uint64_t host_pio_stall_clocks();
+uint64_t host_dma_transfers();
+
+// Misc state
+uint32_t host_eeprom_commits();
@@ -0,0 +1,460 @@
+// Analog output chain and emission mask check, see host_chain.h.
+//
+// The chain is a cascade of sections, given as text separated by spaces or semicolons:
+//   rc:fc               First order low-pass
+//   lp:fc,q             Second order low-pass
+//   hp:fc,q             Second order high-pass
+//   bp:f0,q             Second order band-pass, e.g. a series resonant antenna
+//   bw:n,fc             Butterworth low-pass of order n
+//   ladder:r,e1,e2,...  LC ladder between a source and a load of r ohm (or rs/rl). The elements
+//                       are L<henry> series inductor, C<farad> shunt capacitor, R<ohm> series
+//                       resistor, Cs<farad> series capacitor and Lp<henry> shunt inductor.
+// Values take the suffixes p, n, u, m, k, M and G, e.g. "ladder:50,C820p,L3.3u,C820p bp:3.55M,8".
+// A ladder is scaled so that it has 0 dB gain without elements.
+//
+// The chain is linear, so its output spectrum is the spectrum of the RF output times the
+// response of the chain. The spectrum is calculated once, from EMISSION_CLOCKS clock cycles
+// of the output, and then each chain is only a multiplication.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "host_chain.h"
+
+typedef std::complex<double> complex_t;
+
+static const int EMISSION_BITS = 20;
+static const uint64_t EMISSION_CLOCKS = 1ull << EMISSION_BITS; // 5.24 ms, 190.7 Hz per bin
+static const int TONE_BINS = 4;             // Half width of the main lobe of the window
+static const double CLOSE_IN_HZ = 500e3;    // Spurs closer to the carrier than this are close-in
+static const double CARRIER_GAP_HZ = 2e3;   // and further away than this
+static const int HARMONICS = 10;
+
+typedef struct {
+  char type;          // 'L', 'C', 'R', 'c' (series C) or 'l' (shunt L)
+  double value;
+} chain_element_t;
+
+typedef struct {
+  std::string type;
+  double f0;
+  double q;
+  int order;
+  double rs, rl;
+  std::vector<chain_element_t> elements;
+} chain_section_t;
+
+struct host_chain {
+  std::vector<chain_section_t> sections;
+};
+
+struct host_emission {
+  uint64_t start_clk;
+  uint64_t captured;          // Clock cycles of output seen
+  std::vector<double> x;      // The output, -1, 0 or 1 per clock cycle
+  std::vector<double> power;  // Power spectrum, once calculated
+};
+
+
+// A value with an optional SI prefix, e.g. 3.3u. Returns false if there is no number.
+static bool parse_value(const char *s, char **end, double *value)
+{
+  *value = strtod(s, end);
+  if(*end == s) {
+    return false;
+  }
+  const char *prefixes = "pnumkMG";
+  static const double scales[] = {1e-12, 1e-9, 1e-6, 1e-3, 1e3, 1e6, 1e9};
+  const char *p = **end ? strchr(prefixes, **end) : NULL;
+  if(p) {
+    *value *= scales[p - prefixes];
+    (*end)++;
+  }
+  return true;
+}
+
+
+// The numbers after the colon of a section, separated by commas
+static int parse_numbers(const char *s, double *v, int max)
+{
+  int n = 0;
+  char *end;
+  while(n < max && parse_value(s, &end, &v[n])) {
+    n++;
+    if(*end != ',') {
+      return *end ? -1 : n;
+    }
+    s = end + 1;
+  }
+  return n;
+}
+
+
+static bool parse_ladder(chain_section_t *sec, const char *s)
+{
+  char *end;
+  if(!parse_value(s, &end, &sec->rs)) {
+    return false;
+  }
+  sec->rl = sec->rs;
+  if(*end == '/' && !parse_value(end + 1, &end, &sec->rl)) {
+    return false;
+  }
+  while(*end == ',') {
+    s = end + 1;
+    chain_element_t e;
+    if(strncmp(s, "Cs", 2) == 0 || strncmp(s, "Lp", 2) == 0) {
+      e.type = s[0] == 'C' ? 'c' : 'l';
+      s += 2;
+    } else if(*s == 'L' || *s == 'C' || *s == 'R') {
+      e.type = *s++;
+    } else {
+      return false;
+    }
+    if(!parse_value(s, &end, &e.value) || e.value <= 0) {
+      return false;
+    }
+    sec->elements.push_back(e);
+  }
+  return *end == 0 && sec->rs > 0 && sec->rl > 0;
+}
+
+
+static bool parse_section(chain_section_t *sec, const std::string &text)
+{
+  size_t colon = text.find(':');
+  if(colon == std::string::npos) {
+    return false;
+  }
+  sec->type = text.substr(0, colon);
+  const char *args = text.c_str() + colon + 1;
+  double v[2];
+  int n;
+
+  sec->q = M_SQRT1_2;
+  sec->order = 0;
+  if(sec->type == "ladder") {
+    return parse_ladder(sec, args);
+  }
+  n = parse_numbers(args, v, 2);
+  if(sec->type == "rc") {
+    sec->f0 = v[0];
+    return n == 1 && sec->f0 > 0;
+  }
+  if(sec->type == "lp" || sec->type == "hp" || sec->type == "bp") {
+    sec->f0 = v[0];
+    if(n == 2) {
+      sec->q = v[1];
+    }
+    return n >= 1 && sec->f0 > 0 && sec->q > 0;
+  }
+  if(sec->type == "bw") {
+    sec->order = (int)v[0];
+    sec->f0 = v[1];
+    return n == 2 && sec->order >= 1 && sec->order <= 20 && sec->f0 > 0;
+  }
+  return false;
+}
+
+
+// Parse a chain, see the top of the file. Prints what is wrong and returns NULL on errors.
+host_chain_t *host_chain_parse(const char *spec)
+{
+  host_chain_t *chain = new host_chain_t();
+  std::string s = spec;
+
+  for(size_t pos = 0; pos < s.size(); ) {
+    size_t end = s.find_first_of(" ;", pos);
+    if(end == std::string::npos) {
+      end = s.size();
+    }
+    if(end > pos) {
+      chain_section_t sec;
+      std::string text = s.substr(pos, end - pos);
+      if(!parse_section(&sec, text)) {
+        fprintf(stderr, "Bad output chain section '%s'\n", text.c_str());
+        delete chain;
+        return NULL;
+      }
+      chain->sections.push_back(sec);
+    }
+    pos = end + 1;
+  }
+  return chain;
+}
+
+
+void host_chain_free(host_chain_t *chain)
+{
+  delete chain;
+}
+
+
+static complex_t second_order(const std::string &type, complex_t s, double w0, double q)
+{
+  complex_t den = s*s + s*w0/q + w0*w0;
+  if(type == "hp") {
+    return s*s/den;
+  }
+  if(type == "bp") {
+    return s*w0/q/den;
+  }
+  return w0*w0/den;
+}
+
+
+// Voltage on the load over the voltage on a matched load without the ladder, from the
+// ABCD matrix of the cascaded elements
+static complex_t ladder_response(const chain_section_t *sec, complex_t s)
+{
+  complex_t a = 1, b = 0, c = 0, d = 1;
+
+  for(const chain_element_t &e : sec->elements) {
+    complex_t z = 0, y = 0; // Series impedance or shunt admittance
+    switch(e.type) {
+      case 'L': z = s*e.value; break;
+      case 'R': z = e.value; break;
+      case 'c': z = 1.0/(s*e.value); break;
+      case 'C': y = s*e.value; break;
+      case 'l': y = 1.0/(s*e.value); break;
+    }
+    // Multiply by [1 z; 0 1] or [1 0; y 1] on the right
+    complex_t a2 = a + b*y, c2 = c + d*y;
+    b = a*z + b;
+    d = c*z + d;
+    a = a2;
+    c = c2;
+  }
+  return (sec->rs + sec->rl)/(a*sec->rl + b + sec->rs*(c*sec->rl + d));
+}
+
+
+complex_t host_chain_response(const host_chain_t *chain, double f_hz)
+{
+  complex_t s(0, 2*M_PI*f_hz);
+  complex_t h = 1;
+
+  for(const chain_section_t &sec : chain->sections) {
+    double w0 = 2*M_PI*sec.f0;
+    if(sec.type == "rc") {
+      h *= 1.0/(1.0 + s/w0);
+    } else if(sec.type == "bw") {
+      for(int k = 1; k <= sec.order/2; k++) {
+        h *= second_order("lp", s, w0, 1/(2*sin((2*k - 1)*M_PI/(2*sec.order))));
+      }
+      if(sec.order % 2) {
+        h *= 1.0/(1.0 + s/w0);
+      }
+    } else if(sec.type == "ladder") {
+      h *= ladder_response(&sec, s);
+    } else {
+      h *= second_order(sec.type, s, w0, sec.q);
+    }
+  }
+  return h;
+}
+
+
+host_emission_t *host_emission_open(uint64_t start_clk)
+{
+  host_emission_t *e = new host_emission_t();
+  e->start_clk = start_clk;
+  e->x.assign(EMISSION_CLOCKS, 0);
+  return e;
+}
+
+
+void host_emission_span(host_emission_t *e, const host_rf_span_t *span)
+{
+  uint64_t end = e->start_clk + EMISSION_CLOCKS;
+  uint64_t c = std::max(span->clock, e->start_clk);
+  uint64_t span_end = std::min(span->clock + span->n_clocks, end);
+
+  for(; c < span_end; c++) {
+    uint64_t ii = c - span->clock;
+    uint32_t bits = span->words ? span->words[ii/16] >> (2*(ii % 16)) : span->hold;
+    e->x[c - e->start_clk] = (int)(bits & 1) - (int)((bits >> 1) & 1);
+  }
+  if(span_end > e->start_clk && span_end - e->start_clk > e->captured) {
+    e->captured = span_end - e->start_clk;
+  }
+}
+
+
+// In-place radix 2 FFT
+static void fft(std::vector<complex_t> &v)
+{
+  size_t n = v.size();
+  for(size_t ii = 1, j = 0; ii < n; ii++) {
+    size_t bit = n >> 1;
+    for(; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if(ii < j) {
+      std::swap(v[ii], v[j]);
+    }
+  }
+  for(size_t len = 2; len <= n; len *= 2) {
+    std::vector<complex_t> w(len/2);
+    for(size_t k = 0; k < len/2; k++) {
+      w[k] = std::polar(1.0, -2*M_PI*k/len);
+    }
+    for(size_t ii = 0; ii < n; ii += len) {
+      for(size_t k = 0; k < len/2; k++) {
+        complex_t t = w[k]*v[ii + k + len/2];
+        v[ii + k + len/2] = v[ii + k] - t;
+        v[ii + k] += t;
+      }
+    }
+  }
+}
+
+
+// Power spectrum of the capture with a Blackman-Harris window, scaled so that a sine with
+// amplitude 1 has power 1 summed over its main lobe
+static void calc_spectrum(host_emission_t *e)
+{
+  std::vector<complex_t> v(EMISSION_CLOCKS);
+  double w2sum = 0;
+
+  for(uint64_t ii = 0; ii < EMISSION_CLOCKS; ii++) {
+    double t = 2*M_PI*ii/EMISSION_CLOCKS;
+    double w = 0.35875 - 0.48829*cos(t) + 0.14128*cos(2*t) - 0.01168*cos(3*t);
+    v[ii] = e->x[ii]*w;
+    w2sum += w*w;
+  }
+  fft(v);
+  // By Parseval a sine with amplitude A sums to A^2*N*w2sum/4 on each side
+  double scale = 4/(w2sum*EMISSION_CLOCKS);
+  e->power.resize(EMISSION_CLOCKS/2);
+  for(uint64_t k = 0; k < EMISSION_CLOCKS/2; k++) {
+    e->power[k] = std::norm(v[k])*scale;
+  }
+}
+
+
+static double to_dB(double p)
+{
+  return p > 0 ? 10*log10(p) : -400;
+}
+
+
+// Power of a tone at bin k, summed over the main lobe of the window
+static double tone_power(const std::vector<double> &p, int64_t k)
+{
+  double sum = 0;
+  for(int64_t j = k - TONE_BINS; j <= k + TONE_BINS; j++) {
+    if(j >= 0 && j < (int64_t)p.size()) {
+      sum += p[j];
+    }
+  }
+  return sum;
+}
+
+
+// Check the spectrum after the chain against the mask and print the result. Returns true if
+// it passes.
+bool host_emission_check(host_emission_t *e, double carrier_hz, const char *chain_spec, const host_mask_t *mask)
+{
+  auto start = std::chrono::steady_clock::now();
+  host_chain_t *chain = host_chain_parse(chain_spec);
+  if(!chain) {
+    return false;
+  }
+  if(e->power.empty()) {
+    calc_spectrum(e);
+  }
+
+  double bin_hz = (double)HOST_CLOCK_HZ/EMISSION_CLOCKS;
+  int64_t n_bins = e->power.size();
+  std::vector<double> p(n_bins);
+  for(int64_t k = 1; k < n_bins; k++) { // Not DC, where series capacitors divide by zero
+    p[k] = e->power[k]*std::norm(host_chain_response(chain, k*bin_hz));
+  }
+  host_chain_free(chain);
+
+  int64_t k0 = llround(carrier_hz/bin_hz);
+  if(k0 < TONE_BINS || k0 + TONE_BINS >= n_bins) {
+    printf("Carrier %.1f Hz out of range\n", carrier_hz);
+    return false;
+  }
+  double carrier = tone_power(p, k0);
+  printf("Emissions with output chain '%s':\n", chain_spec);
+  if(e->captured < EMISSION_CLOCKS) {
+    printf("  Only %.3f of %.3f ms captured\n", e->captured*1e3/HOST_CLOCK_HZ, EMISSION_CLOCKS*1e3/HOST_CLOCK_HZ);
+  }
+  if(carrier <= 0) {
+    printf("  No carrier at %.1f Hz, is the key down?\n", carrier_hz);
+    return false;
+  }
+  printf("  Carrier %.1f Hz, %.2f dB (%.2f dB before the chain)\n", carrier_hz, to_dB(carrier),
+         to_dB(tone_power(e->power, k0)));
+
+  // Harmonics
+  bool pass = true;
+  std::vector<bool> is_tone(n_bins, false);
+  for(int64_t j = k0 - TONE_BINS; j <= k0 + TONE_BINS; j++) {
+    is_tone[j] = true;
+  }
+  printf("  Harmonics (dBc):");
+  for(int h = 2; h <= HARMONICS && h*carrier_hz < HOST_CLOCK_HZ/2 - TONE_BINS*bin_hz; h++) {
+    int64_t k = llround(h*carrier_hz/bin_hz);
+    double dBc = to_dB(tone_power(p, k)/carrier);
+    for(int64_t j = k - TONE_BINS; j <= k + TONE_BINS; j++) {
+      is_tone[j] = true;
+    }
+    pass &= dBc <= mask->harmonic_dBc;
+    printf(" %d:%.1f%s", h, dBc, dBc > mask->harmonic_dBc ? "!" : "");
+  }
+  printf("\n");
+
+  // The strongest other emissions, measured like a tone centered on each bin
+  double close_max = 0, far_max = 0;
+  int64_t close_k = -1, far_k = -1;
+  for(int64_t k = TONE_BINS; k < n_bins - TONE_BINS; k++) {
+    bool tone = false;
+    for(int64_t j = k - TONE_BINS; j <= k + TONE_BINS && !tone; j++) {
+      tone = is_tone[j];
+    }
+    double offset = fabs(k - k0)*bin_hz;
+    if(tone || offset < CARRIER_GAP_HZ) {
+      continue;
+    }
+    double window = tone_power(p, k);
+    if(offset < CLOSE_IN_HZ) {
+      if(window > close_max) {
+        close_max = window;
+        close_k = k;
+      }
+    } else if(window > far_max) {
+      far_max = window;
+      far_k = k;
+    }
+  }
+  if(close_k >= 0) {
+    double dBc = to_dB(close_max/carrier);
+    pass &= dBc <= mask->spur_dBc;
+    printf("  Strongest close-in spur: %.1f dBc at %+.2f kHz%s\n", dBc, (close_k - k0)*bin_hz/1e3,
+           dBc > mask->spur_dBc ? "!" : "");
+  }
+  if(far_k >= 0) {
+    double dBc = to_dB(far_max/carrier);
+    pass &= dBc <= mask->spur_dBc;
+    printf("  Strongest other emission: %.1f dBc at %.4f MHz%s\n", dBc, far_k*bin_hz/1e6,
+           dBc > mask->spur_dBc ? "!" : "");
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  printf("  Mask (harmonics %.1f dBc, spurs %.1f dBc): %s, evaluated in %.1f ms\n", mask->harmonic_dBc,
+         mask->spur_dBc, pass ? "pass" : "FAIL", ms);
+  return pass;
+}
+
+
+void host_emission_close(host_emission_t *e)
+{
+  delete e;
+}
@@ -0,0 +1,25 @@
+// Model of the analog output chain (the low-pass filter, the matching and the antenna) and
+// an emission mask check of the RF output after it. The RF output is captured once and its
+// spectrum calculated, then any number of chain configurations can be evaluated on it.
+#pragma once
+#include <cstdint>
+#include <complex>
+#include "host.h"
+
+typedef struct host_chain host_chain_t;
+typedef struct host_emission host_emission_t;
+
+// Limits of the emission mask, relative to the carrier
+typedef struct {
+  double harmonic_dBc;
+  double spur_dBc;
+} host_mask_t;
+
+host_chain_t *host_chain_parse(const char *spec);
+std::complex<double> host_chain_response(const host_chain_t *chain, double f_hz);
+void host_chain_free(host_chain_t *chain);
+
+host_emission_t *host_emission_open(uint64_t start_clk);
+void host_emission_span(host_emission_t *e, const host_rf_span_t *span);
+bool host_emission_check(host_emission_t *e, double carrier_hz, const char *chain_spec, const host_mask_t *mask);
+void host_emission_close(host_emission_t *e);
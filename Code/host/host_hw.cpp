@@ -0,0 +1,920 @@
+// Host model of the DMA and the PIO. The DMA channels run from the dma_hw registers, so
+// the register writes of the firmware and of the chained channels themselves take effect
+// like on the chip. The pio_serialiser program consumes one word from the TX FIFO per 16
+// clock cycles and the toggle program is run with the fractional clock divider, which
+// gives the exact pin waveform per clock cycle, see host_set_rf_sink().
+//
+// Long stretches where the only busy channel streams a buffer into a full FIFO are done in
+// one step, so the cost is per buffer rather than per word.
+#include <vector>
+#include "Arduino.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/irq.h"
+#include "pio_stream.h"
+#include "toggle.h"
+#include "host.h"
+
+alignas(256) static dma_hw_t dma_hw_regs;
+dma_hw_t *dma_hw = &dma_hw_regs;
+pio_hw_t host_pio_hw[2];
+
+static const uint DREQ_FORCE = 0x3f;
+static const uint64_t DMA_TRANSFER_CLOCKS = 4; // Estimate, incl. bus arbitration and chain triggers
+static const uint64_t DMA_POLL_CLOCKS = 8;     // Time spent by the CPU per busy poll
+static const int PIO_SM_COUNT = 4;
+static const int FIFO_MAX = 8;
+static const int SPAN_CHUNK_WORDS = 1024;
+
+typedef struct {
+  bool busy;
+  uint32_t reload;  // Transfer count loaded when triggered
+  uint64_t ready;   // Clock cycle of the next transfer
+  uintptr_t start;  // Read address when triggered
+} dma_state_t;
+
+typedef enum {SM_OTHER, SM_SERIALISER, SM_TOGGLE} sm_kind_t;
+
+typedef struct {
+  sm_kind_t kind;
+  bool enabled;
+  uint8_t first_pin;
+  uint8_t drive;          // Driven RF pins, first pin in bit 0, see update_drive()
+  uint32_t fifo[FIFO_MAX];
+  int fifo_head, fifo_n, fifo_depth;
+  // pio_serialiser
+  uint64_t next_pull;     // Clock cycle when the next word is needed
+  bool stalled;
+  uint64_t stall_start;
+  uint8_t last_bits;
+  // toggle
+  uint32_t div_int, div_frac;
+  std::vector<uint32_t> table; // One period of the waveform, 16 clocks per word
+  uint64_t table_clocks;
+  uint64_t origin;        // Clock cycle where the program started
+  uint64_t emitted;       // The waveform has been given to the sink up to here
+} sm_state_t;
+
+static uint16_t dma_claimed = 0;
+static dma_channel_config dma_config[NUM_DMA_CHANNELS];
+static dma_state_t dma_state[NUM_DMA_CHANNELS];
+static uint8_t pio_sm_claimed[2];
+static uint8_t pio_program_words[2];
+static const pio_program_t *pio_loaded[2][32];
+static uint32_t pio_pindirs[2]; // Pins driven by each PIO
+static sm_state_t sm_state[2][PIO_SM_COUNT];
+
+static uint64_t hw_clock = 0;
+static bool irq_raised;
+static host_rf_sink_t rf_sink = NULL;
+static void *rf_sink_user = NULL;
+static uint64_t stalls = 0;
+static uint64_t stall_clocks = 0;
+static uint64_t transfers = 0;
+
+
+static int pio_index(PIO pio)
+{
+  return pio == pio1 ? 1 : 0;
+}
+
+
+// Bring the model up to the current time before the firmware changes it. Interrupts raised
+// on the way stay pending until the firmware returns to the simulation.
+static void sync()
+{
+  uint64_t now = host_time_clk();
+  while(hw_clock < now) {
+    host_hw_run(now);
+  }
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// RF output
+
+void host_set_rf_sink(host_rf_sink_t sink, void *user)
+{
+  rf_sink = sink;
+  rf_sink_user = user;
+}
+
+
+uint64_t host_pio_stalls()
+{
+  return stalls;
+}
+
+
+uint64_t host_pio_stall_clocks()
+{
+  return stall_clocks;
+}
+
+
+uint64_t host_dma_transfers()
+{
+  return transfers;
+}
+
+
+static void emit_words(sm_state_t *s, uint64_t clock, const uint32_t *words, uint64_t n_clocks,
+                       const uint32_t *source = NULL, uint64_t source_words = 0, uint64_t source_clock = 0)
+{
+  static const uint32_t drive_masks[4] = {0, 0x55555555, 0xaaaaaaaa, 0xffffffff};
+  uint32_t buf[SPAN_CHUNK_WORDS];
+  host_rf_span_t span = {clock, n_clocks, words, 0, s->first_pin, source, source_words, source_clock};
+
+  if(s->drive == 3) {
+    rf_sink(&span, rf_sink_user);
+    return;
+  }
+  // Mask the pins that are not driven, in chunks. The words then differ from the source.
+  span.source = NULL;
+  while(n_clocks > 0) {
+    uint64_t n = n_clocks < 16*SPAN_CHUNK_WORDS ? n_clocks : 16*SPAN_CHUNK_WORDS;
+    for(uint64_t ii = 0; ii < (n + 15)/16; ii++) {
+      buf[ii] = words[ii] & drive_masks[s->drive];
+    }
+    span.clock = clock;
+    span.n_clocks = n;
+    span.words = buf;
+    rf_sink(&span, rf_sink_user);
+    clock += n;
+    words += n/16;
+    n_clocks -= n;
+  }
+}
+
+
+static void emit_hold(sm_state_t *s, uint64_t clock, uint64_t n_clocks, uint8_t bits)
+{
+  host_rf_span_t span = {clock, n_clocks, NULL, (uint8_t)(bits & s->drive), s->first_pin, NULL, 0, 0};
+  if(n_clocks > 0) {
+    rf_sink(&span, rf_sink_user);
+  }
+}
+
+
+// One period of the toggle program with the fractional divider. The state machine runs an
+// instruction when the divider counter wraps, every div_int or div_int+1 clock cycles, so
+// the pattern repeats after 256 instructions.
+static void build_toggle_table(sm_state_t *s)
+{
+  uint64_t div_int = s->div_int ? s->div_int : 65536;
+  uint64_t period = 256*div_int + s->div_frac;
+  uint64_t clocks = period;
+  while(clocks % 16) {
+    clocks += period;
+  }
+  s->table.assign(clocks/16, 0);
+  s->table_clocks = clocks;
+
+  uint64_t t = 0;
+  uint32_t acc = 0;
+  uint64_t instr = 0;
+  while(t < clocks) {
+    acc += s->div_frac;
+    uint64_t n = div_int + (acc >> 8);
+    acc &= 0xff;
+    bool high = (instr++ & 1) == 0; // set pins, 1 then set pins, 0
+    for(uint64_t ii = 0; ii < n && t < clocks; ii++, t++) {
+      if(high) {
+        s->table[t/16] |= 1u << (2*(t % 16));
+      }
+    }
+  }
+}
+
+
+// Give the toggle waveform up to 'until' to the sink
+static void emit_toggle(sm_state_t *s, uint64_t until)
+{
+  uint32_t buf[SPAN_CHUNK_WORDS];
+
+  if(!rf_sink || s->kind != SM_TOGGLE || !s->enabled || until <= s->emitted) {
+    return;
+  }
+  if(s->drive == 0) {
+    emit_hold(s, s->emitted, until - s->emitted, 0);
+    s->emitted = until;
+    return;
+  }
+  if(s->table.empty()) {
+    build_toggle_table(s);
+  }
+  while(s->emitted < until) {
+    uint64_t offset = (s->emitted - s->origin) % s->table_clocks;
+    uint64_t n = std::min(until - s->emitted, s->table_clocks - offset); // Up to the end of the table
+    const uint32_t *table = s->table.data();
+    if(offset % 16 == 0) {
+      emit_words(s, s->emitted, &table[offset/16], n, table, s->table.size(), s->emitted - offset);
+    } else {
+      // Shift the pattern into place
+      n = std::min(n, (uint64_t)16*SPAN_CHUNK_WORDS);
+      size_t n_table = s->table.size();
+      size_t w = offset/16;
+      int shift = 2*(offset % 16);
+      for(uint64_t ii = 0; ii < (n + 15)/16; ii++) {
+        buf[ii] = (table[(w + ii) % n_table] >> shift) | (table[(w + ii + 1) % n_table] << (32 - shift));
+      }
+      emit_words(s, s->emitted, buf, n, table, s->table.size(), s->emitted - offset);
+    }
+    s->emitted += n;
+  }
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// DMA model
+
+static bool in_dma_regs(uintptr_t addr)
+{
+  return addr >= (uintptr_t)&dma_hw->ch[0] && addr < (uintptr_t)&dma_hw->ch[NUM_DMA_CHANNELS];
+}
+
+
+// The state machine whose TX FIFO is at addr, or NULL
+static sm_state_t *tx_fifo_at(uintptr_t addr)
+{
+  for(int p = 0; p < 2; p++) {
+    for(int sm = 0; sm < PIO_SM_COUNT; sm++) {
+      if(addr == (uintptr_t)&host_pio_hw[p].txf[sm]) {
+        return &sm_state[p][sm];
+      }
+    }
+  }
+  return NULL;
+}
+
+
+// The aliases of a channel map onto the read address, write address, transfer count and
+// control registers. The last register of each alias triggers the channel.
+static const int reg_read_addr = 0, reg_write_addr = 1, reg_count = 2, reg_ctrl = 3;
+static const int alias_map[16] = {reg_read_addr, reg_write_addr, reg_count, reg_ctrl,
+                                  reg_ctrl, reg_read_addr, reg_write_addr, reg_count,
+                                  reg_ctrl, reg_count, reg_read_addr, reg_write_addr,
+                                  reg_ctrl, reg_write_addr, reg_count, reg_read_addr};
+
+static void trigger(uint ch);
+
+static uintptr_t reg_read(uintptr_t addr)
+{
+  uint ch = (addr - (uintptr_t)&dma_hw->ch[0]) / sizeof(dma_channel_hw_t);
+  int reg = alias_map[(addr - (uintptr_t)&dma_hw->ch[ch]) / sizeof(io_rw_32)];
+  switch(reg) {
+    case reg_read_addr: return dma_hw->ch[ch].read_addr;
+    case reg_write_addr: return dma_hw->ch[ch].write_addr;
+    case reg_count: return dma_hw->ch[ch].transfer_count;
+    default: return dma_hw->ch[ch].al1_ctrl;
+  }
+}
+
+
+static void reg_write(uintptr_t addr, uintptr_t value)
+{
+  uint ch = (addr - (uintptr_t)&dma_hw->ch[0]) / sizeof(dma_channel_hw_t);
+  int index = (addr - (uintptr_t)&dma_hw->ch[ch]) / sizeof(io_rw_32);
+  switch(alias_map[index]) {
+    case reg_read_addr: dma_hw->ch[ch].read_addr = value; break;
+    case reg_write_addr: dma_hw->ch[ch].write_addr = value; break;
+    case reg_count: dma_state[ch].reload = value; break; // Loaded when triggered
+    default: dma_hw->ch[ch].al1_ctrl = value; break;
+  }
+  if(index % 4 == 3) {
+    trigger(ch);
+  }
+}
+
+
+static void complete(uint ch)
+{
+  dma_state[ch].busy = false;
+  if(!dma_config[ch].irq_quiet) {
+    dma_hw->ints0.bits |= 1u << ch;
+    if(dma_hw->inte0 & (1u << ch)) {
+      host_raise_irq(DMA_IRQ_0);
+      irq_raised = true;
+    }
+  }
+  if(dma_config[ch].chain_to != ch) {
+    trigger(dma_config[ch].chain_to);
+  }
+}
+
+
+static void trigger(uint ch)
+{
+  if(!(dma_hw->ch[ch].al1_ctrl & DMA_CH0_CTRL_TRIG_EN_BITS) || dma_state[ch].busy) {
+    return;
+  }
+  dma_state[ch].busy = true;
+  dma_state[ch].ready = hw_clock + DMA_TRANSFER_CLOCKS;
+  dma_state[ch].start = dma_hw->ch[ch].read_addr;
+  dma_hw->ch[ch].transfer_count = dma_state[ch].reload;
+  if(dma_state[ch].reload == 0) {
+    complete(ch);
+  }
+}
+
+
+// Registers and the dma_block_t fields are pointer sized on the host, so a 32-bit transfer
+// from or to a DMA register moves a whole register.
+static uintptr_t element_size(uint ch)
+{
+  if(dma_config[ch].size == DMA_SIZE_32 &&
+     (in_dma_regs(dma_hw->ch[ch].read_addr) || in_dma_regs(dma_hw->ch[ch].write_addr))) {
+    return sizeof(io_rw_32);
+  }
+  return (uintptr_t)1 << dma_config[ch].size;
+}
+
+
+// Increment an address, wrapping within the ring if there is one
+static uintptr_t next_addr(uintptr_t addr, uintptr_t size, uintptr_t ring_mask)
+{
+  if(ring_mask) {
+    return (addr & ~ring_mask) | ((addr + size) & ring_mask);
+  }
+  return addr + size;
+}
+
+
+// The state machine that paces a channel, or NULL if it is not paced by a TX FIFO
+static sm_state_t *paced_by(uint ch)
+{
+  uint dreq = dma_config[ch].dreq;
+  if(dreq < 16 && (dreq & 7) < 4) {
+    return &sm_state[dreq >> 3][dreq & 3];
+  }
+  return NULL;
+}
+
+
+static void serialiser_push(sm_state_t *s, uint32_t word);
+
+static void transfer(uint ch)
+{
+  dma_channel_hw_t *regs = &dma_hw->ch[ch];
+  const dma_channel_config *cfg = &dma_config[ch];
+  uintptr_t size = element_size(ch);
+  uintptr_t value = 0;
+  sm_state_t *fifo;
+
+  if(in_dma_regs(regs->read_addr)) {
+    value = reg_read(regs->read_addr);
+  } else {
+    memcpy(&value, (const void *)regs->read_addr, size);
+  }
+  uintptr_t write_addr = regs->write_addr;
+  // Update the addresses before the write, which may retrigger this channel
+  uintptr_t ring_mask = cfg->ring_size_bits ? ((uintptr_t)1 << cfg->ring_size_bits) - 1 : 0;
+  if(cfg->read_increment) {
+    regs->read_addr = next_addr(regs->read_addr, size, cfg->ring_write ? 0 : ring_mask);
+  }
+  if(cfg->write_increment) {
+    regs->write_addr = next_addr(write_addr, size, cfg->ring_write ? ring_mask : 0);
+  }
+  regs->transfer_count--;
+  dma_state[ch].ready = hw_clock + DMA_TRANSFER_CLOCKS;
+  transfers++;
+
+  if(in_dma_regs(write_addr)) {
+    reg_write(write_addr, value);
+  } else if((fifo = tx_fifo_at(write_addr)) != NULL) {
+    serialiser_push(fifo, (uint32_t)value);
+  } else {
+    memcpy((void *)write_addr, &value, size);
+  }
+  if(regs->transfer_count == 0) {
+    complete(ch);
+  }
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// pio_serialiser model
+
+static uint32_t fifo_pop(sm_state_t *s)
+{
+  uint32_t word = s->fifo[s->fifo_head];
+  s->fifo_head = (s->fifo_head + 1) % FIFO_MAX;
+  s->fifo_n--;
+  return word;
+}
+
+
+// Output a word from the FIFO, or stall with the pins unchanged if there is none
+static void serialiser_pull(sm_state_t *s, PIO pio, int sm)
+{
+  if(s->fifo_n == 0) {
+    s->stalled = true;
+    s->stall_start = hw_clock;
+    pio->fdebug.bits |= 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+    stalls++;
+    return;
+  }
+  uint32_t word = fifo_pop(s);
+  if(rf_sink) {
+    emit_words(s, hw_clock, &word, 16);
+  }
+  s->last_bits = word >> 30;
+  s->next_pull = hw_clock + 16;
+}
+
+
+static void serialiser_push(sm_state_t *s, uint32_t word)
+{
+  if(s->fifo_n == s->fifo_depth) {
+    return; // Overflow, the word is lost like on the chip
+  }
+  s->fifo[(s->fifo_head + s->fifo_n) % FIFO_MAX] = word;
+  s->fifo_n++;
+  if(s->stalled && s->enabled && s->kind == SM_SERIALISER) {
+    // Continue right away
+    s->stalled = false;
+    stall_clocks += hw_clock - s->stall_start;
+    if(rf_sink) {
+      emit_hold(s, s->stall_start, hw_clock - s->stall_start, s->last_bits);
+    }
+    int p = s >= sm_state[1] ? 1 : 0;
+    serialiser_pull(s, &host_pio_hw[p], s - sm_state[p]);
+  }
+}
+
+
+// Steady state: the channel streams a buffer into the full FIFO of the serialiser and 
+// nothing else is going on. Then the words come out of the FIFO in the order they are read, 
+// one per 16 clock cycles, and many of them can be done in one step. Returns false if the 
+// state is not steady, or if it would only be a few words.
+static bool serialiser_bulk(sm_state_t *s, uint64_t until)
+{
+  int busy_ch = -1;
+  for(uint ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+    if(dma_state[ch].busy) {
+      if(busy_ch >= 0) {
+        return false;
+      }
+      busy_ch = ch;
+    }
+  }
+  if(busy_ch < 0 || paced_by(busy_ch) != s || !(dma_hw->ch[busy_ch].al1_ctrl & DMA_CH0_CTRL_TRIG_EN_BITS) ||
+     s->fifo_n != s->fifo_depth || s->stalled || dma_state[busy_ch].ready > s->next_pull ||
+     element_size(busy_ch) != 4 || !dma_config[busy_ch].read_increment || 
+     in_dma_regs(dma_hw->ch[busy_ch].read_addr) || dma_config[busy_ch].ring_size_bits != 0) {
+    return false;
+  }
+  dma_channel_hw_t *regs = &dma_hw->ch[busy_ch];
+  uint64_t k = std::min((uint64_t)regs->transfer_count, (until - s->next_pull)/16 + 1);
+  if(k <= (uint64_t)s->fifo_depth) {
+    return false;
+  }
+
+  const uint32_t *src = (const uint32_t *)regs->read_addr;
+  uint32_t fifo[FIFO_MAX];
+  int depth = s->fifo_depth;
+  for(int ii = 0; ii < depth; ii++) {
+    fifo[ii] = s->fifo[(s->fifo_head + ii) % FIFO_MAX];
+  }
+  if(rf_sink) {
+    // The FIFO holds the end of the previous buffer or the start of this one
+    const uint32_t *source = (const uint32_t *)dma_state[busy_ch].start;
+    emit_words(s, s->next_pull, fifo, 16*depth);
+    emit_words(s, s->next_pull + 16*depth, src, 16*(k - depth), source, dma_state[busy_ch].reload,
+               s->next_pull + 16*depth - 16*(src - source));
+  }
+  // Each pull lets the channel write one more word
+  for(int ii = 0; ii < depth; ii++) {
+    s->fifo[ii] = src[k - depth + ii];
+  }
+  s->fifo_head = 0;
+  s->last_bits = src[k - depth - 1] >> 30;
+  hw_clock = s->next_pull + 16*(k - 1);
+  s->next_pull += 16*k;
+  regs->read_addr += 4*k;
+  regs->transfer_count -= k;
+  dma_state[busy_ch].ready = hw_clock + DMA_TRANSFER_CLOCKS;
+  transfers += k;
+  if(regs->transfer_count == 0) {
+    complete(busy_ch);
+  }
+  return true;
+}
+
+
+// Run the DMA and the PIO up to until_clk. Returns early, with the clock cycle, if an enabled
+// DMA interrupt was raised.
+uint64_t host_hw_run(uint64_t until_clk)
+{
+  irq_raised = false;
+  while(true) {
+    // Find the next event
+    uint64_t t = UINT64_MAX;
+    sm_state_t *pull = NULL;
+    int pull_p = 0, pull_sm = 0;
+    int ch_next = -1;
+    for(int p = 0; p < 2; p++) {
+      for(int sm = 0; sm < PIO_SM_COUNT; sm++) {
+        sm_state_t *s = &sm_state[p][sm];
+        if(s->kind == SM_SERIALISER && s->enabled && !s->stalled && s->next_pull < t) {
+          t = std::max(s->next_pull, hw_clock);
+          pull = s;
+          pull_p = p;
+          pull_sm = sm;
+        }
+      }
+    }
+    for(uint ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+      if(!dma_state[ch].busy || !(dma_hw->ch[ch].al1_ctrl & DMA_CH0_CTRL_TRIG_EN_BITS)) {
+        continue;
+      }
+      sm_state_t *s = paced_by(ch);
+      if(s && s->fifo_n >= s->fifo_depth) {
+        continue; // Waits for the state machine
+      }
+      uint64_t t_ch = std::max(dma_state[ch].ready, hw_clock);
+      if(t_ch < t) {
+        t = t_ch;
+        ch_next = ch;
+        pull = NULL;
+      }
+    }
+    if(t >= until_clk) {
+      break;
+    }
+    if(pull) {
+      if(!serialiser_bulk(pull, until_clk)) {
+        hw_clock = t;
+        serialiser_pull(pull, &host_pio_hw[pull_p], pull_sm);
+      }
+    } else {
+      hw_clock = t;
+      transfer(ch_next);
+    }
+    if(irq_raised) {
+      return hw_clock;
+    }
+  }
+  hw_clock = until_clk;
+  for(int p = 0; p < 2; p++) {
+    for(int sm = 0; sm < PIO_SM_COUNT; sm++) {
+      emit_toggle(&sm_state[p][sm], hw_clock);
+    }
+  }
+  return hw_clock;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// DMA API
+
+int dma_claim_unused_channel(bool required)
+{
+  for(int ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+    if(!(dma_claimed & (1u << ch))) {
+      dma_claimed |= 1u << ch;
+      return ch;
+    }
+  }
+  if(required) {
+    fprintf(stderr, "No free DMA channel\n");
+    exit(1);
+  }
+  return -1;
+}
+
+
+void dma_channel_unclaim(uint channel)
+{
+  dma_claimed &= ~(1u << channel);
+}
+
+
+void dma_channel_cleanup(uint channel)
+{
+  dma_channel_set_irq0_enabled(channel, false);
+  dma_channel_abort(channel);
+  dma_hw->ints0 = 1u << channel;
+}
+
+
+// The same defaults as the SDK
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+  dma_channel_config c;
+  c.ctrl = DMA_CH0_CTRL_TRIG_EN_BITS;
+  c.size = DMA_SIZE_32;
+  c.read_increment = true;
+  c.write_increment = false;
+  c.ring_write = false;
+  c.ring_size_bits = 0;
+  c.chain_to = channel;
+  c.dreq = DREQ_FORCE;
+  c.irq_quiet = false;
+  return c;
+}
+
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+  c->size = size;
+}
+
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+  c->read_increment = incr;
+}
+
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+  c->write_increment = incr;
+}
+
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+  c->dreq = dreq;
+}
+
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to)
+{
+  c->chain_to = chain_to;
+}
+
+
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits)
+{
+  c->ring_write = write;
+  c->ring_size_bits = size_bits;
+}
+
+
+void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet)
+{
+  c->irq_quiet = irq_quiet;
+}
+
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, 
+                           const volatile void *read_addr, uint transfer_count, bool trigger_now)
+{
+  sync();
+  dma_config[channel] = *config;
+  dma_hw->ch[channel].read_addr = (uintptr_t)read_addr;
+  dma_hw->ch[channel].write_addr = (uintptr_t)write_addr;
+  dma_state[channel].reload = transfer_count;
+  dma_hw->ch[channel].al1_ctrl = config->ctrl;
+  if(trigger_now) {
+    trigger(channel);
+  }
+}
+
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger_now)
+{
+  sync();
+  dma_hw->ch[channel].read_addr = (uintptr_t)read_addr;
+  if(trigger_now) {
+    trigger(channel);
+  }
+}
+
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger_now)
+{
+  sync();
+  dma_state[channel].reload = trans_count;
+  if(trigger_now) {
+    trigger(channel);
+  }
+}
+
+
+void dma_channel_start(uint channel)
+{
+  sync();
+  trigger(channel);
+}
+
+
+void dma_channel_abort(uint channel)
+{
+  sync();
+  dma_state[channel].busy = false;
+}
+
+
+// The firmware polls this in loops, so let the hardware run meanwhile
+bool dma_channel_is_busy(uint channel)
+{
+  host_spin(DMA_POLL_CLOCKS);
+  return dma_state[channel].busy;
+}
+
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled)
+{
+  if(enabled) {
+    dma_hw->inte0 |= 1u << channel;
+  } else {
+    dma_hw->inte0 &= ~(uintptr_t)(1u << channel);
+  }
+}
+
+
+bool dma_channel_get_irq0_status(uint channel)
+{
+  return dma_hw->ints0 & (1u << channel);
+}
+
+
+void dma_channel_acknowledge_irq0(uint channel)
+{
+  dma_hw->ints0 = 1u << channel;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// PIO API
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+  int p = pio_index(pio);
+  uint offset = pio_program_words[p];
+  pio_program_words[p] += program->length;
+  pio_loaded[p][offset] = program;
+  return offset;
+}
+
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset)
+{
+  int p = pio_index(pio);
+  pio_loaded[p][loaded_offset] = NULL;
+  // Programs are removed in the reverse order in the firmware
+  if(loaded_offset + program->length == pio_program_words[p]) {
+    pio_program_words[p] = loaded_offset;
+  }
+}
+
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+  int p = pio_index(pio);
+  for(int sm = 0; sm < PIO_SM_COUNT; sm++) {
+    if(!(pio_sm_claimed[p] & (1u << sm))) {
+      pio_sm_claimed[p] |= 1u << sm;
+      return sm;
+    }
+  }
+  if(required) {
+    fprintf(stderr, "No free PIO state machine\n");
+    exit(1);
+  }
+  return -1;
+}
+
+
+void pio_sm_unclaim(PIO pio, uint sm)
+{
+  pio_sm_claimed[pio_index(pio)] &= ~(1u << sm);
+}
+
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+  (void)pio;
+  (void)pin;
+}
+
+
+static void update_drive(int p, sm_state_t *s)
+{
+  s->drive = (pio_pindirs[p] >> s->first_pin) & 3;
+}
+
+
+// The RF pins show as high in the edge log while the state machine drives them
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out)
+{
+  int p = pio_index(pio);
+  sm_state_t *s = &sm_state[p][sm];
+  sync();
+  emit_toggle(s, hw_clock);
+  for(uint pin = pin_base; pin < pin_base + pin_count; pin++) {
+    host_set_pin_level(pin, is_out);
+    if(is_out) {
+      pio_pindirs[p] |= 1u << pin;
+    } else {
+      pio_pindirs[p] &= ~(1u << pin);
+    }
+  }
+  update_drive(p, s);
+}
+
+
+static bool program_is(const pio_program_t *program, const uint16_t *instructions, uint8_t length)
+{
+  return program && program->length == length && 
+         memcmp(program->instructions, instructions, length*sizeof(uint16_t)) == 0;
+}
+
+
+// Like the SDK, this leaves the state machine disabled with empty FIFOs
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+  int p = pio_index(pio);
+  sm_state_t *s = &sm_state[p][sm];
+  const pio_program_t *program = initial_pc < 32 ? pio_loaded[p][initial_pc] : NULL;
+
+  pio_sm_set_enabled(pio, sm, false);
+  if(program_is(program, pio_serialiser_program_instructions, pio_serialiser_program.length)) {
+    s->kind = SM_SERIALISER;
+    s->first_pin = config->out_base;
+  } else if(program_is(program, toggle_program_instructions, toggle_program.length)) {
+    s->kind = SM_TOGGLE;
+    s->first_pin = config->set_base;
+  } else {
+    s->kind = SM_OTHER;
+  }
+  update_drive(p, s);
+  // The serialiser is only modelled at the clock divider of 1 that the firmware uses
+  s->div_int = (uint32_t)config->clkdiv;
+  s->div_frac = (uint32_t)((config->clkdiv - s->div_int)*256);
+  s->table.clear();
+  s->fifo_depth = config->fifo_join == PIO_FIFO_JOIN_TX ? 8 : 4;
+  s->fifo_head = 0;
+  s->fifo_n = 0;
+  s->stalled = false;
+  s->last_bits = 0;
+}
+
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+  sm_state_t *s = &sm_state[pio_index(pio)][sm];
+  sync();
+  emit_toggle(s, hw_clock);
+  if(s->stalled) {
+    stall_clocks += hw_clock - s->stall_start;
+    if(rf_sink) {
+      emit_hold(s, s->stall_start, hw_clock - s->stall_start, s->last_bits);
+    }
+    s->stalled = false;
+  }
+  if(enabled && !s->enabled) {
+    s->next_pull = hw_clock;
+    s->origin = hw_clock;
+    s->emitted = hw_clock;
+  }
+  s->enabled = enabled;
+  if(enabled) {
+    pio->ctrl |= 1u << sm;
+  } else {
+    pio->ctrl &= ~(uintptr_t)(1u << sm);
+  }
+}
+
+
+// The toggle waveform starts over from the new divider, so the phase is not kept like on the chip
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div)
+{
+  sm_state_t *s = &sm_state[pio_index(pio)][sm];
+  sync();
+  emit_toggle(s, hw_clock);
+  s->div_int = (uint32_t)div;
+  s->div_frac = (uint32_t)((div - s->div_int)*256);
+  s->table.clear();
+  s->origin = hw_clock;
+}
+
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask)
+{
+  (void)pio;
+  (void)sm;
+  for(int pin = 0; pin < 32; pin++) {
+    if(pin_mask & (1u << pin)) {
+      host_set_pin_level(pin, pin_values & (1u << pin));
+    }
+  }
+}
+
+
+void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+  sm_state_t *s = &sm_state[pio_index(pio)][sm];
+  sync();
+  s->fifo_head = 0;
+  s->fifo_n = 0;
+}
+
+
+// The same numbering as the SDK DREQ_PIOx_TXy/RXy
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+  return pio_index(pio)*8 + sm + (is_tx ? 0 : 4);
+}
@@ -0,0 +1,501 @@
+// Runs the firmware on the host on virtual time, see Readme. Console commands can be given
+// at chosen times, and statistics of the keying and of the loop() execution are printed at the end.
+#include <vector>
+#include <map>
+#include <string>
+#include <chrono>
+#include <complex>
+#include <unistd.h>
+#include "Arduino.h"
+#include "LiquidCrystal.h"
+#include "transmitter_PiPico.h"
+#include "host.h"
+#include "host_sigmf.h"
+#include "host_chain.h"
+#include "host_sweep.h"
+
+void setup();
+void loop();
+extern LiquidCrystal lcd;
+
+typedef std::complex<double> complex_t;
+
+static const uint64_t RF_WINDOW_CLOCKS = 16384; // 81.92 us
+static const double RF_CARRIER_MIN = 0.1;       // Relative amplitude of a window with carrier
+
+// Phase of the carrier in the RF output, per window of RF_WINDOW_CLOCKS clock cycles, compared
+// to an ideal carrier. With a continuous carrier the phase moves the same amount from one 
+// window to the next, also over buffer changes and key transitions.
+typedef struct {
+  double freq;
+  complex_t table[65536];   // Sum of 8 samples times the carrier, indexed by 16 bits of a word
+  complex_t rot8;           // The carrier over 8 clock cycles
+  uint64_t window;          // Index of the window being summed
+  complex_t sum;
+  bool prev_carrier;        // The previous window had a carrier
+  double prev_phase;
+  uint64_t clocks;          // Statistics
+  uint64_t windows;
+  uint64_t steps;
+  double step_mean, step_m2, step_min, step_max;
+} rf_analysis_t;
+
+
+// Sample value of the differential output, -1, 0 or 1
+static int rf_sample(uint32_t bits)
+{
+  return (int)(bits & 1) - (int)((bits >> 1) & 1);
+}
+
+
+// The carrier at clock cycle c, without loss of precision for large c
+static complex_t rf_carrier(const rf_analysis_t *a, uint64_t c)
+{
+  double cycles = (double)(c % HOST_CLOCK_HZ) * a->freq / HOST_CLOCK_HZ + 
+                  (double)(c / HOST_CLOCK_HZ) * a->freq;
+  return std::polar(1.0, -2*M_PI*(cycles - floor(cycles)));
+}
+
+
+static void rf_set_frequency(rf_analysis_t *a, double freq)
+{
+  if(freq == a->freq) {
+    return;
+  }
+  a->freq = freq;
+  double w = 2*M_PI*freq/HOST_CLOCK_HZ;
+  for(int x = 0; x < 65536; x++) {
+    complex_t sum = 0;
+    for(int ii = 0; ii < 8; ii++) {
+      sum += (double)rf_sample(x >> (2*ii)) * std::polar(1.0, -w*ii);
+    }
+    a->table[x] = sum;
+  }
+  a->rot8 = std::polar(1.0, -w*8);
+  a->prev_carrier = false;
+}
+
+
+static void rf_end_window(rf_analysis_t *a)
+{
+  double amplitude = 2*std::abs(a->sum)/RF_WINDOW_CLOCKS;
+  bool carrier = amplitude > RF_CARRIER_MIN;
+  double phase = std::arg(a->sum);
+
+  a->windows += carrier;
+  if(carrier && a->prev_carrier) {
+    double step = remainder(phase - a->prev_phase, 2*M_PI)*180/M_PI;
+    // Running mean and variance
+    a->steps++;
+    double delta = step - a->step_mean;
+    a->step_mean += delta/a->steps;
+    a->step_m2 += delta*(step - a->step_mean);
+    a->step_min = a->steps == 1 ? step : std::min(a->step_min, step);
+    a->step_max = a->steps == 1 ? step : std::max(a->step_max, step);
+  }
+  a->prev_carrier = carrier;
+  a->prev_phase = phase;
+  a->sum = 0;
+}
+
+
+static void rf_add(rf_analysis_t *a, uint64_t c, complex_t x)
+{
+  uint64_t window = c / RF_WINDOW_CLOCKS;
+  if(window != a->window) {
+    rf_end_window(a);
+    if(window != a->window + 1) {
+      a->prev_carrier = false; // Gap in the output
+    }
+    a->window = window;
+  }
+  a->sum += x;
+}
+
+
+static void rf_analyse(rf_analysis_t *a, const host_rf_span_t *span)
+{
+  uint64_t c = span->clock;
+  uint64_t end = span->clock + span->n_clocks;
+
+  a->clocks += span->n_clocks;
+  if(span->words == NULL) {
+    int v = rf_sample(span->hold);
+    for(; c < end && v != 0; c += 16) {
+      complex_t sum = 0;
+      for(uint64_t ii = 0; ii < 16 && c + ii < end; ii++) {
+        sum += std::polar(1.0, -2*M_PI*a->freq*ii/HOST_CLOCK_HZ);
+      }
+      rf_add(a, c, (double)v * rf_carrier(a, c) * sum);
+    }
+    return;
+  }
+  complex_t carrier = rf_carrier(a, c);
+  complex_t rot16 = a->rot8*a->rot8;
+  for(uint64_t ii = 0; c < end; ii++, c += 16) {
+    uint32_t word = span->words[ii];
+    if(end - c < 16) {
+      word &= (1u << (2*(end - c))) - 1; // Partial word at the end
+    }
+    rf_add(a, c, carrier*(a->table[word & 0xffff] + a->rot8*a->table[word >> 16]));
+    carrier *= rot16;
+  }
+}
+
+
+// Where the RF output goes
+typedef struct {
+  rf_analysis_t *analysis;
+  host_sigmf_t *sigmf;
+  host_emission_t *emission;
+} rf_outputs_t;
+
+
+static void rf_sink(const host_rf_span_t *span, void *user)
+{
+  rf_outputs_t *out = (rf_outputs_t *)user;
+  if(out->analysis) {
+    // A command may have changed the frequency, and the firmware may sleep before loop() returns
+    rf_set_frequency(out->analysis, rf_synth->get_frequency_exact());
+    rf_analyse(out->analysis, span);
+  }
+  if(out->sigmf) {
+    host_sigmf_span(out->sigmf, span);
+  }
+  if(out->emission) {
+    host_emission_span(out->emission, span);
+  }
+}
+
+
+static void print_rf(rf_analysis_t *a)
+{
+  rf_end_window(a);
+  printf("RF output: %.3f s, %llu TX FIFO stalls (%llu clock cycles), %llu DMA transfers\n", 
+         (double)a->clocks/HOST_CLOCK_HZ, (unsigned long long)host_pio_stalls(), 
+         (unsigned long long)host_pio_stall_clocks(), (unsigned long long)host_dma_transfers());
+  printf("Carrier at %.4f Hz in %llu windows of %.2f us\n", a->freq, (unsigned long long)a->windows,
+         RF_WINDOW_CLOCKS*1e6/HOST_CLOCK_HZ);
+  if(a->steps > 1) {
+    double window_s = (double)RF_WINDOW_CLOCKS/HOST_CLOCK_HZ;
+    printf("Phase step between windows: mean %.4f deg (%.4f Hz offset), std %.4f deg, range %.4f to %.4f deg\n", 
+           a->step_mean, a->step_mean/360/window_s, sqrt(a->step_m2/(a->steps - 1)), a->step_min, a->step_max);
+  }
+}
+
+static const int Key_Debug_Pin = 26; // Follows the key in all modes, see synth.cpp
+
+// Approximation of the low-pass filter on the board, a pi filter with parts from the BOM
+static const char *Default_Chain = "ladder:50,C820p,L3.3u,C820p";
+
+typedef struct {
+  uint64_t t_us;
+  std::string command;
+  uint64_t sent_us;
+  uint64_t read_us;
+} host_command_t;
+
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-t seconds] [-s step_us] [-c [seconds:]command]... [-q] [-r] [-w name] \n"
+                  "       [-d decimation[,taps[,cutoff_Hz]]] [-e seconds] [-a chain]... [-m harmonic_dBc[,spur_dBc]]\n"
+                  "       [-b bytes_per_s] [-T celsius[,celsius_per_min]] [-p [seconds:]n[,batch[,wait[,latency_us]]]]\n", name);
+  fprintf(stderr, "  -t  Virtual time to run, default 60 s\n");
+  fprintf(stderr, "  -s  Virtual time per loop() call, default 1000 us\n");
+  fprintf(stderr, "  -c  Console command to give, at the given time or right after setup()\n");
+  fprintf(stderr, "  -q  Do not show the console output\n");
+  fprintf(stderr, "  -r  Check the phase continuity of the RF output\n");
+  fprintf(stderr, "  -w  Write the RF output to name.sigmf-data and name.sigmf-meta\n");
+  fprintf(stderr, "  -d  Decimate the written output, after a low-pass filter with taps taps, default \n"
+                  "      8*decimation+1, and cutoff frequency cutoff_Hz, default 0.4 times the new sample rate\n");
+  fprintf(stderr, "  -e  Check the emissions in 5.24 ms of RF output, from seconds after setup()\n");
+  fprintf(stderr, "  -a  Output chain to check the emissions after (repeatable), default \"%s\"\n", Default_Chain);
+  fprintf(stderr, "  -m  Emission mask, default -40 dBc for harmonics and spurs\n");
+  fprintf(stderr, "  -b  Rate the console output is read at, 0 for a port that is not read, default no limit\n");
+  fprintf(stderr, "  -T  Temperature of the chip, default 25 C, and how fast it changes\n");
+  fprintf(stderr, "  -p  Sweep with n binary frames of batch (1-5) parameters, each sent when the previous is \n"
+                  "      done (wait 1, default) or answered (wait 0), plus latency_us, default 1000 us\n");
+  exit(1);
+}
+
+
+// Print a summary of the key down and key up times seen on the debug pin
+static void print_keying()
+{
+  size_t n_edges;
+  const host_edge_t *edges = host_edges(&n_edges);
+  std::map<uint64_t, uint32_t> down, up; // Duration in 0.1 ms steps -> count
+  uint64_t last_us = 0;
+  bool have_last = false;
+
+  for(size_t ii = 0; ii < n_edges; ii++) {
+    if(edges[ii].pin != Key_Debug_Pin) {
+      continue;
+    }
+    if(have_last) {
+      // The level after the edge tells what the previous interval was
+      (edges[ii].level ? up : down)[(edges[ii].t_us - last_us + 50)/100]++;
+    }
+    last_us = edges[ii].t_us;
+    have_last = true;
+  }
+  printf("Key down durations (ms, count):");
+  for(auto &d : down) {
+    printf(" %.1f:%u", d.first/10.0, d.second);
+  }
+  printf("\nKey up durations (ms, count):");
+  for(auto &d : up) {
+    printf(" %.1f:%u", d.first/10.0, d.second);
+  }
+  printf("\n");
+}
+
+
+// Annotate the key down periods seen on the debug pin
+static void annotate_keying(host_sigmf_t *sigmf)
+{
+  size_t n_edges;
+  const host_edge_t *edges = host_edges(&n_edges);
+  uint64_t down_us = 0;
+  bool down = false;
+
+  for(size_t ii = 0; ii < n_edges; ii++) {
+    if(edges[ii].pin != Key_Debug_Pin) {
+      continue;
+    }
+    if(edges[ii].level) {
+      down_us = edges[ii].t_us;
+      down = true;
+    } else if(down) {
+      host_sigmf_annotate(sigmf, down_us*HOST_CLOCKS_PER_US, (edges[ii].t_us - down_us)*HOST_CLOCKS_PER_US, "key down");
+      down = false;
+    }
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  double run_s = 60;
+  uint64_t step_us = 1000;
+  bool quiet = false;
+  rf_outputs_t rf_out = {NULL, NULL, NULL};
+  double emission_s = -1;
+  std::vector<const char *> chains;
+  host_mask_t mask = {-40, -40};
+  const char *sigmf_name = NULL;
+  int decimation = 1;
+  int taps = 0;
+  double cutoff_hz = 0;
+  double tx_rate = -1;
+  double temp_c = 25, temp_c_per_min = 0;
+  std::vector<host_command_t> commands;
+  host_sweep_t *sweep = NULL;
+  int opt;
+
+  while((opt = getopt(argc, argv, "t:s:c:qrw:d:e:a:m:b:T:p:")) != -1) {
+    switch(opt) {
+      case 't':
+        run_s = atof(optarg);
+        break;
+      case 's':
+        step_us = strtoull(optarg, NULL, 10);
+        break;
+      case 'c': {
+        host_command_t c = {0, optarg, 0, 0};
+        const char *colon = strchr(optarg, ':');
+        if(colon && strspn(optarg, "0123456789.") == (size_t)(colon - optarg)) {
+          c.t_us = (uint64_t)(atof(optarg)*1e6);
+          c.command = colon + 1;
+        }
+        c.command += "\r";
+        commands.push_back(c);
+        break;
+      }
+      case 'q':
+        quiet = true;
+        break;
+      case 'r':
+        rf_out.analysis = new rf_analysis_t();
+        break;
+      case 'w':
+        sigmf_name = optarg;
+        break;
+      case 'd':
+        if(sscanf(optarg, "%d,%d,%lf", &decimation, &taps, &cutoff_hz) < 1) {
+          usage(argv[0]);
+        }
+        break;
+      case 'e':
+        emission_s = atof(optarg);
+        break;
+      case 'a':
+        chains.push_back(optarg);
+        break;
+      case 'm': {
+        int n = sscanf(optarg, "%lf,%lf", &mask.harmonic_dBc, &mask.spur_dBc);
+        if(n < 1) {
+          usage(argv[0]);
+        }
+        if(n == 1) {
+          mask.spur_dBc = mask.harmonic_dBc;
+        }
+        break;
+      }
+      case 'b':
+        tx_rate = atof(optarg);
+        break;
+      case 'T':
+        if(sscanf(optarg, "%lf,%lf", &temp_c, &temp_c_per_min) < 1) {
+          usage(argv[0]);
+        }
+        break;
+      case 'p': {
+        const char *spec = optarg;
+        const char *colon = strchr(optarg, ':');
+        double start_s = 0;
+        int n = 0, batch = 1, wait = 1;
+        unsigned long long latency_us = 1000;
+        if(colon && strspn(optarg, "0123456789.") == (size_t)(colon - optarg)) {
+          start_s = atof(optarg);
+          spec = colon + 1;
+        }
+        if(sscanf(spec, "%d,%d,%d,%llu", &n, &batch, &wait, &latency_us) < 1 || n < 1 || sweep) {
+          usage(argv[0]);
+        }
+        sweep = host_sweep_open((uint64_t)(start_s*1e6), n, batch, wait != 0, latency_us);
+        break;
+      }
+      default:
+        usage(argv[0]);
+    }
+  }
+  if(step_us == 0) {
+    usage(argv[0]);
+  }
+  if(chains.empty()) {
+    chains.push_back(Default_Chain);
+  }
+  for(const char *c : chains) {
+    host_chain_t *chain = host_chain_parse(c);
+    if(!chain) {
+      usage(argv[0]);
+    }
+    host_chain_free(chain);
+  }
+  host_serial_quiet(quiet);
+  host_serial_tx_rate(tx_rate);
+  host_set_temperature(temp_c, temp_c_per_min/60);
+
+  setup();
+  if(sigmf_name) {
+    if(taps <= 0) {
+      taps = 8*decimation + 1;
+    }
+    if(cutoff_hz <= 0) {
+      cutoff_hz = 0.4*HOST_CLOCK_HZ/decimation;
+    }
+    rf_out.sigmf = host_sigmf_open(sigmf_name, decimation, taps, cutoff_hz);
+  }
+  if(rf_out.analysis) {
+    rf_set_frequency(rf_out.analysis, rf_synth->get_frequency_exact());
+  }
+  if(emission_s >= 0) {
+    rf_out.emission = host_emission_open(host_time_clk() + (uint64_t)(emission_s*HOST_CLOCK_HZ));
+  }
+  if(rf_out.analysis || rf_out.sigmf || rf_out.emission) {
+    host_set_rf_sink(rf_sink, &rf_out);
+  }
+
+  uint64_t run_start_clk = host_time_clk();
+  uint64_t end_us = host_time_us() + (uint64_t)(run_s*1e6);
+  uint64_t loops = 0;
+  double loop_total_ns = 0;
+  double loop_max_ns = 0;
+  size_t next_command = 0;
+  size_t waiting_command = commands.size();
+
+  while(host_time_us() < end_us) {
+    if(waiting_command == commands.size() && next_command < commands.size() && 
+       host_time_us() >= commands[next_command].t_us) {
+      // Give the commands one at a time, like typing them
+      waiting_command = next_command++;
+      commands[waiting_command].sent_us = host_time_us();
+      host_serial_input(commands[waiting_command].command.c_str());
+    }
+    if(sweep) {
+      host_sweep_poll(sweep);
+    }
+    // The console input wakes the firmware from sleep
+    uint64_t wake_clk = next_command < commands.size() ? commands[next_command].t_us*HOST_CLOCKS_PER_US : 0;
+    if(sweep && host_sweep_next_us(sweep) != UINT64_MAX &&
+       (wake_clk == 0 || host_sweep_next_us(sweep)*HOST_CLOCKS_PER_US < wake_clk)) {
+      wake_clk = host_sweep_next_us(sweep)*HOST_CLOCKS_PER_US;
+    }
+    host_wake_at_clk(wake_clk);
+
+    uint64_t sleep_before = host_sleep_clocks();
+    auto start = std::chrono::steady_clock::now();
+    loop();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    loops++;
+    loop_total_ns += ns;
+    if(ns > loop_max_ns) {
+      loop_max_ns = ns;
+    }
+
+    if(waiting_command < commands.size() && host_serial_pending() == 0) {
+      commands[waiting_command].read_us = host_serial_last_read_us();
+      waiting_command = commands.size();
+    }
+    if(host_sleep_clocks() == sleep_before) {
+      // loop() did not sleep, so give it the step
+      host_advance_us(step_us);
+    }
+  }
+  fflush(stdout);
+
+  printf("\n---- Host simulation, %.3f s virtual time ----\n", host_time_us()/1e6);
+  printf("loop() calls: %llu, host time per call: %.2f us mean, %.2f us max\n", 
+         (unsigned long long)loops, loops ? loop_total_ns/loops/1e3 : 0.0, loop_max_ns/1e3);
+  printf("Slept (WFI): %.1f%% of the time\n", 100.0*host_sleep_clocks()/(host_time_clk() - run_start_clk));
+  if(tx_rate >= 0) {
+    printf("Console output: %llu bytes written when the transmit buffer was full\n",
+           (unsigned long long)host_serial_tx_full());
+  }
+  for(auto &c : commands) {
+    std::string name = c.command.substr(0, c.command.size() - 1);
+    if(c.read_us) {
+      printf("Command '%s' at %.3f s read after %llu us\n", name.c_str(), c.sent_us/1e6, 
+             (unsigned long long)(c.read_us - c.sent_us));
+    } else {
+      printf("Command '%s' was not read\n", name.c_str());
+    }
+  }
+  print_keying();
+  if(sweep) {
+    host_sweep_print(sweep);
+    host_sweep_close(sweep);
+  }
+  if(rf_out.analysis) {
+    print_rf(rf_out.analysis);
+  }
+  if(rf_out.sigmf) {
+    char description[160];
+    host_set_rf_sink(NULL, NULL);
+    annotate_keying(rf_out.sigmf);
+    snprintf(description, sizeof(description), "Fox transmitter RF output, %.4f Hz, mode %d (%s)", 
+             rf_synth->get_frequency_exact(), rf_synth->get_mode(), rf_synth->get_mode_str());
+    host_sigmf_close(rf_out.sigmf, description);
+  }
+  if(rf_out.emission) {
+    for(const char *c : chains) {
+      host_emission_check(rf_out.emission, rf_synth->get_frequency_exact(), c, &mask);
+    }
+    host_emission_close(rf_out.emission);
+  }
+  printf("EEPROM commits: %u\n", host_eeprom_commits());
+  printf("LCD: [%s] [%s]\n", lcd.line(0), lcd.line(1));
+  return 0;
+}
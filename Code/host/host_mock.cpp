@@ -0,0 +1,789 @@
+// Host implementation of the Arduino and pico SDK functions used by the firmware: virtual
+// time with alarms, the console, GPIO with an edge log, interrupts, EEPROM and LCD.
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <string>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "LiquidCrystal.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/timer.h"
+#include "host.h"
+
+HardwareSerial Serial;
+RP2040 rp2040;
+EEPROMClass EEPROM;
+
+static uint64_t now_clk = 0;
+
+typedef struct {
+  alarm_id_t id;
+  uint64_t t_clk;
+  alarm_callback_t callback;
+  void *user_data;
+} host_alarm_t;
+
+static std::vector<host_alarm_t> alarms;
+static alarm_id_t next_alarm_id = 1;
+
+static timer_hw_t timer_regs;
+timer_hw_t *timer_hw = &timer_regs;
+static bool hw_alarm_claimed[NUM_ALARMS];
+static alarm_id_t hw_alarm_ids[NUM_ALARMS];     // The alarm above that models an armed one, or 0
+
+static uint64_t wake_clk = 0;
+static uint64_t sleep_clocks = 0;
+
+static irq_handler_t irq_handlers[HOST_NUM_IRQS];
+static bool irq_enabled[HOST_NUM_IRQS];
+static bool irq_pending[HOST_NUM_IRQS];
+
+static std::string serial_in;
+static size_t serial_pos = 0;
+static uint64_t serial_last_read_us = 0;
+static bool serial_quiet = false;
+static void (*serial_sink)(uint8_t c, void *user) = NULL;
+static void *serial_sink_user = NULL;
+static const int serial_tx_buffer = 256;    // Bytes, like the USB CDC buffer of the core
+static double serial_tx_rate = -1;
+static double serial_tx_level = 0;
+static uint64_t serial_tx_clk = 0;
+static uint64_t serial_tx_full = 0;
+
+static int pin_mode[HOST_NUM_PINS];
+static bool pin_level[HOST_NUM_PINS];
+static bool pin_input_level[HOST_NUM_PINS];
+static bool pins_initialized = false;
+static void (*pin_callback[HOST_NUM_PINS])();
+static int pin_callback_mode[HOST_NUM_PINS];
+static std::vector<host_edge_t> edges;
+
+
+// ---------------------------------------------------------------------------------------------
+// Virtual time
+
+uint64_t host_time_us()
+{
+  return now_clk/HOST_CLOCKS_PER_US;
+}
+
+
+uint64_t host_time_clk()
+{
+  return now_clk;
+}
+
+
+// Run the handlers of raised and enabled interrupts
+static void run_irqs()
+{
+  bool any = true;
+  while(any) {
+    any = false;
+    for(int ii = 0; ii < HOST_NUM_IRQS; ii++) {
+      if(irq_pending[ii] && irq_enabled[ii] && irq_handlers[ii]) {
+        irq_pending[ii] = false;
+        irq_handlers[ii]();
+        any = true;
+      }
+    }
+  }
+}
+
+
+// Run the DMA and PIO up to t_clk, with the interrupts they raise on the way
+static void run_hw(uint64_t t_clk)
+{
+  while(now_clk < t_clk) {
+    now_clk = host_hw_run(t_clk);
+    run_irqs();
+  }
+}
+
+
+// Move time forward to t_clk, firing alarms at their deadlines on the way
+void host_advance_to_clk(uint64_t t_clk)
+{
+  run_irqs();
+  while(true) {
+    size_t first = alarms.size();
+    for(size_t ii = 0; ii < alarms.size(); ii++) {
+      if(alarms[ii].t_clk <= t_clk && (first == alarms.size() || alarms[ii].t_clk < alarms[first].t_clk)) {
+        first = ii;
+      }
+    }
+    if(first == alarms.size()) {
+      break;
+    }
+    if(alarms[first].t_clk > now_clk) {
+      // Interrupts on the way may change the alarms, so look again after this
+      run_hw(alarms[first].t_clk);
+      continue;
+    }
+    host_alarm_t alarm = alarms[first];
+    alarms.erase(alarms.begin() + first);
+    int64_t ret = alarm.callback(alarm.id, alarm.user_data);
+    if(ret != 0) {
+      // Negative: relative to the previous deadline, positive: relative to now
+      alarm.t_clk = ret < 0 ? alarm.t_clk - ret*HOST_CLOCKS_PER_US : now_clk + ret*HOST_CLOCKS_PER_US;
+      alarms.push_back(alarm);
+    }
+    run_irqs();
+  }
+  run_hw(t_clk);
+}
+
+
+void host_advance_us(uint64_t us)
+{
+  host_advance_to_clk(now_clk + us*HOST_CLOCKS_PER_US);
+}
+
+
+// Let the DMA and PIO run while the firmware busy waits with interrupts disabled
+void host_spin(uint64_t clocks)
+{
+  uint64_t t_clk = now_clk + clocks;
+  while(now_clk < t_clk) {
+    now_clk = host_hw_run(t_clk);
+  }
+}
+
+
+void host_wake_at_clk(uint64_t t_clk)
+{
+  wake_clk = t_clk;
+}
+
+
+uint64_t host_wake_clk()
+{
+  return wake_clk;
+}
+
+
+uint64_t host_sleep_clocks()
+{
+  return sleep_clocks;
+}
+
+
+static bool irq_waiting()
+{
+  for(int ii = 0; ii < HOST_NUM_IRQS; ii++) {
+    if(irq_pending[ii] && irq_enabled[ii] && irq_handlers[ii]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Sleep until an interrupt: let the DMA and PIO run up to the first alarm, or until they raise 
+// an interrupt, then run the interrupt or the alarm. Console input counts as the USB interrupt.
+void __wfi()
+{
+  uint64_t start_clk = now_clk;
+  uint64_t t_clk = wake_clk > now_clk ? wake_clk : UINT64_MAX;
+
+  if(irq_waiting() || serial_pos < serial_in.size()) {
+    return;
+  }
+  for(size_t ii = 0; ii < alarms.size(); ii++) {
+    t_clk = std::min(t_clk, std::max(alarms[ii].t_clk, now_clk));
+  }
+  if(t_clk == UINT64_MAX) {
+    return; // Nothing would wake it
+  }
+  while(now_clk < t_clk && !irq_waiting()) {
+    now_clk = host_hw_run(t_clk);
+  }
+  sleep_clocks += now_clk - start_clk;
+  host_advance_to_clk(now_clk);
+}
+
+
+uint64_t time_us_64()
+{
+  return host_time_us();
+}
+
+
+uint32_t time_us_32()
+{
+  return (uint32_t)host_time_us();
+}
+
+
+uint32_t micros()
+{
+  return (uint32_t)host_time_us();
+}
+
+
+uint32_t millis()
+{
+  return (uint32_t)(host_time_us()/1000);
+}
+
+
+void sleep_us(uint64_t us)
+{
+  host_advance_us(us);
+}
+
+
+void sleep_ms(uint32_t ms)
+{
+  host_advance_us((uint64_t)ms*1000);
+}
+
+
+void delay(uint32_t ms)
+{
+  host_advance_us((uint64_t)ms*1000);
+}
+
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void *user_data, bool fire_if_past)
+{
+  (void)fire_if_past;
+  host_alarm_t alarm = {next_alarm_id++, now_clk + us*HOST_CLOCKS_PER_US, callback, user_data};
+  alarms.push_back(alarm);
+  return alarm.id;
+}
+
+
+bool cancel_alarm(alarm_id_t alarm_id)
+{
+  for(size_t ii = 0; ii < alarms.size(); ii++) {
+    if(alarms[ii].id == alarm_id) {
+      alarms.erase(alarms.begin() + ii);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// The hardware alarms are alarms above that raise the timer interrupt
+static int64_t hw_alarm_fire(alarm_id_t id, void *user_data)
+{
+  uint n = (uintptr_t)user_data;
+
+  (void)id;
+  hw_alarm_ids[n] = 0;
+  timer_hw->intr.bits |= 1u << n;
+  if(timer_hw->inte & (1u << n)) {
+    host_raise_irq(hardware_alarm_get_irq_num(n));
+  }
+  return 0;
+}
+
+
+// Like the hardware, the alarm fires when the low 32 bits of the us timer reach the target
+void host_timer_alarm_reg::operator=(uint32_t target) volatile
+{
+  uint n = this - (volatile host_timer_alarm_reg *)timer_hw->alarm;
+
+  if(hw_alarm_ids[n] != 0) {
+    cancel_alarm(hw_alarm_ids[n]);
+  }
+  hw_alarm_ids[n] = add_alarm_in_us(target - time_us_32(), hw_alarm_fire, (void *)(uintptr_t)n, true);
+}
+
+
+void host_timer_armed_reg::operator=(uint32_t mask) volatile
+{
+  for(uint n = 0; n < NUM_ALARMS; n++) {
+    if((mask & (1u << n)) && hw_alarm_ids[n] != 0) {
+      cancel_alarm(hw_alarm_ids[n]);
+      hw_alarm_ids[n] = 0;
+    }
+  }
+}
+
+
+host_timer_armed_reg::operator uint32_t() const volatile
+{
+  uint32_t mask = 0;
+
+  for(uint n = 0; n < NUM_ALARMS; n++) {
+    mask |= hw_alarm_ids[n] != 0 ? 1u << n : 0;
+  }
+  return mask;
+}
+
+
+host_timer_time_reg::operator uint32_t() const volatile
+{
+  return time_us_32();
+}
+
+
+int hardware_alarm_claim_unused(bool required)
+{
+  for(int n = 0; n < NUM_ALARMS; n++) {
+    if(!hw_alarm_claimed[n]) {
+      hw_alarm_claimed[n] = true;
+      return n;
+    }
+  }
+  if(required) {
+    fprintf(stderr, "No free hardware alarm\n");
+    exit(1);
+  }
+  return -1;
+}
+
+
+void hardware_alarm_unclaim(uint alarm_num)
+{
+  timer_hw->armed = 1u << alarm_num;
+  hw_alarm_claimed[alarm_num] = false;
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// Interrupts
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+  if(num < HOST_NUM_IRQS) {
+    irq_handlers[num] = handler;
+  }
+}
+
+
+void irq_remove_handler(uint num, irq_handler_t handler)
+{
+  if(num < HOST_NUM_IRQS && irq_handlers[num] == handler) {
+    irq_handlers[num] = NULL;
+  }
+}
+
+
+void irq_set_enabled(uint num, bool enabled)
+{
+  if(num < HOST_NUM_IRQS) {
+    irq_enabled[num] = enabled;
+  }
+}
+
+
+void irq_set_priority(uint num, uint8_t hardware_priority)
+{
+  (void)num;
+  (void)hardware_priority;
+}
+
+
+void host_raise_irq(unsigned int num)
+{
+  if(num < HOST_NUM_IRQS) {
+    irq_pending[num] = true;
+  }
+}
+
+
+bool host_irq_enabled(unsigned int num)
+{
+  return num < HOST_NUM_IRQS && irq_enabled[num];
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// Console
+
+void host_serial_input(const char *s)
+{
+  serial_in.append(s);
+}
+
+
+void host_serial_input_bytes(const uint8_t *data, size_t n)
+{
+  serial_in.append((const char *)data, n);
+}
+
+
+size_t host_serial_pending()
+{
+  return serial_in.size() - serial_pos;
+}
+
+
+uint64_t host_serial_last_read_us()
+{
+  return serial_last_read_us;
+}
+
+
+void host_serial_quiet(bool quiet)
+{
+  serial_quiet = quiet;
+}
+
+
+void host_serial_tx_rate(double bytes_per_s)
+{
+  serial_tx_rate = bytes_per_s;
+}
+
+
+uint64_t host_serial_tx_full()
+{
+  return serial_tx_full;
+}
+
+
+void host_serial_set_sink(void (*sink)(uint8_t c, void *user), void *user)
+{
+  serial_sink = sink;
+  serial_sink_user = user;
+}
+
+
+// Empty the transmit buffer at the rate it is read
+static void serial_tx_update()
+{
+  if(serial_tx_rate < 0) {
+    serial_tx_level = 0;
+  } else {
+    serial_tx_level -= serial_tx_rate*(now_clk - serial_tx_clk)/HOST_CLOCK_HZ;
+    if(serial_tx_level < 0) {
+      serial_tx_level = 0;
+    }
+  }
+  serial_tx_clk = now_clk;
+}
+
+
+uint64_t RP2040::getCycleCount64()
+{
+  auto t = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t).count()*HOST_CLOCK_HZ/1000000000;
+}
+
+
+uint32_t RP2040::f_cpu()
+{
+  return HOST_CLOCK_HZ;
+}
+
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+  return clk_index == clk_sys ? HOST_CLOCK_HZ : 48000000;
+}
+
+
+// The PIO and DMA model runs on HOST_CLOCK_HZ, so the clock stays. The firmware sees that 
+// from clock_get_hz(), like on a board where the PLL could not be set.
+void set_sys_clock_pll(uint32_t vco_freq, uint post_div1, uint post_div2)
+{
+  (void)vco_freq;
+  (void)post_div1;
+  (void)post_div2;
+}
+
+
+int HardwareSerial::availableForWrite()
+{
+  serial_tx_update();
+  return serial_tx_buffer - (int)ceil(serial_tx_level);
+}
+
+
+int HardwareSerial::available()
+{
+  return (int)(serial_in.size() - serial_pos);
+}
+
+
+int HardwareSerial::read()
+{
+  if(serial_pos >= serial_in.size()) {
+    return -1;
+  }
+  serial_last_read_us = host_time_us();
+  int c = (uint8_t)serial_in[serial_pos++];
+  if(serial_pos == serial_in.size()) {
+    serial_in.clear();
+    serial_pos = 0;
+  }
+  return c;
+}
+
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  serial_tx_update();
+  if(serial_tx_level + 1 > serial_tx_buffer) {
+    serial_tx_full++; // The core would wait here, or drop it if the port is not open
+  } else {
+    serial_tx_level++;
+  }
+  if(serial_sink) {
+    serial_sink(c, serial_sink_user);
+  }
+  if(!serial_quiet && c != '\r') {
+    putchar(c);
+  }
+  return 1;
+}
+
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t n)
+{
+  for(size_t ii = 0; ii < n; ii++) {
+    write(buf[ii]);
+  }
+  return n;
+}
+
+
+size_t HardwareSerial::print(const char *s)
+{
+  size_t n = 0;
+  while(*s) {
+    n += write(*s++);
+  }
+  return n;
+}
+
+
+// Print with a fixed number of decimals like the Arduino core does
+size_t HardwareSerial::print(double v, int digits)
+{
+  char s[64];
+  snprintf(s, sizeof(s), "%.*f", digits, v);
+  return print(s);
+}
+
+
+size_t HardwareSerial::print_integer(long long v, bool is_signed, int base)
+{
+  char s[72];
+  char *p = s + sizeof(s) - 1;
+  bool negative = false;
+  unsigned long long u;
+
+  if(base == DEC && is_signed && v < 0) {
+    negative = true;
+    u = -(unsigned long long)v;
+  } else if(is_signed && v < 0) {
+    u = (uint32_t)v; // The Arduino core prints negative numbers in other bases as 32-bit unsigned
+  } else {
+    u = (unsigned long long)v;
+  }
+  if(base < 2) {
+    base = DEC;
+  }
+  *p = '\0';
+  do {
+    int d = u % base;
+    *--p = d < 10 ? '0' + d : 'A' + d - 10;
+    u /= base;
+  } while(u);
+  if(negative) {
+    *--p = '-';
+  }
+  return print(p);
+}
+
+
+size_t HardwareSerial::printf(const char *format, ...)
+{
+  char buf[1024];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  return print(buf);
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// Pins
+
+static void init_pins()
+{
+  if(!pins_initialized) {
+    for(int ii = 0; ii < HOST_NUM_PINS; ii++) {
+      pin_input_level[ii] = true; // Switches and buttons are pulled up, i.e. off
+    }
+    pins_initialized = true;
+  }
+}
+
+
+// Drive a pin and log the change
+static void set_level(int pin, bool level)
+{
+  if(pin < 0 || pin >= HOST_NUM_PINS) {
+    return;
+  }
+  if(pin_level[pin] != level) {
+    host_edge_t edge = {host_time_us(), (uint8_t)pin, level};
+    edges.push_back(edge);
+  }
+  pin_level[pin] = level;
+}
+
+
+void pinMode(int pin, int mode)
+{
+  init_pins();
+  if(pin >= 0 && pin < HOST_NUM_PINS) {
+    pin_mode[pin] = mode;
+  }
+}
+
+
+void digitalWrite(int pin, int val)
+{
+  set_level(pin, val != LOW);
+}
+
+
+int digitalRead(int pin)
+{
+  init_pins();
+  if(pin < 0 || pin >= HOST_NUM_PINS) {
+    return LOW;
+  }
+  return pin_mode[pin] == OUTPUT ? pin_level[pin] : pin_input_level[pin];
+}
+
+
+void gpio_put(uint gpio, bool value)
+{
+  set_level(gpio, value);
+}
+
+
+bool gpio_get(uint gpio)
+{
+  return digitalRead(gpio);
+}
+
+
+int analogRead(int pin)
+{
+  (void)pin;
+  return 2048;
+}
+
+
+void analogReadResolution(int bits)
+{
+  (void)bits;
+}
+
+
+static double temperature_c = 25.0;
+static double temperature_c_per_s = 0;
+
+void host_set_temperature(double celsius, double celsius_per_s)
+{
+  temperature_c = celsius;
+  temperature_c_per_s = celsius_per_s;
+}
+
+
+float analogReadTemp()
+{
+  return temperature_c + temperature_c_per_s*host_time_us()*1e-6;
+}
+
+
+void host_set_pin_input(int pin, bool level)
+{
+  init_pins();
+  if(pin >= 0 && pin < HOST_NUM_PINS) {
+    bool changed = pin_input_level[pin] != level;
+    pin_input_level[pin] = level;
+    int mode = pin_callback_mode[pin];
+    if(changed && pin_callback[pin] && (mode == CHANGE || (mode == RISING) == level)) {
+      pin_callback[pin]();
+    }
+  }
+}
+
+
+void attachInterrupt(int pin, void (*callback)(), int mode)
+{
+  if(pin >= 0 && pin < HOST_NUM_PINS) {
+    pin_callback[pin] = callback;
+    pin_callback_mode[pin] = mode;
+  }
+}
+
+
+bool host_pin_level(int pin)
+{
+  return pin >= 0 && pin < HOST_NUM_PINS && pin_level[pin];
+}
+
+
+// Used by the PIO mock to show whether the state machine drives the RF pins
+void host_set_pin_level(int pin, bool level)
+{
+  set_level(pin, level);
+}
+
+
+const host_edge_t *host_edges(size_t *n)
+{
+  *n = edges.size();
+  return edges.data();
+}
+
+
+void host_clear_edges()
+{
+  edges.clear();
+}
+
+
+// ---------------------------------------------------------------------------------------------
+// EEPROM and LCD
+
+// Erasing and programming the flash sector takes tens of ms, and the core keeps the interrupts 
+// disabled all the time. The interrupts and alarms that came due meanwhile run at the end.
+bool EEPROMClass::commit()
+{
+  m_commits++;
+  host_spin(host_flash_write_us*HOST_CLOCKS_PER_US);
+  host_advance_to_clk(now_clk);
+  return true;
+}
+
+
+uint32_t host_eeprom_commits()
+{
+  return EEPROM.commits();
+}
+
+
+void LiquidCrystal::clear()
+{
+  for(int row = 0; row < 2; row++) {
+    memset(m_text[row], ' ', m_cols);
+    m_text[row][m_cols] = '\0';
+  }
+  m_col = 0;
+  m_row = 0;
+}
+
+
+void LiquidCrystal::print(const char *s)
+{
+  while(*s && m_col < m_cols) {
+    m_text[m_row][m_col++] = *s++;
+  }
+}
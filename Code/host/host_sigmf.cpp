@@ -0,0 +1,300 @@
+// Streaming SigMF writer, see host_sigmf.h. The samples are written in chunks as they come,
+// and the metadata when the file is closed, so the length of a capture is only limited by
+// the disk.
+//
+// Except for the first taps-1 samples of a span, the filter output during a buffer only depends
+// on the buffer and on where it starts relative to the decimation. As the same buffers are sent over
+// and over, that output is calculated once per buffer and start, and then reused.
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "host_sigmf.h"
+
+static const size_t OUT_CHUNK = 65536;   // Samples per write
+static const int CACHE_ENTRIES = 64;
+
+typedef struct {
+  uint64_t start;
+  uint64_t count;
+  std::string label;
+} sigmf_annotation_t;
+
+// Filter output for a buffer, from sample first on, every decimation samples
+typedef struct {
+  const uint32_t *source;
+  uint64_t source_words;
+  uint64_t phase;                  // Start of the buffer relative to the output samples
+  std::vector<uint32_t> copy;      // To see if the buffer is still the same
+  uint64_t first;
+  std::vector<float> out;
+} sigmf_cache_t;
+
+struct host_sigmf {
+  std::string prefix;
+  FILE *data;
+  int decimation;
+  std::vector<float> h;            // Filter taps
+  std::vector<float> hist;         // The last input samples, a power of two long
+  size_t hist_pos;
+  bool started;
+  uint64_t start_clk;
+  uint64_t next_clk;               // Clock cycle of the next input sample
+  std::vector<int8_t> out_i8;
+  std::vector<float> out_f32;
+  uint64_t n_out;
+  sigmf_cache_t cache[CACHE_ENTRIES];
+  int cache_next;
+  uint64_t cache_hits;
+  std::vector<sigmf_annotation_t> annotations;
+};
+
+
+static int sample_of(uint32_t bits)
+{
+  return (int)(bits & 1) - (int)((bits >> 1) & 1);
+}
+
+
+// Windowed sinc (Blackman) low-pass filter with unity gain at DC
+static void design_filter(host_sigmf_t *w, int taps, double cutoff_hz)
+{
+  double fc = cutoff_hz / HOST_CLOCK_HZ;
+  double sum = 0;
+  w->h.resize(taps);
+  for(int k = 0; k < taps; k++) {
+    double m = k - (taps - 1)/2.0;
+    double sinc = m == 0 ? 2*fc : sin(2*M_PI*fc*m)/(M_PI*m);
+    double window = taps == 1 ? 1 : 0.42 - 0.5*cos(2*M_PI*k/(taps - 1)) + 0.08*cos(4*M_PI*k/(taps - 1));
+    w->h[k] = sinc*window;
+    sum += w->h[k];
+  }
+  for(int k = 0; k < taps; k++) {
+    w->h[k] /= sum;
+  }
+}
+
+
+host_sigmf_t *host_sigmf_open(const char *prefix, int decimation, int taps, double cutoff_hz)
+{
+  host_sigmf_t *w = new host_sigmf_t();
+  std::string name = std::string(prefix) + ".sigmf-data";
+
+  w->data = fopen(name.c_str(), "wb");
+  if(!w->data) {
+    perror(name.c_str());
+    delete w;
+    return NULL;
+  }
+  w->prefix = prefix;
+  w->decimation = decimation < 1 ? 1 : decimation;
+  if(w->decimation > 1) {
+    design_filter(w, taps < 1 ? 1 : taps, cutoff_hz);
+    size_t n = 1;
+    while(n < w->h.size()) {
+      n *= 2;
+    }
+    w->hist.assign(n, 0);
+  }
+  return w;
+}
+
+
+static void flush_out(host_sigmf_t *w)
+{
+  if(!w->out_i8.empty()) {
+    fwrite(w->out_i8.data(), 1, w->out_i8.size(), w->data);
+    w->out_i8.clear();
+  }
+  if(!w->out_f32.empty()) {
+    fwrite(w->out_f32.data(), sizeof(float), w->out_f32.size(), w->data);
+    w->out_f32.clear();
+  }
+}
+
+
+static void put_f32(host_sigmf_t *w, float y)
+{
+  w->out_f32.push_back(y);
+  w->n_out++;
+  if(w->out_f32.size() >= OUT_CHUNK) {
+    flush_out(w);
+  }
+}
+
+
+// Take one input sample. With compute false the sample only goes into the filter history.
+static void push(host_sigmf_t *w, int x, bool compute)
+{
+  uint64_t clk = w->next_clk++;
+
+  if(w->decimation == 1) {
+    w->out_i8.push_back((int8_t)x);
+    w->n_out++;
+    if(w->out_i8.size() >= OUT_CHUNK) {
+      flush_out(w);
+    }
+    return;
+  }
+  size_t mask = w->hist.size() - 1;
+  w->hist[w->hist_pos] = x;
+  w->hist_pos = (w->hist_pos + 1) & mask;
+  if(!compute || (clk - w->start_clk) % w->decimation != 0) {
+    return;
+  }
+  float y = 0;
+  size_t pos = w->hist_pos - 1;
+  for(size_t k = 0; k < w->h.size(); k++) {
+    y += w->h[k]*w->hist[(pos - k) & mask];
+  }
+  put_f32(w, y);
+}
+
+
+static int span_sample(const host_rf_span_t *span, uint64_t ii)
+{
+  if(span->words == NULL) {
+    return sample_of(span->hold);
+  }
+  return sample_of(span->words[ii/16] >> (2*(ii % 16)));
+}
+
+
+static sigmf_cache_t *cache_get(host_sigmf_t *w, const host_rf_span_t *span)
+{
+  uint64_t phase = (span->source_clock - w->start_clk) % w->decimation;
+  sigmf_cache_t *c;
+
+  for(int ii = 0; ii < CACHE_ENTRIES; ii++) {
+    c = &w->cache[ii];
+    if(c->source == span->source && c->source_words == span->source_words && c->phase == phase &&
+       memcmp(c->copy.data(), span->source, span->source_words*sizeof(uint32_t)) == 0) {
+      w->cache_hits++;
+      return c;
+    }
+  }
+  // Filter the whole buffer
+  c = &w->cache[w->cache_next];
+  w->cache_next = (w->cache_next + 1) % CACHE_ENTRIES;
+  c->source = span->source;
+  c->source_words = span->source_words;
+  c->phase = phase;
+  c->copy.assign(span->source, span->source + span->source_words);
+  c->out.clear();
+  uint64_t taps = w->h.size();
+  uint64_t n = 16*span->source_words;
+  c->first = taps - 1;
+  while((c->first + phase) % w->decimation != 0) {
+    c->first++;
+  }
+  std::vector<float> x(n);
+  for(uint64_t ii = 0; ii < n; ii++) {
+    x[ii] = sample_of(span->source[ii/16] >> (2*(ii % 16)));
+  }
+  for(uint64_t ii = c->first; ii < n; ii += w->decimation) {
+    float y = 0;
+    for(uint64_t k = 0; k < taps; k++) {
+      y += w->h[k]*x[ii - k];
+    }
+    c->out.push_back(y);
+  }
+  return c;
+}
+
+
+void host_sigmf_span(host_sigmf_t *w, const host_rf_span_t *span)
+{
+  if(!w->started) {
+    w->started = true;
+    w->start_clk = span->clock;
+    w->next_clk = span->clock;
+  }
+  if(span->clock < w->next_clk) {
+    return; // Overlaps what has been written
+  }
+  // The pins are not driven between spans
+  while(w->next_clk < span->clock) {
+    push(w, 0, true);
+  }
+
+  uint64_t n = span->n_clocks;
+  uint64_t end = span->clock + n;
+  uint64_t taps = w->h.size();
+  // The output only depends on the buffer once the filter has seen taps-1 samples of this span,
+  // since what came before it need not be the start of the buffer
+  uint64_t known = std::max(span->clock + taps - 1, span->source_clock + taps - 1 + w->decimation);
+  if(w->decimation == 1 || span->source == NULL || known + taps > end ||
+     span->source_clock + 16*span->source_words < end) {
+    for(uint64_t ii = 0; ii < n; ii++) {
+      push(w, span_sample(span, ii), true);
+    }
+    return;
+  }
+
+  sigmf_cache_t *c = cache_get(w, span);
+  known = std::max(span->clock + taps - 1, span->source_clock + c->first);
+  for(uint64_t ii = 0; span->clock + ii < known; ii++) {
+    push(w, span_sample(span, ii), true);
+  }
+  // Then the output is known
+  for(uint64_t t = w->next_clk; t < end; t++) {
+    if((t - w->start_clk) % w->decimation == 0) {
+      put_f32(w, c->out[(t - span->source_clock - c->first)/w->decimation]);
+      t += w->decimation - 1;
+    }
+  }
+  // Fill the history for what comes next
+  w->next_clk = end - taps;
+  for(uint64_t ii = n - taps; ii < n; ii++) {
+    push(w, span_sample(span, ii), false);
+  }
+}
+
+
+void host_sigmf_annotate(host_sigmf_t *w, uint64_t start_clk, uint64_t n_clocks, const char *label)
+{
+  if(!w->started || start_clk < w->start_clk) {
+    return;
+  }
+  sigmf_annotation_t a = {(start_clk - w->start_clk)/w->decimation, n_clocks/w->decimation, label};
+  w->annotations.push_back(a);
+}
+
+
+void host_sigmf_close(host_sigmf_t *w, const char *description)
+{
+  flush_out(w);
+  fclose(w->data);
+
+  std::string name = w->prefix + ".sigmf-meta";
+  FILE *meta = fopen(name.c_str(), "w");
+  if(!meta) {
+    perror(name.c_str());
+    delete w;
+    return;
+  }
+  fprintf(meta, "{\n  \"global\": {\n");
+  fprintf(meta, "    \"core:datatype\": \"%s\",\n", w->decimation == 1 ? "ri8" : "rf32_le");
+  fprintf(meta, "    \"core:sample_rate\": %.6f,\n", (double)HOST_CLOCK_HZ/w->decimation);
+  fprintf(meta, "    \"core:version\": \"1.0.0\",\n");
+  fprintf(meta, "    \"core:recorder\": \"fox_sim\",\n");
+  fprintf(meta, "    \"core:description\": \"%s", description);
+  if(w->decimation > 1) {
+    fprintf(meta, ", %zu tap low-pass filter, decimated by %d", w->h.size(), w->decimation);
+  }
+  fprintf(meta, "\"\n  },\n");
+  fprintf(meta, "  \"captures\": [\n    {\"core:sample_start\": 0}\n  ],\n");
+  fprintf(meta, "  \"annotations\": [");
+  for(size_t ii = 0; ii < w->annotations.size(); ii++) {
+    const sigmf_annotation_t *a = &w->annotations[ii];
+    fprintf(meta, "%s\n    {\"core:sample_start\": %llu, \"core:sample_count\": %llu, \"core:label\": \"%s\"}",
+            ii ? "," : "", (unsigned long long)a->start, (unsigned long long)a->count, a->label.c_str());
+  }
+  fprintf(meta, "\n  ]\n}\n");
+  fclose(meta);
+  printf("Wrote %llu samples to %s.sigmf-data, %llu spans from the cache\n",
+         (unsigned long long)w->n_out, w->prefix.c_str(), (unsigned long long)w->cache_hits);
+  delete w;
+}
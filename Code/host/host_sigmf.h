@@ -0,0 +1,13 @@
+// Streaming SigMF writer for the RF output of the host simulation. The differential output
+// (-1, 0 or 1 per clock cycle) is written at full rate as ri8, or low-pass filtered and 
+// decimated as rf32_le. Key down periods etc are written as annotations.
+#pragma once
+#include <cstdint>
+#include "host.h"
+
+typedef struct host_sigmf host_sigmf_t;
+
+host_sigmf_t *host_sigmf_open(const char *prefix, int decimation, int taps, double cutoff_hz);
+void host_sigmf_span(host_sigmf_t *w, const host_rf_span_t *span);
+void host_sigmf_annotate(host_sigmf_t *w, uint64_t start_clk, uint64_t n_clocks, const char *label);
+void host_sigmf_close(host_sigmf_t *w, const char *description);
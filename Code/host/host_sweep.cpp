@@ -0,0 +1,184 @@
+// Binary protocol sweep for -p, see host_sweep.h
+#include <cstdio>
+#include <cstring>
+#include "host.h"
+#include "host_sweep.h"
+#include "binproto.h"
+#include "commands.h"
+
+struct host_sweep {
+  int n;
+  int batch;
+  bool wait_done;
+  uint64_t latency_us;
+  uint64_t next_us;        // When to send the next frame, UINT64_MAX while waiting
+  int sent;
+  uint8_t seq;
+  uint64_t sent_us;
+  uint64_t first_us, last_us;
+  // Frame being received
+  uint8_t frame[BIN_MAX_FRAME];
+  size_t pos;
+  // Statistics
+  int responses;
+  int done;
+  int errors;              // Error statuses
+  int bad_frames;          // Received frames with a bad CRC
+  uint64_t response_us_total, response_us_max;
+  uint64_t done_us_total, done_us_max;
+};
+
+
+static void sweep_send(host_sweep_t *s)
+{
+  static const int params[] = {PARAM_FREQ, PARAM_AMPL, PARAM_DITHER, PARAM_PH3, PARAM_AMPL3};
+  uint8_t payload[BIN_MAX_PAYLOAD];
+  uint8_t frame[BIN_MAX_FRAME];
+  int k = s->sent;
+
+  for(int ii = 0; ii < s->batch; ii++) {
+    double v = 0;
+    switch(params[ii]) {
+      case PARAM_FREQ:   v = 3.5e6 + 100.0*(k % 1000); break;
+      case PARAM_AMPL:   v = k % 2 ? 0.9 : 1.0; break;
+      case PARAM_DITHER: v = k % 2 ? 0.5 : 0.0; break;
+      case PARAM_PH3:    v = k % 2 ? 10 : 0; break;
+      case PARAM_AMPL3:  v = k % 2 ? 0.01 : 0; break;
+    }
+    payload[ii*BIN_VALUE_SIZE] = params[ii];
+    memcpy(payload + ii*BIN_VALUE_SIZE + 1, &v, sizeof(v));
+  }
+  s->seq++;
+  host_serial_input_bytes(frame, bin_encode(frame, s->seq, BIN_SET, payload, s->batch*BIN_VALUE_SIZE));
+  s->sent_us = host_time_us();
+  if(s->sent == 0) {
+    s->first_us = s->sent_us;
+  }
+  s->sent++;
+  s->next_us = UINT64_MAX;
+}
+
+
+// The PC sends the next frame after its latency, which wakes the firmware like the USB interrupt
+static void sweep_next(host_sweep_t *s)
+{
+  s->next_us = host_time_us() + s->latency_us;
+  uint64_t t_clk = s->next_us*HOST_CLOCKS_PER_US;
+  if(host_wake_clk() <= host_time_clk() || t_clk < host_wake_clk()) {
+    host_wake_at_clk(t_clk);
+  }
+}
+
+
+// A frame from the firmware
+static void sweep_frame(host_sweep_t *s, const uint8_t *frame)
+{
+  uint8_t type = frame[3];
+  const uint8_t *payload = frame + BIN_HEADER;
+  uint64_t us = host_time_us() - s->sent_us;
+
+  if(frame[2] != s->seq) {
+    return; // E.g. a superseded event of an earlier frame
+  }
+  if(type == (BIN_SET | BIN_RESPONSE)) {
+    s->responses++;
+    s->response_us_total += us;
+    s->response_us_max = us > s->response_us_max ? us : s->response_us_max;
+    if(payload[0] != BIN_OK) {
+      s->errors++;
+    }
+    if(!s->wait_done || payload[0] != BIN_OK) {
+      sweep_next(s);
+      s->last_us = host_time_us();
+    }
+  } else if(type == BIN_EVT_DONE) {
+    s->done++;
+    s->done_us_total += us;
+    s->done_us_max = us > s->done_us_max ? us : s->done_us_max;
+    if(s->wait_done) {
+      sweep_next(s);
+    }
+    s->last_us = host_time_us();
+  }
+}
+
+
+// Every byte of console output. Text between the frames is skipped.
+static void sweep_sink(uint8_t c, void *user)
+{
+  host_sweep_t *s = (host_sweep_t *)user;
+
+  if(s->pos == 0 && c != BIN_SYNC) {
+    return;
+  }
+  s->frame[s->pos++] = c;
+  if(s->pos > 1 && s->pos == BIN_HEADER + s->frame[1] + 2u) {
+    size_t n = s->frame[1];
+    uint16_t crc = s->frame[BIN_HEADER + n] | (uint16_t)s->frame[BIN_HEADER + n + 1] << 8;
+    if(crc == bin_crc16(s->frame + 1, BIN_HEADER - 1 + n)) {
+      sweep_frame(s, s->frame);
+    } else {
+      s->bad_frames++;
+    }
+    s->pos = 0;
+  }
+}
+
+
+host_sweep_t *host_sweep_open(uint64_t start_us, int n, int batch, bool wait_done, uint64_t latency_us)
+{
+  host_sweep_t *s = new host_sweep_t();
+
+  s->n = n;
+  s->batch = batch < 1 ? 1 : batch > 5 ? 5 : batch;
+  s->wait_done = wait_done;
+  s->latency_us = latency_us;
+  s->next_us = start_us;
+  host_serial_set_sink(sweep_sink, s);
+  return s;
+}
+
+
+// Send the next frame if it is time. Call before loop().
+void host_sweep_poll(host_sweep_t *s)
+{
+  if(s->sent < s->n && host_time_us() >= s->next_us) {
+    sweep_send(s);
+  }
+}
+
+
+// When the next frame is due, so that the firmware wakes for it
+uint64_t host_sweep_next_us(const host_sweep_t *s)
+{
+  return s->sent < s->n ? s->next_us : UINT64_MAX;
+}
+
+
+void host_sweep_print(const host_sweep_t *s)
+{
+  double span_s = (s->last_us - s->first_us)/1e6;
+
+  printf("Sweep: %d of %d frames sent with %d parameters, %d responses, %d done, %d errors, %d bad frames\n",
+         s->sent, s->n, s->batch, s->responses, s->done, s->errors, s->bad_frames);
+  if(s->responses > 0) {
+    printf("Sweep response: %.3f ms mean, %.3f ms max\n", s->response_us_total/1e3/s->responses,
+           s->response_us_max/1e3);
+  }
+  if(s->done > 0) {
+    printf("Sweep settings in use: %.3f ms mean, %.3f ms max\n", s->done_us_total/1e3/s->done,
+           s->done_us_max/1e3);
+  }
+  if(span_s > 0) {
+    int completed = s->wait_done ? s->done : s->responses;
+    printf("Sweep throughput: %.1f frames/s, %.1f parameters/s (%.3f s, PC latency %llu us)\n",
+           completed/span_s, completed*s->batch/span_s, span_s, (unsigned long long)s->latency_us);
+  }
+}
+
+
+void host_sweep_close(host_sweep_t *s)
+{
+  host_serial_set_sink(NULL, NULL);
+  delete s;
+}
@@ -0,0 +1,15 @@
+// Client of the binary protocol (binproto.h) for a sweep of the synth settings. Each BIN_SET frame
+// is sent when the previous one has been answered, or when its settings are in use, plus the
+// latency of the PC, and the throughput is printed at the end.
+#pragma once
+#include <cstdint>
+
+typedef struct host_sweep host_sweep_t;
+
+// n frames from start_us, with batch (1-5) parameters each: the frequency, in 100 Hz steps, then
+// the amplitude, the dither, the HD3 phase and the HD3 amplitude
+host_sweep_t *host_sweep_open(uint64_t start_us, int n, int batch, bool wait_done, uint64_t latency_us);
+void host_sweep_poll(host_sweep_t *s);
+uint64_t host_sweep_next_us(const host_sweep_t *s);
+void host_sweep_print(const host_sweep_t *s);
+void host_sweep_close(host_sweep_t *s);
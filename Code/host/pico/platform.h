@@ -0,0 +1,5 @@
+// Host mock of the pico SDK platform macros. There is no flash to keep code out of.
+#pragma once
+#define __not_in_flash(group)
+#define __not_in_flash_func(func) func
+#define __time_critical_func(func) func
@@ -0,0 +1,11 @@
+// Host mock of the pico SDK standard include
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+typedef unsigned int uint;
+
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
@@ -0,0 +1,81 @@
+#include <arduino.h>
+#include <hardware/sync.h>
+#include "idle.h"
+
+// Longest sleep, in case something forgot to ask for a wake-up
+static const int32_t idle_max_ms = 50;
+// Estimates of the current of the RP2350 core and bus at 200 MHz running code and in WFI, with
+// the DMA and PIO running. Measure them on the board for an exact figure.
+static const double idle_busy_mA = 20.0;
+static const double idle_sleep_mA = 8.0;
+
+static int32_t idle_wake_ms = idle_max_ms;  // For the next idle_sleep()
+static uint32_t idle_start_us = 0;
+static uint64_t idle_us = 0;
+static uint32_t idle_sleeps = 0;
+
+
+// The alarm only has to wake the core
+static int64_t idle_alarm_callback(alarm_id_t id, void *user_data)
+{
+  return 0;
+}
+
+
+// Ask for loop() to run again within ms milliseconds. 0 or less means right away.
+void idle_wake_in_ms(int32_t ms)
+{
+  if(ms < idle_wake_ms) {
+    idle_wake_ms = ms;
+  }
+}
+
+
+// Sleep until an interrupt or the earliest time asked for since the last call
+void idle_sleep()
+{
+  int32_t ms = idle_wake_ms;
+
+  idle_wake_ms = idle_max_ms;
+#if IDLE_SLEEP
+  if(ms <= 0 || Serial.available()) {
+    return;
+  }
+  uint32_t t_start = time_us_32();
+  alarm_id_t alarm = add_alarm_in_us((uint64_t)ms*1000, idle_alarm_callback, NULL, true);
+  if(alarm <= 0) {
+    return; // Due already, or no alarm to wake up with
+  }
+  // With the interrupts masked an interrupt that is already pending still ends the WFI, so
+  // nothing that happens after the checks is missed. Its handler runs when they are unmasked.
+  uint32_t irq_state = save_and_disable_interrupts();
+  __wfi();
+  restore_interrupts(irq_state);
+  cancel_alarm(alarm);
+  idle_us += time_us_32() - t_start;
+  idle_sleeps++;
+#endif
+}
+
+
+void idle_print_stats()
+{
+#if IDLE_SLEEP
+  uint32_t total_us = time_us_32() - idle_start_us;
+  double idle = total_us ? (double)idle_us/total_us : 0;
+
+  Serial.printf("Idle: %.1f%% of %.3f s, %lu sleeps\n", 100*idle, total_us/1e6, (unsigned long)idle_sleeps);
+  Serial.printf("Estimated saving: %.1f mA of the %.1f mA of the core when busy\n",
+                idle*(idle_busy_mA - idle_sleep_mA), idle_busy_mA);
+#else
+  Serial.println("Idle sleep is not enabled (IDLE_SLEEP)");
+#endif
+}
+
+
+void idle_clear_stats()
+{
+  idle_start_us = time_us_32();
+  idle_us = 0;
+  idle_sleeps = 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Sleep of the main loop. The parts of loop() tell with idle_wake_in_ms() when they next have
+// something to do, and idle_sleep() at the end of loop() waits for an interrupt (WFI) until then.
+// The DMA and alarm interrupts of the keying, the USB interrupt of the console and the button
+// interrupt wake it earlier. The DMA and PIO keep running while the core sleeps. Build with
+// IDLE_SLEEP 0 to poll all the time like before.
+#ifndef IDLE_SLEEP
+#define IDLE_SLEEP 1
+#endif
+
+void idle_wake_in_ms(int32_t ms);
+void idle_sleep();
+void idle_print_stats();
+void idle_clear_stats();
@@ -0,0 +1,216 @@
+#include <arduino.h>
+#include <atomic>
+#include <cstdarg>
+#include <cstring>
+#include "log.h"
+
+// The ring holds records of a 4 byte header and the text, padded to a multiple of 4 bytes.
+// A writer reserves space by moving log_head with compare-and-swap, so loop() and interrupts
+// can write at the same time without locks. The record is marked ready when its text is in
+// place, and log_drain() stops at the first record that is not. A record that would wrap is
+// preceded by a padding record to the end of the ring. log_drain() zeroes what it has read, so
+// reserved space never looks like a ready record. A record is only sent when all of it fits
+// in the transmit buffer, so the replies that the commands print directly never land in the
+// middle of a log line. A record from log_irq() holds a log_deferred_t instead of the text.
+static const uint32_t log_ring_size = 4096;  // Bytes, a power of two
+static const int log_line_max = 120;         // Longer messages are cut
+static const uint8_t log_free = 0;
+static const uint8_t log_ready = 1;
+static const uint8_t log_padding = 2;
+static const uint8_t log_deferred = 3;
+
+typedef struct {
+  uint16_t len;           // Length of the text, or of the padding after the header
+  uint8_t level;
+  volatile uint8_t state;
+} log_header_t;
+
+typedef struct {
+  const char *format;
+  long args[3];
+} log_deferred_t;
+
+static uint32_t log_ring[log_ring_size/4];
+static std::atomic<uint32_t> log_head(0);    // Reserved up to here
+static std::atomic<uint32_t> log_tail(0);    // Drained up to here
+
+// Statistics
+static std::atomic<uint32_t> log_messages(0);
+static std::atomic<uint32_t> log_dropped(0);
+static std::atomic<uint32_t> log_write_us(0);
+static uint32_t log_write_max_us = 0;
+static uint32_t log_drain_us = 0;
+static uint32_t log_drain_max_us = 0;
+static uint32_t log_fill_max = 0;            // Most bytes in the ring
+
+
+static log_header_t *log_header_at(uint32_t pos)
+{
+  return (log_header_t *)((uint8_t *)log_ring + (pos & (log_ring_size - 1)));
+}
+
+
+// Put a message in the ring. Returns false if there is no room.
+static bool log_put(int level, uint8_t state, const void *text, int len)
+{
+  uint32_t need = sizeof(log_header_t) + ((len + 3) & ~3u);
+  uint32_t head, pad, next;
+
+  do {
+    head = log_head.load(std::memory_order_relaxed);
+    uint32_t index = head & (log_ring_size - 1);
+    pad = index + need > log_ring_size ? log_ring_size - index : 0;
+    next = head + pad + need;
+    if(next - log_tail.load(std::memory_order_acquire) > log_ring_size) {
+      return false;
+    }
+  } while(!log_head.compare_exchange_weak(head, next, std::memory_order_acq_rel));
+
+  if(next - log_tail.load(std::memory_order_relaxed) > log_fill_max) {
+    log_fill_max = next - log_tail.load(std::memory_order_relaxed);
+  }
+  if(pad) {
+    log_header_t *h = log_header_at(head);
+    h->len = pad - sizeof(log_header_t);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->state = log_padding;
+    head += pad;
+  }
+  log_header_t *h = log_header_at(head);
+  h->len = len;
+  h->level = level;
+  memcpy(h + 1, text, len);
+  std::atomic_thread_fence(std::memory_order_release);
+  h->state = state;
+  return true;
+}
+
+
+// Log a line of text, printf style. Use the LOG_ macros so that the levels can be compiled out.
+void log_printf(int level, const char *format, ...)
+{
+  uint32_t t_start = time_us_32();
+  char text[log_line_max];
+  va_list args;
+
+  va_start(args, format);
+  int len = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if(len < 0) {
+    return;
+  }
+  if(len >= log_line_max) {
+    len = log_line_max - 1;
+  }
+  log_messages++;
+#ifdef LOG_DIRECT
+  (void)level;
+  Serial.println(text);
+#else
+  if(!log_put(level, log_ready, text, len)) {
+    log_dropped++;
+  }
+#endif
+  uint32_t us = time_us_32() - t_start;
+  log_write_us += us;
+  if(us > log_write_max_us) {
+    log_write_max_us = us;
+  }
+}
+
+
+// Log from an interrupt. Only the format and the arguments are stored, see log.h. Also with 
+// LOG_DIRECT, as printing is not safe from an interrupt either.
+void log_irq(int level, const char *format, long a, long b, long c)
+{
+  log_deferred_t d = {format, {a, b, c}};
+
+  log_messages++;
+  if(!log_put(level, log_deferred, &d, sizeof(d))) {
+    log_dropped++;
+  }
+}
+
+
+// Send the whole records that fit in the serial transmit buffer. Call often from loop(), it does
+// not block.
+void log_drain()
+{
+  uint32_t t_start = time_us_32();
+  uint32_t tail = log_tail.load(std::memory_order_relaxed);
+  int space = Serial.availableForWrite();
+
+  while(tail != log_head.load(std::memory_order_acquire)) {
+    log_header_t *h = log_header_at(tail);
+    uint8_t state = h->state;
+    if(state == log_free) {
+      break; // Still being written
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t size = sizeof(log_header_t) + (state == log_padding ? h->len : (h->len + 3) & ~3u);
+    if(state != log_padding) {
+      const char *text = (const char *)(h + 1);
+      int len = h->len;
+      char deferred[log_line_max];
+      if(state == log_deferred) {
+        const log_deferred_t *d = (const log_deferred_t *)(h + 1);
+        len = snprintf(deferred, sizeof(deferred), d->format, d->args[0], d->args[1], d->args[2]);
+        len = len < 0 ? 0 : len >= log_line_max ? log_line_max - 1 : len;
+        text = deferred;
+      }
+      // The text and a line break
+      if(space < len + 2) {
+        break;
+      }
+      Serial.write((const uint8_t *)text, len);
+      Serial.write('\r');
+      Serial.write('\n');
+      space -= len + 2;
+    }
+    memset(h, 0, size);
+    tail += size;
+    log_tail.store(tail, std::memory_order_release);
+  }
+
+  uint32_t us = time_us_32() - t_start;
+  log_drain_us += us;
+  if(us > log_drain_max_us) {
+    log_drain_max_us = us;
+  }
+}
+
+
+// True if there are messages left to send
+bool log_pending()
+{
+  return log_tail.load(std::memory_order_relaxed) != log_head.load(std::memory_order_relaxed);
+}
+
+
+void log_print_stats()
+{
+#ifdef LOG_DIRECT
+  Serial.println("Logging: direct to Serial");
+#else
+  Serial.printf("Logging: ring of %lu bytes, %lu in use, at most %lu\n", (unsigned long)log_ring_size,
+                (unsigned long)(log_head.load() - log_tail.load()), (unsigned long)log_fill_max);
+#endif
+  Serial.printf("Messages: %lu, dropped: %lu\n", (unsigned long)log_messages.load(),
+                (unsigned long)log_dropped.load());
+  Serial.printf("Time in log calls: %lu us, max %lu us per call\n", (unsigned long)log_write_us.load(),
+                (unsigned long)log_write_max_us);
+  Serial.printf("Time draining: %lu us, max %lu us per call\n", (unsigned long)log_drain_us,
+                (unsigned long)log_drain_max_us);
+}
+
+
+void log_clear_stats()
+{
+  log_messages = 0;
+  log_dropped = 0;
+  log_write_us = 0;
+  log_write_max_us = 0;
+  log_drain_us = 0;
+  log_drain_max_us = 0;
+  log_fill_max = 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// Log messages go to a ring buffer that loop() drains to Serial with log_drain(), as much as fits
+// in the transmit buffer, so logging never blocks. Messages above LOG_LEVEL are compiled out. 
+// Build with LOG_DIRECT defined to print right away instead, e.g. to compare the time spent with 
+// logstat.
+// From interrupts, use the _IRQ macros. vsnprintf() can allocate memory, e.g. for %f, and an 
+// interrupt in the middle of a malloc() in loop() would then deadlock or corrupt the heap. The 
+// _IRQ macros only store the format, which must be a string literal, and up to three integer 
+// arguments, passed as long so use %ld, %lu or %lx. log_drain() formats them later.
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_ERROR(...) do {if(LOG_LEVEL >= LOG_LEVEL_ERROR) log_printf(LOG_LEVEL_ERROR, __VA_ARGS__);} while(0)
+#define LOG_WARN(...) do {if(LOG_LEVEL >= LOG_LEVEL_WARN) log_printf(LOG_LEVEL_WARN, __VA_ARGS__);} while(0)
+#define LOG_INFO(...) do {if(LOG_LEVEL >= LOG_LEVEL_INFO) log_printf(LOG_LEVEL_INFO, __VA_ARGS__);} while(0)
+#define LOG_DEBUG(...) do {if(LOG_LEVEL >= LOG_LEVEL_DEBUG) log_printf(LOG_LEVEL_DEBUG, __VA_ARGS__);} while(0)
+
+#define LOG_ERROR_IRQ(...) do {if(LOG_LEVEL >= LOG_LEVEL_ERROR) log_irq(LOG_LEVEL_ERROR, __VA_ARGS__);} while(0)
+#define LOG_WARN_IRQ(...) do {if(LOG_LEVEL >= LOG_LEVEL_WARN) log_irq(LOG_LEVEL_WARN, __VA_ARGS__);} while(0)
+#define LOG_INFO_IRQ(...) do {if(LOG_LEVEL >= LOG_LEVEL_INFO) log_irq(LOG_LEVEL_INFO, __VA_ARGS__);} while(0)
+#define LOG_DEBUG_IRQ(...) do {if(LOG_LEVEL >= LOG_LEVEL_DEBUG) log_irq(LOG_LEVEL_DEBUG, __VA_ARGS__);} while(0)
+
+void log_printf(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void log_irq(int level, const char *format, long a = 0, long b = 0, long c = 0);
+void log_drain();
+bool log_pending();
+void log_print_stats();
+void log_clear_stats();
@@ -0,0 +1,315 @@
+// Compilation of the fox string and call sign into a schedule of key down/key up runs,
+// and a player that steps through the schedule in constant time per run.
+
+#include "morse.h"
+#include <arduino.h>
+#include <cstring>
+
+
+// Conversion table from ASCII to morse code.
+// Dashes are encoded as ones, and dots as zeros in the LSBs.
+// The MorseLengths array tells how many pieces each character has.
+static const uint8_t MorseCodes[] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x06, 0x12, 0x09, 0x09, 0x0C, 0x00, 0x1E,
+  0x16, 0x2D, 0x00, 0x0A, 0x33, 0x21, 0x15, 0x12, 0x1F, 0x0F,
+  0x07, 0x03, 0x01, 0x00, 0x10, 0x18, 0x1C, 0x1E, 0x38, 0x2A,
+  0x00, 0x00, 0x00, 0x0C, 0x1A, 0x01, 0x08, 0x0A, 0x04, 0x00,
+  0x02, 0x06, 0x00, 0x00, 0x07, 0x05, 0x04, 0x03, 0x02, 0x07,
+  0x06, 0x0D, 0x02, 0x00, 0x01, 0x01, 0x01, 0x03, 0x09, 0x0B,
+  0x0C, 0x00, 0x00, 0x00, 0x00, 0x0D, 0x1E, 0x01, 0x08, 0x0A,
+  0x04, 0x00, 0x02, 0x06, 0x00, 0x00, 0x07, 0x05, 0x04, 0x03,
+  0x02, 0x07, 0x06, 0x0D, 0x02, 0x00, 0x01, 0x01, 0x01, 0x03,
+  0x09, 0x0B, 0x0C, 0x00, 0x00, 0x00, 0x15, 0x00
+};
+
+static const uint8_t MorseLengths[] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x05, 0x06, 0x05, 0x07, 0x05, 0x00, 0x06,
+  0x05, 0x06, 0x00, 0x05, 0x06, 0x06, 0x06, 0x05, 0x05, 0x05,
+  0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06,
+  0x00, 0x00, 0x00, 0x06, 0x06, 0x02, 0x04, 0x04, 0x03, 0x01,
+  0x04, 0x03, 0x04, 0x02, 0x04, 0x03, 0x04, 0x02, 0x02, 0x03,
+  0x04, 0x04, 0x03, 0x03, 0x01, 0x03, 0x04, 0x03, 0x04, 0x04,
+  0x04, 0x00, 0x00, 0x00, 0x00, 0x06, 0x06, 0x02, 0x04, 0x04,
+  0x03, 0x01, 0x04, 0x03, 0x04, 0x02, 0x04, 0x03, 0x04, 0x02,
+  0x02, 0x03, 0x04, 0x04, 0x03, 0x03, 0x01, 0x03, 0x04, 0x03,
+  0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00
+};
+
+// Morse timing in units
+static const uint16_t DOT_UNITS = 1;
+static const uint16_t DASH_UNITS = 3;
+static const uint16_t PIECE_PAUSE_UNITS = 1;
+static const uint16_t CHAR_PAUSE_UNITS = 3;
+static const uint16_t WORD_PAUSE_UNITS = 7;
+
+
+// Length of a morse unit in us at the given rate in words per minute. Not rounded, 
+// e.g. 17 WPM gives 70588.2 us.
+double morse_us_per_unit(int wpm)
+{
+  if(wpm < 5) {
+    wpm = 5;
+  }
+  if(wpm > 100) {
+    wpm = 100;
+  }
+  return 60e6 / (wpm * 50.0); // us per minute / WPM / units per word
+}
+
+
+// Append a run, or extend the last one if it has the same flags.
+static void append_run(morse_schedule_t *sched, uint8_t flags, uint16_t units)
+{
+  if(sched->n_runs > 0 && sched->runs[sched->n_runs-1].flags == flags) {
+    sched->runs[sched->n_runs-1].units += units;
+  } else if(sched->n_runs < MAX_MORSE_RUNS) {
+    sched->runs[sched->n_runs].units = units;
+    sched->runs[sched->n_runs].flags = flags;
+    sched->n_runs++;
+  }
+}
+
+
+// Append the runs of a string, followed by a word pause.
+// Each character ends with a character pause, so a space or the end adds the rest of a word pause.
+static void append_string(morse_schedule_t *sched, const char *str, uint8_t flags, uint8_t end_flags)
+{
+  for(const char *p = str; *p != '\0'; p++) {
+    uint8_t c = *p;
+    if(c == ' ') {
+      append_run(sched, flags, WORD_PAUSE_UNITS - CHAR_PAUSE_UNITS);
+      continue;
+    }
+    if(c >= sizeof(MorseLengths) || MorseLengths[c] == 0) {
+      // Invalid character, skip it
+      continue;
+    }
+    for(int bit = MorseLengths[c]; bit > 0; bit--) {
+      if(MorseCodes[c] & (1 << (bit - 1))) {
+        append_run(sched, flags | MORSE_KEY_DOWN, DASH_UNITS);
+      } else {
+        append_run(sched, flags | MORSE_KEY_DOWN, DOT_UNITS);
+      }
+      append_run(sched, flags, bit > 1 ? PIECE_PAUSE_UNITS : CHAR_PAUSE_UNITS);
+    }
+  }
+  append_run(sched, end_flags, WORD_PAUSE_UNITS - CHAR_PAUSE_UNITS);
+}
+
+
+// Compile the fox string and call sign to a schedule. Only needs to be done when they, or the rate, change.
+void morse_compile(morse_schedule_t *sched, int wpm, const char *fox_string, const char *call)
+{
+  sched->n_runs = 0;
+  append_string(sched, fox_string, 0, 0);
+  sched->n_fox = sched->n_runs;
+  if(strlen(call) > 0) {
+    append_string(sched, call, MORSE_FAST, MORSE_FAST | MORSE_PULSE);
+  }
+  sched->us_per_unit[0] = morse_us_per_unit(wpm);
+  sched->us_per_unit[1] = morse_us_per_unit(2*wpm);
+  sched->wpm = wpm;
+  strncpy(sched->fox_string, fox_string, sizeof(sched->fox_string));
+  sched->fox_string[MAX_FOX_LEN] = '\0';
+  strncpy(sched->call, call, sizeof(sched->call));
+  sched->call[MAX_CALL_LEN] = '\0';
+}
+
+
+// True if the schedule was compiled from this configuration
+bool morse_schedule_matches(const morse_schedule_t *sched, int wpm, const char *fox_string, const char *call)
+{
+  return sched->wpm == wpm && strcmp(sched->fox_string, fox_string) == 0 && strcmp(sched->call, call) == 0;
+}
+
+
+void morse_player_reset(morse_player_t *player)
+{
+  player->index = 0;
+  player->repeat = 0;
+}
+
+
+// Return the next run of the schedule, or NULL if it is empty.
+// The fox string is repeated FOX_REPEATS times, then the call sign is sent, and then it all starts over.
+const morse_run_t *morse_next(const morse_schedule_t *sched, morse_player_t *player)
+{
+  const morse_run_t *run;
+
+  if(sched->n_runs == 0) {
+    return NULL;
+  }
+  if(player->index >= sched->n_runs) {
+    morse_player_reset(player);
+  }
+  run = &sched->runs[player->index];
+  player->index++;
+  if(player->index == sched->n_fox && ++player->repeat < FOX_REPEATS) {
+    player->index = 0;
+  } else if(player->index >= sched->n_runs) {
+    morse_player_reset(player);
+  }
+  return run;
+}
+
+
+// Duration of a run in us
+double morse_run_us(const morse_schedule_t *sched, const morse_run_t *run)
+{
+  return run->units * sched->us_per_unit[(run->flags & MORSE_FAST) ? 1 : 0];
+}
+
+
+// Start a new timeline with ticks of tick_us
+void key_timeline_reset(key_timeline_t *timeline, double tick_us)
+{
+  timeline->tick_us = tick_us;
+  timeline->ideal_us = 0;
+  timeline->ticks = 0;
+  timeline->error_max_us = 0;
+}
+
+
+// Add a segment of 'us' microseconds to the timeline and return its length in ticks.
+// The end of the segment is the ideal end rounded to the nearest tick, so some segments 
+// get one tick more or less than others, but the timeline never drifts.
+uint32_t key_timeline_advance(key_timeline_t *timeline, double us)
+{
+  uint64_t end;
+  uint32_t ticks;
+  double error_us;
+
+  timeline->ideal_us += us;
+  end = (uint64_t)(timeline->ideal_us / timeline->tick_us + 0.5);
+  error_us = fabs(end * timeline->tick_us - timeline->ideal_us);
+  if(error_us > timeline->error_max_us) {
+    timeline->error_max_us = error_us;
+  }
+  ticks = end - timeline->ticks;
+  timeline->ticks = end;
+  return ticks;
+}
+
+
+// How much longer a fox cycle gets with the unit length truncated to whole ms, as it used to be
+static double units_per_cycle_drift_ms(int wpm, const morse_schedule_t *sched)
+{
+  double drift_ms = 0;
+  int rate[2] = {wpm, std::min(2*wpm, 100)};
+
+  for(int ii = 0; ii < sched->n_runs; ii++) {
+    int fast = (sched->runs[ii].flags & MORSE_FAST) ? 1 : 0;
+    double truncated_ms = (1000 * 60 / (rate[fast] * 50));
+    double repeats = (ii < sched->n_fox) ? FOX_REPEATS : 1;
+    drift_ms += repeats * sched->runs[ii].units * (truncated_ms - sched->us_per_unit[fast] / 1000.0);
+  }
+  return drift_ms;
+}
+
+
+// Play whole cycles of a few schedules in virtual time and check the timing.
+// PARIS is 50 units long including the word pause.
+void test_morse_schedule()
+{
+  static morse_schedule_t sched;
+  morse_player_t player;
+  typedef struct {
+    int wpm;
+    const char *fox;
+    const char *call;
+    uint32_t fox_units;   // Expected length of one fox string
+    uint32_t call_units;  // Expected length of the call sign
+    uint32_t key_downs;   // Expected number of dots and dashes in a cycle
+  } morse_test_case_t;
+  morse_test_case_t test[] = {
+    {20, "PARIS", "PARIS", 50, 50, 11*14},
+    {10, "MOE", "", 32, 0, 10*6},
+    {17, "PARIS PARIS", "SA5BYZ", 100, 74, 10*28 + 22},
+    {35, "5", "E", 16, 8, 10*5 + 1},
+  };
+  uint32_t n_tests = sizeof(test)/sizeof(test[0]);
+
+  for(uint32_t ii = 0; ii < n_tests; ii++) {
+    morse_compile(&sched, test[ii].wpm, test[ii].fox, test[ii].call);
+    morse_player_reset(&player);
+    double t_ms = 0;
+    uint32_t key_downs = 0, n_runs = 0;
+    bool ok = true;
+    uint8_t last_flags = 0xFF;
+    // Play one cycle, and check that it has wrapped around
+    do {
+      const morse_run_t *run = morse_next(&sched, &player);
+      if(run->flags == last_flags) {
+        ok = false; // Runs with equal flags should have been merged
+      }
+      last_flags = run->flags;
+      t_ms += morse_run_us(&sched, run) / 1000.0;
+      key_downs += (run->flags & MORSE_KEY_DOWN) ? 1 : 0;
+      n_runs++;
+    } while((player.index != 0 || player.repeat != 0) && n_runs < 100000);
+    double expected_ms = (FOX_REPEATS * test[ii].fox_units * sched.us_per_unit[0] +
+                          test[ii].call_units * sched.us_per_unit[1]) / 1000.0;
+    ok = ok && fabs(t_ms - expected_ms) < 1e-6 && key_downs == test[ii].key_downs;
+    Serial.printf("wpm = %d, fox = \"%s\", call = \"%s\": cycle %.1f ms, %lu runs, %lu key downs ",
+                  test[ii].wpm, test[ii].fox, test[ii].call, t_ms, (unsigned long)n_runs, (unsigned long)key_downs);
+    if(ok) {
+      Serial.println(" OK");
+    } else {
+      Serial.printf("Expected %.1f ms, %lu key downs\n", expected_ms, (unsigned long)test[ii].key_downs);
+    }
+  }
+}
+
+
+// Play 'cycles' fox cycles through a keying timeline in virtual time, for a few rates and tick lengths,
+// and check that every key change is within half a tick of the ideal time, also after many cycles.
+// The ideal time is counted in whole units, so it is exact.
+// Also show how far the old whole-ms unit length would have drifted in the same time.
+void test_morse_timing(uint32_t cycles)
+{
+  static morse_schedule_t sched;
+  morse_player_t player;
+  key_timeline_t timeline;
+  const int rates[] = {5, 10, 13, 17, 20, 35, 50};
+  const double ticks_us[] = {1.0, 327.68, 1200.0};  // Timer, short buffer, full buffer
+  uint32_t n_fail = 0;
+
+  for(uint32_t ii = 0; ii < sizeof(rates)/sizeof(rates[0]); ii++) {
+    morse_compile(&sched, rates[ii], "MOE", "SA5BYZ");
+    for(uint32_t jj = 0; jj < sizeof(ticks_us)/sizeof(ticks_us[0]); jj++) {
+      uint64_t units[2] = {0, 0};   // Normal and fast units played so far
+      double error_max_us = 0;
+      double cycle_us = 0;
+      morse_player_reset(&player);
+      key_timeline_reset(&timeline, ticks_us[jj]);
+      for(uint32_t cycle = 0; cycle < cycles; cycle++) {
+        do {
+          const morse_run_t *run = morse_next(&sched, &player);
+          key_timeline_advance(&timeline, morse_run_us(&sched, run));
+          units[(run->flags & MORSE_FAST) ? 1 : 0] += run->units;
+          double ideal_us = units[0] * 60e6 / (rates[ii] * 50.0) + 
+                            units[1] * 60e6 / (std::min(2*rates[ii], 100) * 50.0);
+          double error_us = fabs(timeline.ticks * timeline.tick_us - ideal_us);
+          if(error_us > error_max_us) {
+            error_max_us = error_us;
+          }
+          cycle_us = ideal_us / (cycle + 1);
+        } while(player.index != 0 || player.repeat != 0);
+      }
+      bool ok = error_max_us <= ticks_us[jj]/2 * (1 + 1e-9);
+      n_fail += ok ? 0 : 1;
+      Serial.printf("%3d WPM, tick %7.2f us: %lu cycles of %.1f ms, max error %.2f us", rates[ii], ticks_us[jj], 
+                    (unsigned long)cycles, cycle_us / 1000.0, error_max_us);
+      Serial.println(ok ? " OK" : " FAIL");
+    }
+    double old_drift_ms = (units_per_cycle_drift_ms(rates[ii], &sched)) * cycles;
+    Serial.printf("%3d WPM: whole-ms units would have been %.1f ms off\n", rates[ii], old_drift_ms);
+  }
+  Serial.printf("Morse timing: %lu failures\n", (unsigned long)n_fail);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include "config.h"
+
+// Flags of a morse run
+const uint8_t MORSE_KEY_DOWN = 0x01; // Transmit during the run
+const uint8_t MORSE_FAST = 0x02;     // The length is in units of the fast (call sign) rate
+const uint8_t MORSE_PULSE = 0x04;    // Pulse the LED and the power bank load during the run
+
+const int FOX_REPEATS = 10;          // Number of times to send the fox string before the call sign
+
+// Max number of pieces (dots and dashes) of a character is 6, each followed by a pause. Plus the word pauses.
+const int MAX_MORSE_RUNS = 2*6*(MAX_FOX_LEN + MAX_CALL_LEN) + 4;
+
+// A run of constant key state
+typedef struct {
+  uint16_t units;  // Length in morse units
+  uint8_t flags;
+} morse_run_t;
+
+// A compiled fox cycle: the fox string FOX_REPEATS times, then the call sign at twice the rate.
+typedef struct {
+  morse_run_t runs[MAX_MORSE_RUNS];
+  uint16_t n_fox;   // runs[0] to runs[n_fox-1] is the fox string with the word pause after it
+  uint16_t n_runs;  // runs[n_fox] to runs[n_runs-1] is the call sign with the word pause after it
+  double us_per_unit[2]; // Normal and fast rate
+  // The configuration that was compiled
+  int wpm;
+  char fox_string[MAX_FOX_LEN+1];
+  char call[MAX_CALL_LEN+1];
+} morse_schedule_t;
+
+// Position in a morse_schedule_t
+typedef struct {
+  uint16_t index;
+  uint16_t repeat;
+} morse_player_t;
+
+// Keying timeline that rounds segment lengths to whole ticks (buffer periods or timer us).
+// Segment ends are rounded from the ideal absolute time, so the error never builds up.
+typedef struct {
+  double tick_us;       // Duration of a tick
+  double ideal_us;      // Ideal end of the segments so far
+  uint64_t ticks;       // Rounded end of the segments so far
+  double error_max_us;  // Largest deviation of a rounded segment end from the ideal one
+} key_timeline_t;
+
+
+double morse_us_per_unit(int wpm);
+void morse_compile(morse_schedule_t *sched, int wpm, const char *fox_string, const char *call);
+bool morse_schedule_matches(const morse_schedule_t *sched, int wpm, const char *fox_string, const char *call);
+void morse_player_reset(morse_player_t *player);
+const morse_run_t *morse_next(const morse_schedule_t *sched, morse_player_t *player);
+double morse_run_us(const morse_schedule_t *sched, const morse_run_t *run);
+void key_timeline_reset(key_timeline_t *timeline, double tick_us);
+uint32_t key_timeline_advance(key_timeline_t *timeline, double us);
+void test_morse_schedule();
+void test_morse_timing(uint32_t cycles);
@@ -0,0 +1,65 @@
+#include <arduino.h>
+#include "prof.h"
+
+typedef struct {
+  uint32_t calls;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+} prof_entry_t;
+
+static const char *prof_names[PROF_N] = {
+  "loop", "log", "cmd", "settings", "stats", "lcd", "temp", "power", "button", "morse"
+};
+
+static prof_entry_t prof_entries[PROF_N];
+
+
+// The cycle counter of the Arduino core, SysTick based, so it works on both the RP2040 and RP2350
+uint32_t prof_cycles()
+{
+  return rp2040.getCycleCount();
+}
+
+
+void prof_add(prof_id_t id, uint32_t cycles)
+{
+  prof_entry_t *e = &prof_entries[id];
+
+  if(e->calls == 0 || cycles < e->min) {
+    e->min = cycles;
+  }
+  if(cycles > e->max) {
+    e->max = cycles;
+  }
+  e->total += cycles;
+  e->calls++;
+}
+
+
+void prof_print()
+{
+#if PROF_ENABLE
+  double us_per_cycle = 1e6/rp2040.f_cpu();
+  uint64_t loop_total = prof_entries[PROF_LOOP].total;
+
+  Serial.println("Part       calls     min cyc    mean cyc     max cyc      max us  share");
+  for(int ii = 0; ii < PROF_N; ii++) {
+    const prof_entry_t *e = &prof_entries[ii];
+    if(e->calls == 0) {
+      continue;
+    }
+    Serial.printf("%-8s %7lu %11lu %11lu %11lu %11.1f %5.1f%%\n", prof_names[ii], (unsigned long)e->calls,
+                  (unsigned long)e->min, (unsigned long)(e->total/e->calls), (unsigned long)e->max,
+                  e->max*us_per_cycle, loop_total ? 100.0*e->total/loop_total : 0.0);
+  }
+#else
+  Serial.println("The profiler is not enabled (PROF_ENABLE)");
+#endif
+}
+
+
+void prof_reset()
+{
+  memset(prof_entries, 0, sizeof(prof_entries));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// Profiler of the parts of loop(). Each part is timed with the CPU cycle counter between
+// PROF_BEGIN and PROF_END, and the min, mean and max cycles and the number of calls are kept.
+// The prof command prints and resets them. Build with PROF_ENABLE 0 to remove it.
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 1
+#endif
+
+typedef enum {
+  PROF_LOOP,      // All of loop()
+  PROF_LOG,       // log_drain()
+  PROF_CMD,       // bin_poll(), the binary frames and the text commands
+  PROF_SETTINGS,  // rf_synth->poll_settings()
+  PROF_STATS,     // rf_synth->poll_stats()
+  PROF_LCD,       // lcd_show_status()
+  PROF_TEMP,      // tc_poll()
+  PROF_POWER,     // Power bank pulses
+  PROF_BUTTON,    // btn1 and the switches
+  PROF_MORSE,     // queueMorse() or start_transmitting()
+  PROF_N
+} prof_id_t;
+
+#if PROF_ENABLE
+#define PROF_BEGIN(id) uint32_t prof_start_##id = prof_cycles()
+#define PROF_END(id) prof_add(id, prof_cycles() - prof_start_##id)
+#else
+#define PROF_BEGIN(id) do {} while(0)
+#define PROF_END(id) do {} while(0)
+#endif
+
+uint32_t prof_cycles();
+void prof_add(prof_id_t id, uint32_t cycles);
+void prof_print();
+void prof_reset();
@@ -3,31 +3,159 @@
 #include "synth.h"
 #include "toggle.h"
 #include "commands.h"
+#include "config.h"
+#include "morse.h"
+#include "log.h"
 
-double CPU_freq_actual = 200e6;
+double CPU_freq_actual = CPU_freq_nominal;
 
-const int max_words = 15000;
-
-// These variables have to be outside the class as they are used by the interrupt handler
+// These variables are outside the class as they are shared with the DMA control blocks
 static uint32_t synth_dma;
 static uint32_t restart_dma;
+static uint32_t link_read_dma;
+static uint32_t link_write_dma;
 static uint32_t synth_buffer[max_words] __attribute__((aligned(4)));
 static uint32_t synth_buffer_ramp_up[max_words] __attribute__((aligned(4)));
 static uint32_t synth_buffer_ramp_down[max_words] __attribute__((aligned(4)));
 static uint32_t synth_buffer_silent[max_words] __attribute__((aligned(4)));
-static uint32_t *synth_buffer_ptr[1];
-static uint32_t *synth_buffer_ramp_up_ptr[1];
-static uint32_t *synth_buffer_ramp_down_ptr[1];
-static uint32_t *synth_buffer_silent_ptr[1];
-static bool enable_transmit = false;
+static volatile bool enable_transmit = false;
+
+// False while apply_settings() overwrites the buffers. The chain then plays the silent buffer and 
+// the keying only keeps track of the key state, until key_resync makes the DMA interrupt start 
+// the new buffers in the current key state.
+static volatile bool buffers_ready = true;
+static volatile bool key_resync = false;
+
+// DMA control blocks, linked into a list that the DMAs walk without any help from the CPU.
+// When the synth DMA has finished a buffer, the restart DMA copies count and addr of the next 
+// block to the transfer count and the triggering read address registers of the synth DMA.
+// Its read address is then left pointing at the next field, which the two link DMAs use to 
+// load the read address of the restart DMA with the block after that.
+// All fields are pointer sized, which gives the same layout as on the device also when the 
+// code is built for a 64-bit host.
+typedef struct dma_block {
+  uintptr_t count;
+  const uint32_t *addr;
+  const struct dma_block *next;
+} dma_block_t;
+
+// The lists are ramp_up -> main -> main..., and ramp_down -> silent -> silent...
+// Keying only redirects the restart DMA to ramp_up or ramp_down, see retarget_chain().
+static dma_block_t block_main;      // The main buffer, not used in dual modulus mode
+static dma_block_t block_ramp_up;
+static dma_block_t block_ramp_down;
+static dma_block_t block_silent;
+
+// Sequence of buffer A (0) and B (1) in dual modulus mode, dual_seq_len = 0 otherwise.
+// dual_blocks is the same sequence as a circular list of control blocks.
+static const int max_dual_seq = 1024;
+static uint8_t dual_seq[max_dual_seq];
+static dma_block_t dual_blocks[max_dual_seq];
+static volatile int dual_seq_len = 0;
+
+// Pin that follows the keying, for measurements with a scope
+static const uint debug_pin = 26;
+
+// Number of times the PIO TX FIFO has run empty during a flash write
+static uint32_t flash_tx_stalls = 0;
+static uint32_t flash_late_changes;              // key_late_changes when the write began
+static bool flash_key_down;                      // The key was down when the write began
+
+// Streaming statistics. The TX stalls are polled from loop(), the keying latencies are measured 
+// in retarget_chain(). Histogram bucket n counts latencies from 2^(n-1) up to 2^n - 1 us.
+static const int latency_buckets = 16;
+static uint32_t tx_stall_polls = 0;       // Number of polls that found the stall flag set
+static uint32_t stat_polls = 0;
+static uint32_t retarget_count = 0;
+static uint32_t retarget_wait_max_us = 0; // Longest wait for a safe point in the buffer
+static uint32_t key_latency_max_us = 0;   // Longest time from a key change to the new buffer
+static uint32_t key_latency_hist[latency_buckets];
+// Dead air, the time the key was down while the buffers were being recalculated
+static volatile bool dead_air = false;
+static uint32_t dead_air_start_us;
+static uint64_t dead_air_us = 0;
+
+// Keying engine. The key is scheduled as a queue of segments, each with a key state and a length 
+// in ticks. A tick is a buffer period, and the segments are consumed at buffer boundaries, from the 
+// interrupt of the link DMA that runs right after a new buffer has been started. So the keying is 
+// exact to one buffer regardless of what loop() is doing. In mode 0 there are no buffers, and a 
+// tick is 1 us of a hardware alarm that is always rescheduled from its previous deadline.
+typedef struct {
+  bool on;
+  uint32_t ticks;
+} key_segment_t;
+
+static const uint32_t key_queue_len = 32;        // Must be a power of two
+static key_segment_t key_queue[key_queue_len];
+static volatile uint32_t key_pushed = 0;         // Number of segments queued so far
+static volatile uint32_t key_popped = 0;         // Number of segments started so far
+static volatile uint32_t key_remaining = 0;      // Buffers left of the current segment
+static uint32_t key_underruns = 0;               // Times the queue ran empty
+// The buffers that started since the last interrupt, see key_ticks(). The times are in us, 
+// q16 and q32 mean shifted left by 16 and 32 bits.
+static uint32_t key_tick_us;                     // When the last counted buffer started
+static uint32_t key_tick_period_q16;             // Average buffer period
+static uint32_t key_tick_rate_q32;               // Buffers per us
+static uint32_t key_tick_hold_us;                // Longer than this between interrupts is a hold-up
+static bool key_tick_ahead = false;              // The last counted buffer may not have started
+static uint32_t key_holdups = 0;                 // Interrupts that counted more than one buffer
+static uint32_t key_late_changes = 0;            // Key segments that started late, in a hold-up
+static key_timeline_t key_timeline = {1.0, 0, 0, 0}; // End of the queued segments
+static alarm_id_t key_alarm;                     // Alarm used instead of the DMA in mode 0
+static bool key_timer_active = false;
+static const int64_t key_idle_poll_us = 1000;    // Alarm interval when there is nothing to key
+static PIO key_pio;                              // The state machine, for the keying
+static uint key_sm, key_first_pin;
+
+// Parking in long silences. When the ramp-down is done and the key stays up for at least 
+// park_min_ticks more buffers, the state machine is stopped with the pins low. The TX FIFO 
+// fills up with silence and the DMA chain waits for it, so there are no bus transfers and no 
+// interrupt per buffer. An alarm restarts the state machine one buffer before the key goes 
+// down, and the silent buffer that was started when parking is then played to its end, so 
+// the keying goes on from the same buffer boundary as if it had not stopped.
+// The alarm is a hardware alarm of its own, armed and handled from RAM by writing the timer 
+// registers, as the SDK alarm pool runs from flash. For the same reason the buffer timing is 
+// set up with the buffers in integers, so the interrupt needs no floating point library.
+static const uint32_t park_min_ticks = 4;
+static bool park_enabled = true;
+static volatile bool key_parked = false;
+static volatile bool flash_writing = false;      // No parking, see flash_write_begin()
+static int park_timer_alarm = -1;                // Hardware alarm that ends the parking
+static uint32_t park_start_us;
+static uint32_t park_remaining;                  // key_remaining when parking
+static uint32_t park_period_q16;                 // Length of the silent buffer, us << 16
+static uint32_t park_rate_q32;                   // Silent buffers per us << 32
+static uint32_t park_count = 0;
+static uint64_t parked_us = 0;
+static uint32_t stream_buffers = 0;              // Buffers started by the DMA chain
+
+// Don't redirect the restart DMA when the synth DMA has fewer words than this left to transfer,
+// the link DMAs could then overwrite the new read address. 64 words take 5 us.
+static const uint32_t chain_guard_words = 64;
+static uint32_t word_us_q16;                     // Time of a buffer word, 16 clock cycles, us << 16
+
+// States of apply_settings(), see poll_settings()
+static const int calc_idle = 0;     // Nothing to do
+static const int calc_silence = 1;  // Waiting for the chain to ramp down to the silent buffer
+static const int calc_fill = 2;     // Filling the buffers
+// Work per call of poll_settings(). The time is checked every calc_chunk_words words.
+static const uint32_t calc_slice_us = 1000;
+static const int calc_slice_words = 256;
+static const int calc_chunk_words = 16;
+
+// System clocks that plan_clock() chooses from. The PLL makes 12 MHz * fbdiv / (pd1 * pd2) with 
+// the VCO at 750 to 1600 MHz. The range is kept where the flash and the core voltage are known 
+// to cope, and above clock_vreg_hz the core voltage is raised first.
+static const double xosc_hz = 12e6;
+static const double vco_min_hz = 750e6;
+static const double vco_max_hz = 1600e6;
+static const double clock_min_hz = 150e6;
+static const double clock_max_hz = 250e6;
+static const double clock_vreg_hz = 200e6;
 
 
 void synth::fill_synth_buffer_silent()
 {
-  synth_buffer_ptr[0] = synth_buffer;
-  synth_buffer_ramp_up_ptr[0] = synth_buffer_ramp_up;
-  synth_buffer_ramp_down_ptr[0] = synth_buffer_ramp_down;
-  synth_buffer_silent_ptr[0] = synth_buffer_silent;
   for(int ii=0; ii < max_words; ii++) {
     synth_buffer_silent[ii] = 0;
   }
@@ -49,11 +177,13 @@ double taper(int n, int n_max, bool falling)
 }
 
 
-// Use sigma-delta modulation to do 1-bit quantization of a sinusoid into the synth buffer
-// based on the parameters already stored in the object.
-// Also fill the ramp-up and ramp-down buffers.
-void synth::fill_synth_buffer_sigma_delta()
+// Use sigma-delta modulation to do 1-bit quantization of a sinusoid into the buffers of job, 
+// from word job->next up to end, based on the other parameters already stored in the object.
+// Also fill the ramp-up and ramp-down buffers unless they are NULL.
+void synth::fill_synth_buffer_sigma_delta(fill_job_t *job, int end)
 {
+  uint32_t *buf = job->buf, *buf_up = job->buf_up, *buf_down = job->buf_down;
+  int periods = job->periods, words = job->words;
   double phase, phase_increment;
   double sample, sample_up, sample_down;
   double acc, acc_up, acc_down;
@@ -63,22 +193,21 @@ void synth::fill_synth_buffer_sigma_delta()
   double epsilon = 1e-5; // To get a little bit away from the zero crossings
   uint32_t word, word_up, word_down;
 
-  fill_synth_buffer_silent();
-  phase_increment = 2 * M_PI * n_periods / ((double)n_words * 16.0);
+  phase_increment = 2 * M_PI * periods / ((double)words * 16.0);
   phase = 0;
   acc = 0;
   out = 0;
-  delta_dly = 0;
+  delta_dly = job->delta_dly[0];
   acc_up = 0;
   out_up = 0;
-  delta_dly_up = 0;
+  delta_dly_up = job->delta_dly[1];
   acc_down = 0;
   out_down = 0;
-  delta_dly_down = 0;
+  delta_dly_down = job->delta_dly[2];
   dither = 0;
 
   // Iterate over 32-bit words in the buffer
-  for(int ii=0; ii < n_words; ii++) {
+  for(int ii=job->next; ii < end; ii++) {
     word = 0;
     word_up = 0;
     word_down = 0;
@@ -87,8 +216,8 @@ void synth::fill_synth_buffer_sigma_delta()
     for(int jj=0; jj < 16; jj++) {
       phase = (ii*16 + jj)*phase_increment + epsilon;
       sample = amplitude * sin(phase) + hd3_amplitude*sin(3*phase + hd3_phase_rad);
-      sample_up = sample * taper(ii*16 + jj, n_words*16, false);
-      sample_down = sample * taper(ii*16 + jj, n_words*16, true);
+      sample_up = sample * taper(ii*16 + jj, words*16, false);
+      sample_down = sample * taper(ii*16 + jj, words*16, true);
       acc = sample + delta_dly;
       acc_up = sample_up + delta_dly_up;
       acc_down = sample_down + delta_dly_down;
@@ -122,24 +251,32 @@ void synth::fill_synth_buffer_sigma_delta()
       delta_dly_down = acc_down - out_down;
     }
     if(ii < max_words) {
-      synth_buffer[ii] = word;
-      if(mode >= 4) {
-        synth_buffer_ramp_up[ii] = word_up;
-        synth_buffer_ramp_down[ii] = word_down;
-      } else {
-        synth_buffer_ramp_up[ii] = word;
-        synth_buffer_ramp_down[ii] = 0;
+      buf[ii] = word;
+      if(buf_up && buf_down) {
+        if(mode >= 4) {
+          buf_up[ii] = word_up;
+          buf_down[ii] = word_down;
+        } else {
+          buf_up[ii] = word;
+          buf_down[ii] = 0;
+        }
       }
     }
   }
+  job->delta_dly[0] = delta_dly;
+  job->delta_dly[1] = delta_dly_up;
+  job->delta_dly[2] = delta_dly_down;
+  job->next = end;
 }
 
 
-// Use sigma-delta modulation to do 1.5-bit quantization (3 levels) of a sinusoid into the synth buffer.
-// based on the parameters already stored in the object.
-// Also fill the ramp-up and ramp-down buffers.
-void synth::fill_synth_buffer_sigma_delta_3s()
+// Use sigma-delta modulation to do 1.5-bit quantization (3 levels) of a sinusoid into the buffers 
+// of job, from word job->next up to end, based on the other parameters already stored in the object.
+// Also fill the ramp-up and ramp-down buffers unless they are NULL.
+void synth::fill_synth_buffer_sigma_delta_3s(fill_job_t *job, int end)
 {
+  uint32_t *buf = job->buf, *buf_up = job->buf_up, *buf_down = job->buf_down;
+  int periods = job->periods, words = job->words;
   double phase, phase_increment, dither;
   double sample, sample_up, sample_down;
   double acc, acc_up, acc_down;
@@ -149,24 +286,23 @@ void synth::fill_synth_buffer_sigma_delta_3s()
   uint32_t word, word_up, word_down;
   int last_equal, last_equal_up, last_equal_down; // Switch between keeping both high and both low when they shall be equal
 
-  fill_synth_buffer_silent();
-  phase_increment = 2 * M_PI * n_periods / ((double)n_words * 16.0);
+  phase_increment = 2 * M_PI * periods / ((double)words * 16.0);
   phase = 0;
   acc = 0;
   out = 0;
-  delta_dly = 0;
+  delta_dly = job->delta_dly[0];
   acc_up = 0;
   out_up = 0;
-  delta_dly_up = 0;
+  delta_dly_up = job->delta_dly[1];
   acc_down = 0;
   out_down = 0;
-  delta_dly_down = 0;
+  delta_dly_down = job->delta_dly[2];
   dither = 0;
-  last_equal = 1;
-  last_equal_up = 1;
-  last_equal_down = 1;
+  last_equal = job->last_equal[0];
+  last_equal_up = job->last_equal[1];
+  last_equal_down = job->last_equal[2];
   // Iterate over 32-bit words in the buffer
-  for(int ii=0; ii < n_words; ii++) {
+  for(int ii=job->next; ii < end; ii++) {
     word = 0;
     word_up = 0;
     word_down = 0;
@@ -175,8 +311,8 @@ void synth::fill_synth_buffer_sigma_delta_3s()
     for(int jj=0; jj < 16; jj++) {
       phase = (ii*16 + jj)*phase_increment + epsilon;
       sample = amplitude * sin(phase) + hd3_amplitude*sin(3*phase + hd3_phase_rad);
-      sample_up = sample * taper(ii*16 + jj, n_words*16, false);
-      sample_down = sample * taper(ii*16 + jj, n_words*16, true);
+      sample_up = sample * taper(ii*16 + jj, words*16, false);
+      sample_down = sample * taper(ii*16 + jj, words*16, true);
       acc = sample + delta_dly;
       acc_up = sample_up + delta_dly_up;
       acc_down = sample_down + delta_dly_down;
@@ -236,30 +372,40 @@ void synth::fill_synth_buffer_sigma_delta_3s()
       delta_dly_down = acc_down - out_down;
     }
     if(ii < max_words) {
-      synth_buffer[ii] = word;
-      if(mode >= 4) {
-        synth_buffer_ramp_up[ii] = word_up;
-        synth_buffer_ramp_down[ii] = word_down;
-      } else {
-        synth_buffer_ramp_up[ii] = word;
-        synth_buffer_ramp_down[ii] = 0;
+      buf[ii] = word;
+      if(buf_up && buf_down) {
+        if(mode >= 4) {
+          buf_up[ii] = word_up;
+          buf_down[ii] = word_down;
+        } else {
+          buf_up[ii] = word;
+          buf_down[ii] = 0;
+        }
       }
     }
   }
+  job->delta_dly[0] = delta_dly;
+  job->delta_dly[1] = delta_dly_up;
+  job->delta_dly[2] = delta_dly_down;
+  job->last_equal[0] = last_equal;
+  job->last_equal[1] = last_equal_up;
+  job->last_equal[2] = last_equal_down;
+  job->next = end;
 }
 
 
-// Do 1-bit quantization of a sinusoid into the synth buffer based on the parameters already stored in the object.
-void synth::fill_synth_buffer_compare()
+// Do 1-bit quantization of a sinusoid into the buffers of job, from word job->next up to end, based 
+// on the other parameters already stored in the object. Also fill the ramp buffers unless they are NULL.
+void synth::fill_synth_buffer_compare(fill_job_t *job, int end)
 {
+  uint32_t *buf = job->buf, *buf_up = job->buf_up, *buf_down = job->buf_down;
   double phase = 0, phase_increment, sample, dither;
   uint32_t word;
   double epsilon = 1e-5; // To get a little bit away from the zero crossings
 
-  fill_synth_buffer_silent();
-  phase_increment = 2 * M_PI * n_periods / ((double)n_words * 16.0);
+  phase_increment = 2 * M_PI * job->periods / ((double)job->words * 16.0);
   // Iterate over 32-bit words in the buffer
-  for(int ii=0; ii < n_words; ii++) {
+  for(int ii=job->next; ii < end; ii++) {
     word = 0;
     // Iterate over pairs of bits in the word.
     // Each bit is written first normally and then inverted in the neighboring bit to form a differential signal
@@ -275,11 +421,14 @@ void synth::fill_synth_buffer_compare()
       } 
     }
     if(ii < max_words) {
-      synth_buffer[ii] = word;
-      synth_buffer_ramp_up[ii] = word;
-      synth_buffer_ramp_down[ii] = 0;
+      buf[ii] = word;
+      if(buf_up && buf_down) {
+        buf_up[ii] = word;
+        buf_down[ii] = 0;
+      }
     }
   }
+  job->next = end;
 }
 
 
@@ -293,45 +442,434 @@ void synth::fill_synth_buffer_compare()
 // https://github.com/raspberrypi/pico-examples/blob/master/dma/channel_irq/channel_irq.c
 
 
-void dma_irq_handler()
+// Make the restart DMA continue with the list starting at next after the current buffer.
+// The link DMAs write the read address of the restart DMA right after a new buffer has been 
+// started, so wait until that is done and there is plenty of time left in the buffer.
+// This runs from RAM so that keying is not held up by flash accesses.
+static void __not_in_flash_func(retarget_chain)(const dma_block_t *next)
+{
+  if(synth_dma >= 1000) {
+    return;
+  }
+  uint32_t t_start = time_us_32();
+  while(true) {
+    uint32_t irq_state = save_and_disable_interrupts();
+    // The synth DMA is also idle for a moment between buffers, while the restart DMA reads 
+    // the next block, so the control DMAs must be idle in both cases.
+    if(!dma_channel_is_busy(restart_dma) && 
+       !dma_channel_is_busy(link_read_dma) && 
+       !dma_channel_is_busy(link_write_dma) && 
+       (!dma_channel_is_busy(synth_dma) || 
+        dma_hw->ch[synth_dma].transfer_count > chain_guard_words)) {
+      dma_hw->ch[restart_dma].read_addr = (uintptr_t)next;
+      uint32_t words_left = dma_hw->ch[synth_dma].transfer_count;
+      restore_interrupts(irq_state);
+
+      // The new list starts when the current buffer is done
+      uint32_t wait_us = time_us_32() - t_start;
+      uint32_t latency_us = wait_us + ((words_left * word_us_q16) >> 16);
+      int bucket = 0;
+      while(bucket < latency_buckets - 1 && (latency_us >> bucket) != 0) {
+        bucket++;
+      }
+      key_latency_hist[bucket]++;
+      retarget_count++;
+      if(wait_us > retarget_wait_max_us) {
+        retarget_wait_max_us = wait_us;
+      }
+      if(latency_us > key_latency_max_us) {
+        key_latency_max_us = latency_us;
+      }
+      return;
+    }
+    restore_interrupts(irq_state);
+  }
+}
+
+
+// Change the key state at the next buffer boundary. Called right after a new buffer was started, 
+// when the link DMAs are done, so the read address of the restart DMA can be written directly.
+static void __not_in_flash_func(key_apply)(bool on)
+{
+  if(on == enable_transmit) {
+    return;
+  }
+  if(key_timer_active) {
+    pio_sm_set_consecutive_pindirs(key_pio, key_sm, key_first_pin, 2, on);
+  } else if(buffers_ready) {
+    dma_hw->ch[restart_dma].read_addr = (uintptr_t)(on ? &block_ramp_up : &block_ramp_down);
+  } else if(on) {
+    dead_air_start_us = time_us_32();
+    dead_air = true;
+  } else if(dead_air) {
+    dead_air_us += time_us_32() - dead_air_start_us;
+    dead_air = false;
+  }
+  gpio_put(debug_pin, on);
+  enable_transmit = on;
+}
+
+
+// The number of buffers started since the last interrupt. That is one, unless the interrupts 
+// were disabled for longer than a buffer, e.g. while writing the flash, and the interrupts of 
+// several buffers merged into one. Then it is worked out from the time, rounded to the nearest, 
+// so the last buffer counted may start a little later. The next interrupt then counts none.
+// The dual modulus buffers are up to twice as long as the average, see key_tick_setup().
+static uint32_t __not_in_flash_func(key_ticks)()
+{
+  uint32_t now = time_us_32();
+  int32_t us = now - key_tick_us;
+
+  if(key_tick_ahead || us > (int32_t)key_tick_hold_us) {
+    uint32_t ticks = us <= 0 ? 0 : ((uint64_t)us * key_tick_rate_q32 + (1u << 31)) >> 32;
+    key_tick_ahead = ticks > 1;
+    if(key_tick_ahead) {
+      key_tick_us += ((uint64_t)ticks * key_tick_period_q16) >> 16;
+      key_holdups++;
+      return ticks;
+    }
+    key_tick_us = now;
+    return ticks;
+  }
+  key_tick_us = now;
+  return 1;
+}
+
+
+// Advance the key schedule by 'ticks' buffers. The segments that ended on the way are skipped.
+// When the schedule is not running, the next segment starts now.
+static void __not_in_flash_func(key_tick)(uint32_t ticks)
+{
+  bool running = key_remaining > 0;
+
+  if(running) {
+    uint32_t n = min(ticks, (uint32_t)key_remaining);
+    key_remaining -= n;
+    ticks -= n;
+  } else {
+    ticks = 0;
+  }
+  while(key_remaining == 0) {
+    if(key_popped == key_pushed) {
+      if(running) {
+        // The schedule ended without a new segment in time
+        key_underruns++;
+      }
+      return;
+    }
+    key_segment_t *seg = &key_queue[key_popped & (key_queue_len - 1)];
+    key_popped++;
+    if(ticks > 0) {
+      key_late_changes++;
+      if(seg->ticks <= ticks) {
+        ticks -= seg->ticks;
+        continue;
+      }
+    }
+    key_apply(seg->on);
+    key_remaining = seg->ticks - ticks;
+    ticks = 0;
+  }
+}
+
+
+// Restart the state machine. The buffer periods spent parked are taken off the key segment.
+// Call with the interrupts disabled.
+static void __not_in_flash_func(key_unpark)()
+{
+  if(!key_parked) {
+    return;
+  }
+  uint32_t us = time_us_32() - park_start_us;
+  uint32_t ticks = ((uint64_t)us * park_rate_q32 + (1u << 31)) >> 32; // Rounded
+  key_remaining = ticks < park_remaining ? park_remaining - ticks : 1;
+  // The silent buffer started when parking goes on from here
+  key_tick_us = time_us_32();
+  key_tick_ahead = false;
+  pio_sm_set_enabled(key_pio, key_sm, true);
+  key_parked = false;
+  parked_us += us;
+}
+
+
+static void __not_in_flash_func(park_timer_irq_handler)()
+{
+  timer_hw->intr = 1u << park_timer_alarm; // Acknowledge interrupt
+  key_unpark();
+}
+
+
+// Park if the silent buffer has just been started and the key stays up long enough
+static void __not_in_flash_func(key_park)()
+{
+  uintptr_t addr = dma_hw->ch[synth_dma].read_addr;
+  if(!park_enabled || park_timer_alarm < 0 || key_parked || flash_writing || enable_transmit || 
+     !buffers_ready || key_resync || key_remaining < park_min_ticks || 
+     addr < (uintptr_t)synth_buffer_silent || addr > (uintptr_t)(synth_buffer_silent + max_words)) {
+    return;
+  }
+  park_remaining = key_remaining;
+  park_start_us = time_us_32();
+  pio_sm_set_enabled(key_pio, key_sm, false);
+  key_parked = true;
+  // Writing the target arms the alarm. It is at least park_min_ticks - 1 buffers ahead, so it 
+  // can't be missed.
+  timer_hw->alarm[park_timer_alarm] = park_start_us + 
+    (uint32_t)(((uint64_t)(key_remaining - 1) * park_period_q16) >> 16);
+  park_count++;
+}
+
+
+// Stop parking now, e.g. when the key is forced down or the buffers change
+static void key_wake()
 {
-  static int dma_state = 0;
-  // 0 - silent
-  // 1 - transmitting
-  /*
-  digitalWrite(26, HIGH);
-  digitalWrite(26, LOW);
-  digitalWrite(26, HIGH);
-*/
-  if(dma_channel_get_irq0_status(restart_dma)) {
-    dma_hw->ints0 = 1u << restart_dma; // Acknowledge interrupt
-    if(!dma_channel_is_busy(restart_dma)) {
+  uint32_t irq_state = save_and_disable_interrupts();
+  if(key_parked) {
+    timer_hw->armed = 1u << park_timer_alarm; // Disarm
+    key_unpark();
+  }
+  restore_interrupts(irq_state);
+}
+
+
+static void __not_in_flash_func(key_dma_irq_handler)()
+{
+  if(dma_channel_get_irq0_status(link_write_dma)) {
+    dma_hw->ints0 = 1u << link_write_dma; // Acknowledge interrupt
+    if(key_resync) {
+      // New buffers after apply_settings(), the chain is in the silent buffer
+      key_resync = false;
       if(enable_transmit) {
-        if(dma_state == 1) {
-          dma_channel_set_read_addr(restart_dma, synth_buffer_ptr, false);
-        } else if(dma_state == 0){
-          dma_channel_set_read_addr(restart_dma, synth_buffer_ramp_up_ptr, false);
-          digitalWrite(26, HIGH);
-          dma_state = 1;
-        }
-      } else {
-        if(dma_state == 0) {
-          dma_channel_set_read_addr(restart_dma, synth_buffer_silent_ptr, false);
-        } else if(dma_state == 1){
-          dma_channel_set_read_addr(restart_dma, synth_buffer_ramp_down_ptr, false);
-          digitalWrite(26, LOW);
-          dma_state = 0;
-        }
+        dma_hw->ch[restart_dma].read_addr = (uintptr_t)&block_ramp_up;
+      }
+      if(dead_air) {
+        dead_air_us += time_us_32() - dead_air_start_us;
+        dead_air = false;
       }
+      key_tick_us = time_us_32();
+      key_tick_ahead = false;
+      key_tick(1);
+    } else {
+      key_tick(key_ticks());
+    }
+    key_park();
+    stream_buffers++;
+  }
+}
+
+
+// Mode 0 keying. Start the next segment and fire again when it ends. A negative return value 
+// reschedules the alarm relative to when it was due, not to when it ran, so there is no drift.
+static int64_t __not_in_flash_func(key_alarm_callback)(alarm_id_t id, void *user_data)
+{
+  bool running = key_remaining > 0;
+
+  key_remaining = 0;
+  while(key_popped != key_pushed) {
+    key_segment_t *seg = &key_queue[key_popped & (key_queue_len - 1)];
+    key_popped++;
+    if(seg->ticks > 0) {
+      key_apply(seg->on);
+      key_remaining = 1;
+      return -(int64_t)seg->ticks;
+    }
+  }
+  if(running) {
+    key_underruns++;
+  }
+  return key_idle_poll_us;
+}
+
+
+// Set up key_ticks() for ticks of tick_us, the average buffer period. Call with the interrupts 
+// disabled.
+static void key_tick_setup(double tick_us)
+{
+  key_tick_period_q16 = llround(tick_us * 65536);
+  key_tick_rate_q32 = llround(4294967296.0 / tick_us);
+  // The longest dual modulus buffer, plus half an average one for the interrupt latency
+  key_tick_hold_us = (uint32_t)(2.5 * tick_us);
+  key_tick_us = time_us_32();
+  key_tick_ahead = false;
+}
+
+
+// Forget the queued key segments and restart the timeline with ticks of tick_us
+static void key_reset(double tick_us)
+{
+  key_wake();
+  uint32_t irq_state = save_and_disable_interrupts();
+  key_popped = key_pushed;
+  key_remaining = 0;
+  key_tick_setup(tick_us);
+  restore_interrupts(irq_state);
+  key_timeline_reset(&key_timeline, tick_us);
+}
+
+
+// Convert what is left of the key segments to ticks of tick_us, when the buffers change under a 
+// running key schedule. The segments are then at most half a tick off.
+static void key_rescale(double tick_us)
+{
+  double r = key_timeline.tick_us/tick_us;
+  uint32_t irq_state = save_and_disable_interrupts();
+  if(key_remaining > 0) {
+    key_remaining = max((uint32_t)(key_remaining*r + 0.5), 1u);
+  }
+  for(uint32_t ii = key_popped; ii != key_pushed; ii++) {
+    key_segment_t *seg = &key_queue[ii & (key_queue_len - 1)];
+    seg->ticks = (uint32_t)(seg->ticks*r + 0.5);
+  }
+  key_tick_setup(tick_us);
+  restore_interrupts(irq_state);
+  key_timeline_reset(&key_timeline, tick_us);
+}
+
+
+// Queue a key segment of 'us' microseconds with the key down (on = true) or up.
+// The segment is rounded to whole ticks, but the rounding does not accumulate over
+// consecutive segments. Returns an id to use with key_started(), or 0 if the queue is full.
+uint32_t synth::key_queue_segment(bool on, double us)
+{
+  if(key_space() == 0) {
+    return 0;
+  }
+  if(key_popped == key_pushed && key_remaining == 0) {
+    // The queue has run empty, start a new timeline
+    key_timeline.ideal_us = 0;
+    key_timeline.ticks = 0;
+  }
+  key_segment_t *seg = &key_queue[key_pushed & (key_queue_len - 1)];
+  seg->on = on;
+  seg->ticks = key_timeline_advance(&key_timeline, us);
+  key_pushed++; // Publish the segment to the interrupt
+  return key_pushed;
+}
+
+
+// Number of segments queued but not yet started
+uint32_t synth::key_queued()
+{
+  return key_pushed - key_popped;
+}
+
+
+// Number of segments that can be queued
+uint32_t synth::key_space()
+{
+  return key_queue_len - (key_pushed - key_popped);
+}
+
+
+// True if the segment with the given id has started
+bool synth::key_started(uint32_t id)
+{
+  return (int32_t)(key_popped - id) >= 0;
+}
+
+
+// Drop the queued key segments, so that they do not key the output while it is forced on.
+// Cheap when there is nothing queued.
+void synth::key_flush()
+{
+  if(key_popped != key_pushed || key_remaining > 0) {
+    key_reset(key_timeline.tick_us);
+  }
+}
+
+
+// How long the key stays up, in us, according to the key segments that are queued. 0 if it is 
+// down. The queue only reaches a few segments ahead, so the key can stay up for longer.
+double synth::key_up_us()
+{
+  double us;
+  uint32_t irq_state = save_and_disable_interrupts();
+  uint32_t remaining = key_remaining;
+
+  if(enable_transmit) {
+    restore_interrupts(irq_state);
+    return 0;
+  }
+  if(key_parked) {
+    uint32_t ticks = ((uint64_t)(time_us_32() - park_start_us) * park_rate_q32) >> 32;
+    remaining = ticks < park_remaining ? park_remaining - ticks : 1;
+  }
+  us = remaining * key_timeline.tick_us;
+  for(uint32_t ii = key_popped; ii != key_pushed; ii++) {
+    key_segment_t *seg = &key_queue[ii & (key_queue_len - 1)];
+    if(seg->on) {
+      break;
     }
+    us += seg->ticks * key_timeline.tick_us;
+  }
+  restore_interrupts(irq_state);
+  return us;
+}
+
+
+// Total dead air in us, see key_apply()
+uint64_t synth::get_dead_air_us()
+{
+  uint32_t irq_state = save_and_disable_interrupts();
+  uint64_t us = dead_air_us + (dead_air ? time_us_32() - dead_air_start_us : 0);
+  restore_interrupts(irq_state);
+  return us;
+}
+
+
+// Stop the state machine in long silences, see key_park()
+void synth::set_parking(bool p)
+{
+  park_enabled = p;
+  if(!p) {
+    key_wake();
+  }
+}
+
+
+bool synth::get_parking()
+{
+  return park_enabled;
+}
+
+
+// Set the calibration, the error of the system clock (i.e. the crystal) in ppm. If the rational 
+// approximation, or the divider in mode 0, comes out the same at the corrected clock, only the 
+// reported frequency changes. Otherwise the next apply_settings() recalculates the buffers.
+void synth::set_ppm(double p)
+{
+  double old_clk = get_clock();
+
+  if(p == ppm) {
+    return;
+  }
+  ppm = p;
+  if(needs_recalculation || calc_state != calc_idle || dual_seq_len > 0 || clock_plan < 0) {
+    needs_recalculation = true;
+    return;
+  }
+  if(mode == 0) {
+    needs_recalculation = round(256.0*get_clock()/(2.0*frequency)) != round(256.0*old_clk/(2.0*frequency));
+  } else {
+    rational_t r = plan_ratio(get_clock());
+    needs_recalculation = (uint64_t)r.numerator * n_words != (uint64_t)n_periods * r.denominator;
+  }
+  if(!needs_recalculation) {
+    LOG_INFO("Calibration %.3f ppm applied, the buffers stay the same", ppm);
   }
 }
 
 
+// The key state is only recorded while apply_settings() calculates new buffers
 void synth::disable_output()
 {
-  if(enable_transmit && mode == 0) {
+  if(enable_transmit && key_timer_active) {
     pio_sm_set_consecutive_pindirs(pio, sm, m_first_rf_pin, 2, false);
+  } else if(enable_transmit) {
+    if(buffers_ready) {
+      retarget_chain(&block_ramp_down);
+    }
+    gpio_put(debug_pin, false);
   }
   enable_transmit = false;
 }
@@ -339,20 +877,143 @@ void synth::disable_output()
 
 void synth::enable_output()
 {
-  if(!enable_transmit && mode == 0) {
+  key_wake();
+  if(!enable_transmit && key_timer_active) {
     pio_sm_set_consecutive_pindirs(pio, sm, m_first_rf_pin, 2, true);
+  } else if(!enable_transmit) {
+    if(buffers_ready) {
+      retarget_chain(&block_ramp_up);
+    }
+    gpio_put(debug_pin, true);
   }
   enable_transmit = true;
 }
 
 
-double synth::get_frequency_exact()
+// Writing the flash stalls all code running from it, and the core keeps the interrupts disabled 
+// meanwhile. The DMA chain and the buffers are in RAM, so the RF output keeps going without the 
+// CPU, but keying has to wait until the write is done. This is the one place that deals with it:
+// - The alarm that ends parking could not run during the write, and the key-down after it 
+//   would be late, so the state machine is restarted first and does not park until the end.
+// - The key interrupt counts the buffers played meanwhile from the time, see key_ticks(), so a 
+//   key change due during the write is late, but the ones after it are on time.
+// - flash_write_end() logs if the RF output stalled, or if the write overlapped a key-down.
+// Call this before a flash write and flash_write_end() after it.
+void synth::flash_write_begin()
 {
+  flash_writing = true;
+  key_wake();
   if(mode != 0) {
-    return CPU_freq_actual * (double) n_periods / (16 * (double) n_words);
+    pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm); // Write 1 to clear
+  }
+  uint32_t irq_state = save_and_disable_interrupts();
+  flash_late_changes = key_late_changes;
+  flash_key_down = enable_transmit;
+  restore_interrupts(irq_state);
+}
+
+
+void synth::flash_write_end()
+{
+  flash_writing = false;
+  if(mode != 0 && (pio->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + sm)))) {
+    flash_tx_stalls++;
+    LOG_WARN("RF output stalled during the flash write (%lu times so far)", (unsigned long)flash_tx_stalls);
+  }
+  uint32_t irq_state = save_and_disable_interrupts();
+  uint32_t late = key_late_changes - flash_late_changes;
+  bool down = flash_key_down || enable_transmit;
+  restore_interrupts(irq_state);
+  if(late > 0) {
+    LOG_WARN("The flash write held up the keying, %lu key changes were late", (unsigned long)late);
+  } else if(down) {
+    LOG_WARN("The flash write overlapped a key-down");
+  }
+}
+
+
+// Check if the PIO TX FIFO has run empty since the last call. Cheap enough to call from every 
+// iteration of loop(). 
+void synth::poll_stats()
+{
+  uint32_t mask = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+  
+  if(mode == 0 || synth_dma >= 1000) {
+    return;
+  }
+  stat_polls++;
+  if(pio->fdebug & mask) {
+    pio->fdebug = mask; // Write 1 to clear
+    tx_stall_polls++;
+  }
+}
+
+
+void synth::clear_stats()
+{
+  pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm);
+  tx_stall_polls = 0;
+  stat_polls = 0;
+  retarget_count = 0;
+  retarget_wait_max_us = 0;
+  key_latency_max_us = 0;
+  key_timeline.error_max_us = 0;
+  key_underruns = 0;
+  key_holdups = 0;
+  key_late_changes = 0;
+  flash_tx_stalls = 0;
+  park_count = 0;
+  parked_us = 0;
+  stream_buffers = 0;
+  dead_air_us = 0;
+  for(int ii = 0; ii < latency_buckets; ii++) {
+    key_latency_hist[ii] = 0;
+  }
+}
+
+
+void synth::print_stats()
+{
+  Serial.printf("TX FIFO stalls: %lu of %lu polls (%lu during flash writes)\n", 
+                (unsigned long)tx_stall_polls, (unsigned long)stat_polls, (unsigned long)flash_tx_stalls);
+  Serial.printf("Key changes: %lu\n", (unsigned long)retarget_count);
+  Serial.printf("Max wait for a safe DMA retarget: %lu us\n", (unsigned long)retarget_wait_max_us);
+  Serial.printf("Max key change to new buffer: %lu us\n", (unsigned long)key_latency_max_us);
+  Serial.printf("Key schedule: %.2f us per tick, max timing error %.2f us, %lu underruns\n", 
+                key_timeline.tick_us, key_timeline.error_max_us, (unsigned long)key_underruns);
+  Serial.printf("Key interrupt held up %lu times, %lu key changes late\n", (unsigned long)key_holdups, 
+                (unsigned long)key_late_changes);
+  Serial.printf("Buffers streamed: %lu, parked in silences %lu times for %.3f s\n", (unsigned long)stream_buffers, 
+                (unsigned long)park_count, parked_us*1e-6);
+  Serial.printf("Dead air while recalculating: %.1f ms\n", get_dead_air_us()*1e-3);
+  Serial.println("Key latency histogram:");
+  for(int ii = 0; ii < latency_buckets; ii++) {
+    if(key_latency_hist[ii] != 0) {
+      Serial.printf("  < %6lu us: %lu\n", (unsigned long)(1ul << ii), (unsigned long)key_latency_hist[ii]);
+    }
+  }
+}
+
+
+// Average duration of one buffer in seconds
+double synth::get_buffer_period()
+{
+  if(dual_seq_len > 0) {
+    return 16.0 * dual_words / (dual_seq_len * get_clock());
+  }
+  return 16.0 * n_words / get_clock();
+}
+
+
+double synth::get_frequency_exact()
+{
+  if(mode != 0 && dual_seq_len > 0) {
+    return get_clock() * (double) dual_periods / (16 * (double) dual_words);
+  } else if(mode != 0) {
+    return get_clock() * (double) n_periods / (16 * (double) n_words);
   } else {
-    float clkdiv = round(256.0*CPU_freq_actual/(2.0*frequency))/256.0;
-    return CPU_freq_actual/(2*clkdiv);
+    float clkdiv = round(256.0*get_clock()/(2.0*frequency))/256.0;
+    return get_clock()/(2*clkdiv);
   }
 }
 
@@ -363,7 +1024,7 @@ void synth::set_mode(int m)
     mode = m;
     needs_recalculation = true;
   } else {
-    Serial.println("Attempted to set invalid mode");
+    LOG_ERROR("Attempted to set invalid mode %d", m);
   }
 }
 
@@ -389,83 +1050,683 @@ const char *synth::get_mode_str()
 }
 
 
-// (Re)calculate the buffers
-void synth::calculate_buffers()
+// Set up a job to fill buf (and the ramp buffers unless they are NULL) with 'periods' periods 
+// in 'words' words
+static void fill_job_init(fill_job_t *job, uint32_t *buf, uint32_t *buf_up, uint32_t *buf_down, int periods, int words)
+{
+  job->buf = buf;
+  job->buf_up = buf_up;
+  job->buf_down = buf_down;
+  job->periods = periods;
+  job->words = words;
+  job->next = 0;
+  for(int ii = 0; ii < 3; ii++) {
+    job->delta_dly[ii] = 0;
+    job->last_equal[ii] = 1;
+  }
+}
+
+
+// Fill the buffers of job up to word end according to the mode.
+void synth::fill_buffers(fill_job_t *job, int end)
+{
+  if(mode == 1) {
+    fill_synth_buffer_compare(job, end);
+  } else if(mode == 2 or mode == 4) {
+    fill_synth_buffer_sigma_delta(job, end);
+  } else {
+    fill_synth_buffer_sigma_delta_3s(job, end);
+  }
+}
+
+
+// Do a slice of the planned buffer fills, about calc_slice_us long. Returns true when all are done.
+bool synth::fill_slice()
+{
+  uint32_t t_start = time_us_32();
+  int words = 0;
+
+  for(int jj = 0; jj < n_calc_jobs; jj++) {
+    fill_job_t *job = &calc_jobs[jj];
+    while(job->next < job->words) {
+      if(words >= calc_slice_words || time_us_32() - t_start >= calc_slice_us) {
+        return false;
+      }
+      int end = min(job->next + calc_chunk_words, job->words);
+      words += end - job->next;
+      fill_buffers(job, end);
+    }
+  }
+  return true;
+}
+
+
+// Point all DMA control blocks at buffers of 'words' words and link them.
+static void setup_blocks(int words)
+{
+  block_main.count = words;
+  block_main.addr = synth_buffer;
+  block_main.next = &block_main;
+  block_ramp_up.count = words;
+  block_ramp_up.addr = synth_buffer_ramp_up;
+  block_ramp_up.next = &block_main;
+  block_ramp_down.count = words;
+  block_ramp_down.addr = synth_buffer_ramp_down;
+  block_ramp_down.next = &block_silent;
+  block_silent.count = words;
+  block_silent.addr = synth_buffer_silent;
+  block_silent.next = &block_silent;
+
+  // The buffer timing for the keying interrupt and retarget_chain(), in integers, see 
+  // park_timer_irq_handler()
+  double word_us = 16 / (CPU_freq_actual * 1e-6);
+  word_us_q16 = llround(word_us * 65536);
+  park_period_q16 = llround(words * word_us * 65536);
+  park_rate_q32 = llround(4294967296.0 / (words * word_us));
+}
+
+
+// Dual modulus fractional-N sequencing. The target number of periods per word x lies between 
+// two neighbors a/b < x < c/d in the Farey sequence of order K = max_words/2. Buffer A holds 
+// a multiple of a/b and buffer B a multiple of c/d, each at most K words long. Playing the two in 
+// a sequence where a fraction u of the buffers are B buffers gives an average frequency much closer 
+// to the target than a single buffer of max_words words can, at the cost of a small periodic phase 
+// error, i.e. spurs at multiples of the sequence repetition frequency.
+// This plans the sequence and the fill jobs of the two buffers, finish_dual_modulus() links them.
+// Returns false if a single buffer is just as good, or if dual modulus can't be used.
+bool synth::plan_dual_modulus()
+{
+  int64_t K = min(max_words, max_words_limit)/2;
+  int64_t a, b, c, d, m1, m2, p1, w1, p2, w2;
+  rational_t r, u;
+  double x, e1, e2;
+
+  if(word_multiple > 1 || odd_periods) {
+    LOG_WARN("Dual modulus ignored when the buffer alignment is constrained");
+    return false;
+  }
+  x = frequency * 16.0 / get_clock();
+  r = rational_approximation_exact(freq_to_mHz(frequency) * 16, freq_to_mHz(get_clock()), K);
+  if(r.numerator == 0 || r.numerator == r.denominator) {
+    return false;
+  }
+  // Bracket x between r and one of its Farey neighbors
+  farey_neighbors(r.numerator, r.denominator, K, &a, &b, &c, &d);
+  if(x >= r.numerator/(double)r.denominator) {
+    a = r.numerator;
+    b = r.denominator;
+  } else {
+    c = r.numerator;
+    d = r.denominator;
+  }
+  m1 = K/b;
+  m2 = K/d;
+  p1 = m1*a;
+  w1 = m1*b;
+  p2 = m2*c;
+  w2 = m2*d;
+
+  // Phase error in periods accumulated by one A buffer (lagging) and one B buffer (leading).
+  // They cancel on average when a fraction e1/(e1 + e2) of the buffers are B buffers.
+  e1 = x*w1 - p1;
+  e2 = p2 - x*w2;
+  if(e1 <= 0 || e2 <= 0) {
+    return false;
+  }
+  u = rational_approximation(e1/(e1 + e2), max_dual_seq);
+  if(u.numerator == 0 || u.numerator == u.denominator) {
+    return false;
+  }
+
+  // Spread the B buffers evenly over the sequence (Bresenham)
+  uint32_t acc = 0;
+  for(uint32_t ii = 0; ii < u.denominator; ii++) {
+    acc += u.numerator;
+    if(acc >= u.denominator) {
+      acc -= u.denominator;
+      dual_seq[ii] = 1;
+    } else {
+      dual_seq[ii] = 0;
+    }
+  }
+  dual_periods = (uint64_t)(u.denominator - u.numerator)*p1 + (uint64_t)u.numerator*p2;
+  dual_words = (uint64_t)(u.denominator - u.numerator)*w1 + (uint64_t)u.numerator*w2;
+  n_periods = p1;
+  n_words = w1;
+  dual_p1 = p1;
+  dual_w1 = w1;
+  dual_p2 = p2;
+  dual_w2 = w2;
+  dual_offset = K;
+  dual_n_b = u.numerator;
+  dual_seq_len = u.denominator;
+
+  fill_job_init(&calc_jobs[0], synth_buffer, synth_buffer_ramp_up, synth_buffer_ramp_down, p1, w1);
+  fill_job_init(&calc_jobs[1], synth_buffer + K, NULL, NULL, p2, w2);
+  n_calc_jobs = 2;
+  return true;
+}
+
+
+// Link the dual modulus buffers into a circular list and print the expected spurs
+void synth::finish_dual_modulus()
+{
+  int64_t p1 = dual_p1, w1 = dual_w1, p2 = dual_p2, w2 = dual_w2;
+
+  setup_blocks(w1);
+  for(int ii = 0; ii < dual_seq_len; ii++) {
+    dual_blocks[ii].count = dual_seq[ii] ? w2 : w1;
+    dual_blocks[ii].addr = dual_seq[ii] ? synth_buffer + dual_offset : synth_buffer;
+    dual_blocks[ii].next = &dual_blocks[(ii + 1) % dual_seq_len];
+  }
+  block_ramp_up.next = &dual_blocks[0];
+
+  // Phase deviation (radians) at the end of each buffer relative to the average frequency, and its 
+  // Fourier series over one sequence period. A small phase modulation phi(t) gives sidebands at 
+  // k*f_rep with amplitude |c_k| relative to the carrier.
+  double f_avg = dual_periods/(double)dual_words;
+  double phase = 0, phase_mean = 0, phase_max = 0, t = 0;
+  static float phase_dev[max_dual_seq];
+  for(int ii = 0; ii < dual_seq_len; ii++) {
+    if(dual_seq[ii]) {
+      phase += 2*M_PI*(p2 - f_avg*w2);
+    } else {
+      phase += 2*M_PI*(p1 - f_avg*w1);
+    }
+    phase_dev[ii] = phase;
+    phase_mean += phase/dual_seq_len;
+  }
+  double spur_max = 0;
+  int spur_k = 0;
+  for(int k = 1; k <= 16; k++) {
+    double re = 0, im = 0;
+    t = 0;
+    for(int ii = 0; ii < dual_seq_len; ii++) {
+      double w = dual_seq[ii] ? w2 : w1;
+      t += w;
+      double arg = 2*M_PI*k*t/dual_words;
+      re += (phase_dev[ii] - phase_mean)*w*cos(arg);
+      im -= (phase_dev[ii] - phase_mean)*w*sin(arg);
+      if(k == 1 && fabs(phase_dev[ii] - phase_mean) > phase_max) {
+        phase_max = fabs(phase_dev[ii] - phase_mean);
+      }
+    }
+    double mag = sqrt(re*re + im*im)/dual_words;
+    if(mag > spur_max) {
+      spur_max = mag;
+      spur_k = k;
+    }
+  }
+  double f_rep = get_clock()/(16.0*dual_words);
+  LOG_INFO("Dual modulus: A %lld/%lld, B %lld/%lld, %lu B buffers out of %lu", 
+           (long long)p1, (long long)w1, (long long)p2, (long long)w2, 
+           (unsigned long)dual_n_b, (unsigned long)dual_seq_len);
+  LOG_INFO("Average frequency %.4f Hz (error %.4f Hz)", get_frequency_exact(), 
+           get_frequency_exact() - frequency);
+  LOG_INFO("Max phase error %.3f deg, largest spur %.1f dBc at %.1f Hz offset", 
+           phase_max*180/M_PI, 20*log10(spur_max + 1e-20), spur_k*f_rep);
+}
+
+
+// Periods per 32-bit word for the frequency at the calibrated system clock clk, before the multiplier
+rational_t synth::plan_ratio(double clk)
+{
+  if(word_multiple > 1 || odd_periods) {
+    return rational_approximation_constrained(frequency * 16.0 / clk, 
+                                              min(max_words, max_words_limit), word_multiple, odd_periods);
+  }
+  // Exact integer calculation with the frequency and the clock in mHz
+  return rational_approximation_exact(freq_to_mHz(frequency) * 16, freq_to_mHz(clk), 
+                                      min(max_words, max_words_limit));
+}
+
+
+// Fill in the frequency error and the spur spacing of the current settings at the clock cs->hz
+void synth::rate_clock(clock_setting_t *cs)
+{
+  double clk = cal_clock(cs->hz);
+
+  if(mode == 0) {
+    double clkdiv = round(256.0*clk/(2.0*frequency))/256.0;
+    cs->error_hz = fabs(clk/(2*clkdiv) - frequency);
+    cs->spur_hz = 0;
+  } else {
+    rational_t r = plan_ratio(clk);
+    cs->error_hz = fabs(clk * r.numerator / (16.0 * r.denominator) - frequency);
+    cs->spur_hz = clk / (16.0 * r.denominator);
+  }
+}
+
+
+// True if clock a suits the settings better than clock b. Within the tolerance the shortest 
+// buffer, i.e. the widest spur spacing, wins, otherwise the smallest frequency error.
+static bool clock_better(const clock_setting_t *a, const clock_setting_t *b)
+{
+  bool a_ok = a->error_hz <= CHANNEL_PLAN_TOLERANCE_HZ;
+  bool b_ok = b->error_hz <= CHANNEL_PLAN_TOLERANCE_HZ;
+
+  if(a_ok != b_ok) {
+    return a_ok;
+  }
+  if(a_ok && a->spur_hz != b->spur_hz) {
+    return a->spur_hz > b->spur_hz;
+  }
+  return a->error_hz < b->error_hz;
+}
+
+
+// Choose the system clock for the current settings, as clock_plan says. The clock that runs 
+// now is kept unless another one is strictly better. Of the PLL settings that give the same 
+// clock the one with the highest VCO frequency is used, it has the least jitter.
+clock_setting_t synth::plan_clock()
+{
+  clock_setting_t best = {CPU_freq_actual, 0, 0, 0, 0, 0};
+  bool found = false;
+
+  if(clock_plan == 0 || (clock_plan > 0 && fabs(clock_plan - CPU_freq_actual) < 1.0)) {
+    return best;
+  }
+  rate_clock(&best);
+  for(uint32_t fbdiv = (uint32_t)(vco_max_hz/xosc_hz); fbdiv * xosc_hz >= vco_min_hz; fbdiv--) {
+    for(uint8_t pd1 = 7; pd1 >= 1; pd1--) {
+      for(uint8_t pd2 = 1; pd2 <= pd1; pd2++) {
+        clock_setting_t cs = {fbdiv * xosc_hz / (pd1 * pd2), (uint32_t)(fbdiv * xosc_hz), pd1, pd2, 0, 0};
+        if(cs.hz < clock_min_hz || cs.hz > clock_max_hz) {
+          continue;
+        }
+        if(clock_plan > 0) {
+          // A given clock
+          if(fabs(cs.hz - clock_plan) < 1.0 && !found) {
+            rate_clock(&cs);
+            best = cs;
+            found = true;
+          }
+          continue;
+        }
+        rate_clock(&cs);
+        if(clock_better(&cs, &best)) {
+          best = cs;
+        }
+      }
+    }
+  }
+  if(clock_plan > 0 && !found) {
+    LOG_WARN("The PLL can not make %.3f MHz, keeping %.3f MHz", clock_plan*1e-6, CPU_freq_actual*1e-6);
+  }
+  return best;
+}
+
+
+// Switch the system clock. The CPU, the PIO and the DMA run on it, so the RF output must be 
+// silent. The timer and the USB have clocks of their own, so the alarms and the console are 
+// not affected.
+bool synth::set_clock(const clock_setting_t *cs)
+{
+  if(cs->vco_hz == 0 || cs->hz == CPU_freq_actual) {
+    return true;
+  }
+  if(cs->hz > clock_vreg_hz) {
+    // The voltage is left raised if the clock goes down again later
+    vreg_set_voltage(VREG_VOLTAGE_1_15);
+    sleep_ms(10);
+  }
+  set_sys_clock_pll(cs->vco_hz, cs->pd1, cs->pd2);
+  double hz = clock_get_hz(clk_sys);
+  if(fabs(hz - cs->hz) > 1000.0) {
+    LOG_WARN("Could not set the system clock to %.3f MHz, it is %.3f MHz", cs->hz*1e-6, hz*1e-6);
+    CPU_freq_actual = hz;
+    return false;
+  }
+  CPU_freq_actual = cs->hz;
+  LOG_INFO("System clock %.6f MHz (VCO %lu MHz / %d / %d)", cs->hz*1e-6, 
+           (unsigned long)(cs->vco_hz/1000000), cs->pd1, cs->pd2);
+  return true;
+}
+
+
+// Stop the CLKDIV output with the pins undriven, so that the clock can change on the way to 
+// a buffer mode. poll_settings() then replaces the program.
+void synth::silence_toggle()
+{
+  if(key_timer_active) {
+    cancel_alarm(key_alarm);
+    key_timer_active = false;
+  }
+  pio_sm_set_enabled(pio, sm, false);
+  pio_sm_set_consecutive_pindirs(pio, sm, m_first_rf_pin, 2, false);
+}
+
+
+// Print the best n clocks for the current settings
+void synth::print_clock_plan(int n)
+{
+  const int max_n = 10;
+  clock_setting_t top[max_n];
+  int n_top = 0;
+
+  n = max(1, min(n, max_n));
+  for(uint32_t fbdiv = (uint32_t)(vco_max_hz/xosc_hz); fbdiv * xosc_hz >= vco_min_hz; fbdiv--) {
+    for(uint8_t pd1 = 7; pd1 >= 1; pd1--) {
+      for(uint8_t pd2 = 1; pd2 <= pd1; pd2++) {
+        clock_setting_t cs = {fbdiv * xosc_hz / (pd1 * pd2), (uint32_t)(fbdiv * xosc_hz), pd1, pd2, 0, 0};
+        bool seen = false;
+        if(cs.hz < clock_min_hz || cs.hz > clock_max_hz) {
+          continue;
+        }
+        for(int ii = 0; ii < n_top; ii++) {
+          seen = seen || top[ii].hz == cs.hz;
+        }
+        if(seen) {
+          continue;
+        }
+        rate_clock(&cs);
+        // Insert in order
+        int pos = n_top;
+        while(pos > 0 && clock_better(&cs, &top[pos - 1])) {
+          pos--;
+        }
+        if(pos >= n) {
+          continue;
+        }
+        for(int ii = min(n_top, n - 1); ii > pos; ii--) {
+          top[ii] = top[ii - 1];
+        }
+        top[pos] = cs;
+        n_top = min(n_top + 1, n);
+      }
+    }
+  }
+
+  clock_setting_t now = {CPU_freq_actual, 0, 0, 0, 0, 0};
+  rate_clock(&now);
+  Serial.printf("System clock %.6f MHz: error %.4f Hz, spurs every %.1f Hz\n", now.hz*1e-6, 
+                now.error_hz, now.spur_hz);
+  for(int ii = 0; ii < n_top; ii++) {
+    Serial.printf("%10.6f MHz (VCO %4lu MHz / %d / %d): error %.4f Hz, spurs every %.1f Hz\n", 
+                  top[ii].hz*1e-6, (unsigned long)(top[ii].vco_hz/1000000), top[ii].pd1, top[ii].pd2, 
+                  top[ii].error_hz, top[ii].spur_hz);
+  }
+}
+
+
+// Choose the buffer lengths and set up the jobs to fill the buffers
+void synth::plan_buffers()
 {
   rational_t PperW; // Periods per 32-bit word as a rational number
   uint32_t n_mult;
 
-  Serial.println("Calculating buffers...");
+  LOG_INFO("Calculating buffers...");
+  dual_seq_len = 0;
+  needs_recalculation = false;
+  fill_synth_buffer_silent();
+  if(dual_modulus && plan_dual_modulus()) {
+    return;
+  }
 
-  PperW = rational_approximation(frequency * 16.0 / (double)CPU_freq_actual, min(max_words, max_words_limit));
+  if(word_multiple == 1 && !odd_periods && get_clock() == CPU_freq_nominal && 
+     max_words_limit >= max_words && lookup_channel_plan(frequency, &PperW)) {
+    LOG_INFO("Using precomputed channel plan");
+  } else {
+    PperW = plan_ratio(get_clock());
+  }
   n_periods = PperW.numerator;
   n_words = PperW.denominator;
 
-  Serial.print("n_words = ");
-  Serial.println(get_n_words());
-  Serial.print("n_periods = ");
-  Serial.println(get_n_periods());
+  LOG_DEBUG("n_words = %d, n_periods = %d before the multiplier", n_words, n_periods);
 
   n_mult = floor(max_words/n_words);
+  if(odd_periods && n_mult % 2 == 0) {
+    // An even multiplier would make n_periods even
+    n_mult--;
+  }
   // Make the buffer at least half of max_words so that the interrupt has plenty of time to do its job. 
   n_periods *= n_mult;
   n_words *= n_mult;
 
   
-  Serial.print("n_words = ");
-  Serial.println(get_n_words());
-  Serial.print("n_periods = ");
-  Serial.println(get_n_periods());
+  LOG_INFO("n_words = %d", get_n_words());
+  LOG_INFO("n_periods = %d", get_n_periods());
 
-  if(mode == 1) {
-    fill_synth_buffer_compare();
-  } else if(mode == 2 or mode == 4) {
-    fill_synth_buffer_sigma_delta();
+  fill_job_init(&calc_jobs[0], synth_buffer, synth_buffer_ramp_up, synth_buffer_ramp_down, n_periods, n_words);
+  n_calc_jobs = 1;
+}
+
+
+// Link the filled buffers
+void synth::finish_buffers()
+{
+  if(dual_seq_len > 0) {
+    finish_dual_modulus();
   } else {
-    fill_synth_buffer_sigma_delta_3s();
+    setup_blocks(n_words);
   }
-  needs_recalculation = false;
+}
+
+
+// (Re)calculate the buffers all at once
+void synth::calculate_buffers()
+{
+  clock_target = plan_clock();
+  set_clock(&clock_target);
+  plan_buffers();
+  while(!fill_slice()) {
+  }
+  finish_buffers();
 }
 
 
 // Apply the frequency, mode etc settings, i.e. calculate new waveforms based on the settings.
-// But only if necessary;
+// But only if necessary. Only the plan is made here. The buffers are filled a slice at a time 
+// by poll_settings(), from loop(), so that the console, the LCD and the keying keep running.
+// Meanwhile the chain plays the silent buffer (or mode 0 keeps going). A call while buffers are 
+// being filled starts over with the latest settings, so a few changes in a row only cost one 
+// full calculation.
 void synth::apply_settings()
 {
   if(!needs_recalculation) {
     return;
   }
+  calc_keep_key = false;
+  if(mode == 0) {
+    // No buffers, switch at once
+    calc_state = calc_idle;
+    needs_recalculation = false;
+    if(key_timer_active) {
+      cancel_alarm(key_alarm);
+      key_timer_active = false;
+    }
+    stop_dma();
+    buffers_ready = true;
+    remove_pio_program();
+    clock_target = plan_clock();
+    set_clock(&clock_target);
+    add_pio_program(&toggle_program);
+    float clkdiv = get_clock()/(2.0*frequency);
+    toggle_program_init(pio, sm, pio_prog_offset, m_first_rf_pin, clkdiv);
+    // No DMA buffers, key with a microsecond alarm instead
+    key_pio = pio;
+    key_sm = sm;
+    key_first_pin = m_first_rf_pin;
+    key_reset(1.0);
+    key_alarm = add_alarm_in_us(key_idle_poll_us, key_alarm_callback, NULL, true);
+    key_timer_active = key_alarm > 0;
+    PrintStatus2();
+    return;
+  }
+
+  if(calc_state != calc_idle) {
+    LOG_INFO("Starting over with the new settings");
+  }
+  calc_start_ms = millis();
+  clock_target = plan_clock();
+  clock_pending = false;
+  if(clock_target.hz != CPU_freq_actual) {
+    if(synth_dma >= 1000) {
+      silence_toggle();
+      set_clock(&clock_target);
+    } else if(calc_state == calc_fill) {
+      // Already silent
+      set_clock(&clock_target);
+    } else {
+      // Change the clock and plan the buffers when the chain has ramped down
+      clock_pending = true;
+    }
+  }
+  if(!clock_pending) {
+    plan_buffers();
+  }
+  if(synth_dma < 1000) {
+    // Ramp down and let the chain play the silent buffer while the others are overwritten
+    uint32_t irq_state = save_and_disable_interrupts();
+    buffers_ready = false;
+    key_resync = false;
+    bool on = enable_transmit;
+    restore_interrupts(irq_state);
+    if(on && calc_state == calc_idle) {
+      retarget_chain(&block_ramp_down);
+    }
+    if(calc_state == calc_idle) {
+      calc_state = calc_silence;
+    }
+  } else {
+    calc_state = calc_fill;
+  }
+}
+
+
+// Apply a small change of the frequency, e.g. of set_ppm(), without disturbing the keying. In 
+// mode 0 the divider of the running state machine is changed. Otherwise the buffers are 
+// recalculated like by apply_settings(), but the key schedule goes on from where it is, so 
+// call this when key_up_us() is longer than that takes.
+void synth::apply_correction()
+{
+  if(!needs_recalculation) {
+    return;
+  }
+  if(mode == 0 && calc_state == calc_idle && clock_plan == 0) {
+    needs_recalculation = false;
+    pio_sm_set_clkdiv(pio, sm, get_clock()/(2.0*frequency));
+    return;
+  }
+  bool idle = calc_state == calc_idle;
+  apply_settings();
+  calc_keep_key = idle && mode != 0;
+}
+
+
+// Continue what apply_settings() started. Call this often, from loop(). Returns true while the 
+// new settings are not yet in effect.
+bool synth::poll_settings()
+{
+  if(calc_state == calc_silence) {
+    // The buffers are free once the synth DMA reads the silent buffer
+    uintptr_t addr = dma_hw->ch[synth_dma].read_addr;
+    if(addr < (uintptr_t)synth_buffer_silent || addr > (uintptr_t)(synth_buffer_silent + max_words)) {
+      return true;
+    }
+    if(clock_pending) {
+      clock_pending = false;
+      set_clock(&clock_target);
+      plan_buffers();
+    }
+    calc_state = calc_fill;
+  }
+  if(calc_state != calc_fill) {
+    return false;
+  }
+  if(!fill_slice()) {
+    return true;
+  }
+
+  finish_buffers();
+  if(synth_dma < 1000) {
+    // The restart DMA picks up the new length of the silent buffer at the next buffer, then 
+    // the interrupt starts the new buffers if the key is down
+    if(calc_keep_key) {
+      // Go on with the queued key segments
+      key_wake();
+      key_rescale(get_buffer_period() * 1e6);
+    } else {
+      key_reset(get_buffer_period() * 1e6);
+    }
+    uint32_t irq_state = save_and_disable_interrupts();
+    buffers_ready = true;
+    key_resync = true;
+    restore_interrupts(irq_state);
+  } else {
+    // From mode 0
+    if(key_timer_active) {
+      cancel_alarm(key_alarm);
+      key_timer_active = false;
+    }
+    remove_pio_program();
+    start_serialiser();
+  }
+  calc_state = calc_idle;
+  LOG_INFO("New settings applied after %lu ms", (unsigned long)(millis() - calc_start_ms));
+  PrintStatus2();
+  return false;
+}
+
+
+// Percentage of the work of apply_settings() that is done, or -1 if there is nothing going on
+int synth::get_settings_progress()
+{
+  int done = 0, total = 0;
+
+  if(calc_state == calc_idle) {
+    return -1;
+  }
+  if(calc_state == calc_silence) {
+    return 0;
+  }
+  for(int jj = 0; jj < n_calc_jobs; jj++) {
+    done += calc_jobs[jj].next;
+    total += calc_jobs[jj].words;
+  }
+  return total > 0 ? 100*done/total : 0;
+}
+
+
+// Stop the DMAs, if they are running
+void synth::stop_dma()
+{
+  key_wake();
   if(synth_dma < 1000) {
     // dma_channel_abort does not seem to work for chained DMAs
     // Write zeros to the control registers as recommended here:
     // (https://forums.raspberrypi.com/viewtopic.php?t=330119)
     // https://forums.raspberrypi.com/viewtopic.php?t=337439
-    Serial.println("Waiting for DMAs to stop...");
+    LOG_INFO("Waiting for DMAs to stop...");
     hw_clear_bits(&dma_hw->ch[synth_dma].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
     hw_clear_bits(&dma_hw->ch[restart_dma].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
+    hw_clear_bits(&dma_hw->ch[link_read_dma].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
+    hw_clear_bits(&dma_hw->ch[link_write_dma].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
     do {
       // This loop might not be necessary
       dma_channel_abort(synth_dma);
       dma_channel_abort(restart_dma);
-    } while(dma_channel_is_busy(synth_dma) || dma_channel_is_busy(restart_dma));
+      dma_channel_abort(link_read_dma);
+      dma_channel_abort(link_write_dma);
+    } while(dma_channel_is_busy(synth_dma) || dma_channel_is_busy(restart_dma) || 
+            dma_channel_is_busy(link_read_dma) || dma_channel_is_busy(link_write_dma));
    unclaim_dma(); 
   }
+}
 
-  remove_pio_program();
-  if(mode == 0) {
-    add_pio_program(&toggle_program);
-    float clkdiv = CPU_freq_actual/(2.0*frequency);
-    toggle_program_init(pio, sm, pio_prog_offset, m_first_rf_pin, clkdiv);
-  } else {
-    Serial.println("Adding PIO program...");
-    add_pio_program(&pio_serialiser_program);
-    pio_serialiser_program_init(pio, sm, pio_prog_offset, m_first_rf_pin, 1.0); 
-    calculate_buffers();
-    // Restart the DMAs
-    Serial.println("Restarting DMAs");
-    setup_dma();
-  }
-  PrintStatus2();
+
+// Load the serialiser into the PIO and start streaming the buffers
+void synth::start_serialiser()
+{
+  LOG_INFO("Adding PIO program...");
+  // The PIO contains a very simple program that waits for a pin to go high
+  // then repeatedly reads a 32-bit word from the FIFO and sends 2 bits per 
+  // clock to two IO pins.
+  add_pio_program(&pio_serialiser_program);
+  pio_serialiser_program_init(pio, sm, pio_prog_offset, m_first_rf_pin, 1.0); 
+  // Restart the DMAs
+  LOG_INFO("Restarting DMAs");
+  setup_dma();
 }
 
 
@@ -488,35 +1749,48 @@ void synth::add_pio_program(const pio_program_t *prog)
 }
 
 
-synth::synth(const uint8_t first_rf_pin, double frequency_a)
+synth::synth(const uint8_t first_rf_pin, double frequency_a, double ppm_a)
 {
   m_first_rf_pin = first_rf_pin;
   frequency = frequency_a;
+  ppm = ppm_a;
   dither_amplitude = 1.0;
   max_words_limit = max_words;
+  word_multiple = 1;
+  odd_periods = false;
   amplitude = 1.0;
   hd3_amplitude = 0.045;
   hd3_phase_rad = -35.0 * M_PI/180.0;
   mode = 5;
   n_words = max_words; // Dummy value for now
+  dual_modulus = false;
   needs_recalculation = true;
-
+  calc_state = calc_idle;
+  n_calc_jobs = 0;
+  clock_plan = 0;
+  clock_pending = false;
+  calc_keep_key = false;
+
+  // The clock is whatever the core was built for, the code is set up for CPU_freq_nominal
+  CPU_freq_actual = clock_get_hz(clk_sys);
+  if(CPU_freq_actual != CPU_freq_nominal) {
+    LOG_WARN("System clock %.3f MHz, not %.3f MHz as expected", CPU_freq_actual*1e-6, CPU_freq_nominal*1e-6);
+  }
   calculate_buffers();
-
-  // The PIO contains a very simple program that waits for a pin to go high
-  // then repeatedly reads a 32-bit word from the FIFO and sends 2 bits per 
-  // clock to two IO pins.
-  add_pio_program(&pio_serialiser_program);
-  pio_serialiser_program_init(pio, sm, pio_prog_offset, first_rf_pin, 1.0); 
-  setup_dma();
+  start_serialiser();
 }
 
 
 void synth::setup_dma()
 {
+  key_pio = pio;
+  key_sm = sm;
+  key_first_pin = m_first_rf_pin;
   // Configure DMA from memory to PIO SM TX FIFO
   synth_dma = dma_claim_unused_channel(true);
   restart_dma = dma_claim_unused_channel(true);
+  link_read_dma = dma_claim_unused_channel(true);
+  link_write_dma = dma_claim_unused_channel(true);
   synth_dma_cfg = dma_channel_get_default_config(synth_dma);
   channel_config_set_transfer_data_size(&synth_dma_cfg, DMA_SIZE_32);
   channel_config_set_read_increment(&synth_dma_cfg, true);
@@ -526,27 +1800,71 @@ void synth::setup_dma()
   // Write to the SM TX FIFO, provide the buffer address, n_words x 32 bit transfers, do not yet start
   dma_channel_configure(synth_dma, &synth_dma_cfg, &pio->txf[sm], synth_buffer, n_words, false);
 
+  // The link DMAs follow the next pointer of the block the restart DMA just read.
+  // The first one copies the read address of the restart DMA, which points at the next field, 
+  // to the triggering read address of the second one. That one copies the next field to the 
+  // read address of the restart DMA. Neither increments, so they can be triggered again and again.
+  dma_channel_config link_cfg = dma_channel_get_default_config(link_write_dma);
+  channel_config_set_transfer_data_size(&link_cfg, DMA_SIZE_32);
+  channel_config_set_read_increment(&link_cfg, false);
+  channel_config_set_write_increment(&link_cfg, false);
+  dma_channel_configure(link_write_dma, &link_cfg, &dma_hw->ch[restart_dma].read_addr, NULL, 1, false);
+  link_cfg = dma_channel_get_default_config(link_read_dma);
+  channel_config_set_transfer_data_size(&link_cfg, DMA_SIZE_32);
+  channel_config_set_read_increment(&link_cfg, false);
+  channel_config_set_write_increment(&link_cfg, false);
+  dma_channel_configure(link_read_dma, &link_cfg, &dma_hw->ch[link_write_dma].al3_read_addr_trig, 
+                        &dma_hw->ch[restart_dma].read_addr, 1, false);
+
   // Use a second DMA to reconfigure the first
   restart_dma_cfg = dma_channel_get_default_config(restart_dma);
   channel_config_set_transfer_data_size(&restart_dma_cfg, DMA_SIZE_32);
-  channel_config_set_read_increment(&restart_dma_cfg, true); // increment the read address, needed for the DMA handler to have proper effect
-  channel_config_set_write_increment(&restart_dma_cfg, false); // do not increment the write address
-  dma_channel_set_irq0_enabled(restart_dma, true);
-  irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler); 
+  channel_config_set_read_increment(&restart_dma_cfg, true); // Read count and addr of a control block
+  channel_config_set_write_increment(&restart_dma_cfg, true); // Write the transfer count and the read address...
+  channel_config_set_ring(&restart_dma_cfg, true, __builtin_ctz(2*sizeof(uintptr_t))); // ...and wrap back to the count
+  channel_config_set_chain_to(&restart_dma_cfg, link_read_dma);
+  // The keying engine runs when the link DMAs are done, i.e. once per buffer
+  key_reset(get_buffer_period() * 1e6);
+  dma_channel_set_irq0_enabled(link_write_dma, true);
+  irq_set_exclusive_handler(DMA_IRQ_0, key_dma_irq_handler); 
   irq_set_enabled(DMA_IRQ_0, true);
-  // Write to the DMA read pointer, provide the buffer address, 2 words x 32 bit, start
-  dma_channel_configure(restart_dma, &restart_dma_cfg, &dma_hw->ch[synth_dma].al3_read_addr_trig, synth_buffer_ramp_up_ptr, 1, true);  
+  // Without a free hardware alarm, there is no parking
+  park_timer_alarm = hardware_alarm_claim_unused(false);
+  if(park_timer_alarm >= 0) {
+    hw_set_bits(&timer_hw->inte, 1u << park_timer_alarm);
+    irq_set_exclusive_handler(hardware_alarm_get_irq_num(park_timer_alarm), park_timer_irq_handler);
+    irq_set_enabled(hardware_alarm_get_irq_num(park_timer_alarm), true);
+  }
+  // Write a control block to the transfer count and read address trigger registers, 2 words x 32 bit, start
+  dma_channel_configure(restart_dma, &restart_dma_cfg, &dma_hw->ch[synth_dma].al3_transfer_count, 
+                        enable_transmit ? &block_ramp_up : &block_silent, 2, true);  
 }
 
 
 void synth::unclaim_dma()
 {
+  dma_channel_set_irq0_enabled(link_write_dma, false);
+  irq_remove_handler(DMA_IRQ_0, key_dma_irq_handler);
+  if(park_timer_alarm >= 0) {
+    key_wake();
+    irq_set_enabled(hardware_alarm_get_irq_num(park_timer_alarm), false);
+    irq_remove_handler(hardware_alarm_get_irq_num(park_timer_alarm), park_timer_irq_handler);
+    hw_clear_bits(&timer_hw->inte, 1u << park_timer_alarm);
+    hardware_alarm_unclaim(park_timer_alarm);
+    park_timer_alarm = -1;
+  }
   dma_channel_cleanup(synth_dma);
   dma_channel_cleanup(restart_dma);
+  dma_channel_cleanup(link_read_dma);
+  dma_channel_cleanup(link_write_dma);
   dma_channel_unclaim(synth_dma);
   dma_channel_unclaim(restart_dma);
+  dma_channel_unclaim(link_read_dma);
+  dma_channel_unclaim(link_write_dma);
   synth_dma = 999999; // Set to some unrealistic value to signal that it is not valid
   restart_dma = 999999;
+  link_read_dma = 999999;
+  link_write_dma = 999999;
 }
 
 
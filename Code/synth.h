@@ -3,23 +3,56 @@
 #include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "hardware/irq.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
 #include "pico/stdlib.h"
 #include "pio_stream.h"
 #include "farey.h"
 #include <cmath>
 #include <stdio.h>
 
-extern double CPU_freq_actual;
-extern const int max_words;
+constexpr double CPU_freq_nominal = 200e6; // The clock frequency the code is set up for
+extern double CPU_freq_actual;             // The system clock, read at startup
+const int max_words = 15000;
+
+// Frequency in Hz to integer mHz, as used for the exact rational approximation
+constexpr uint64_t freq_to_mHz(double f) {return (uint64_t)(f * 1000.0 + 0.5);}
 
 void dma_handler();
 
+// A system clock that the PLL can make, and how well the current settings do with it
+typedef struct {
+  double hz;
+  uint32_t vco_hz;    // 0 if it is the clock that runs now
+  uint8_t pd1, pd2;
+  double error_hz;    // Frequency error of the carrier
+  double spur_hz;     // Repetition rate of the buffer, the spacing of its spurs
+} clock_setting_t;
+
+// State of a buffer fill that is done a slice at a time, see synth::poll_settings()
+typedef struct {
+  uint32_t *buf, *buf_up, *buf_down;
+  int periods, words;
+  int next;                // Next word to calculate
+  double delta_dly[3];     // Quantization error of the main, ramp-up and ramp-down buffers
+  int last_equal[3];
+} fill_job_t;
+
 class synth {
   public:
-    synth(const uint8_t first_rf_pin, double frequency_Hz);
+    synth(const uint8_t first_rf_pin, double frequency_Hz, double ppm);
     ~synth();
     void disable_output();
     void enable_output();
+    uint32_t key_queue_segment(bool on, double us);
+    uint32_t key_queued();
+    uint32_t key_space();
+    bool key_started(uint32_t id);
+    void key_flush();
+    double key_up_us();
+    uint64_t get_dead_air_us();
     void set_dither_amplitude(float a) {dither_amplitude = a; needs_recalculation = true;};
     float get_dither_amplitude() {return dither_amplitude;};
     void set_amplitude(float a) {amplitude = a; needs_recalculation = true;};
@@ -31,6 +64,7 @@ class synth {
     void set_frequency(double f) {frequency = f; needs_recalculation = true;};
     double get_frequency() {return frequency;};
     double get_frequency_exact();
+    double get_buffer_period();
     void set_mode(int m);
     int  get_mode() {return mode;};
     const char *get_mode_str();
@@ -38,9 +72,30 @@ class synth {
     int get_n_periods() {return n_periods;};
     void set_max_words(int m) {max_words_limit = m; needs_recalculation = true;};
     int get_max_words() {return max_words_limit;};
+    void set_alignment(int multiple, bool odd) {word_multiple = multiple; odd_periods = odd; needs_recalculation = true;};
+    int get_word_multiple() {return word_multiple;};
+    bool get_odd_periods() {return odd_periods;};
+    void set_dual_modulus(bool d) {dual_modulus = d; needs_recalculation = true;};
+    bool get_dual_modulus() {return dual_modulus;};
+    void set_parking(bool p);
+    bool get_parking();
+    void set_ppm(double p);
+    double get_ppm() {return ppm;};
+    double get_clock() {return cal_clock(CPU_freq_actual);}; // The calibrated system clock
+    void set_clock_plan(double hz) {clock_plan = hz; needs_recalculation = true;};
+    double get_clock_plan() {return clock_plan;};
+    void print_clock_plan(int n);
     void calculate_buffers();
     void apply_settings();
+    void apply_correction();
+    bool poll_settings();
+    int get_settings_progress();
     void restore_out_pins();
+    void flash_write_begin();
+    void flash_write_end();
+    void poll_stats();
+    void clear_stats();
+    void print_stats();
     
   private:
     static const uint8_t bits_per_word = 32u;
@@ -56,18 +111,48 @@ class synth {
     float hd3_amplitude;
     float hd3_phase_rad;
     int max_words_limit;
+    int word_multiple;  // n_words must be a multiple of this
+    bool odd_periods;   // n_periods must be odd
+    bool dual_modulus;  // Alternate between two buffers to get closer to the frequency
+    uint64_t dual_periods, dual_words; // Length of the whole dual modulus sequence
     double frequency;
+    double ppm;              // Error of the system clock, from the calibration
     int mode; // 0 - CLKDIV, 1 - comparator, 2 - binary sigma delta, 3 - trinary sigma delta, 
               // 4 - click free binary sigma delta, 5 - click free trinary sigma delta
     int n_words, n_periods;
     bool needs_recalculation;
+    int calc_state;          // Progress of apply_settings(), see poll_settings()
+    fill_job_t calc_jobs[2]; // The main buffer, and the B buffer in dual modulus mode
+    int n_calc_jobs;
+    uint32_t calc_start_ms;
+    int64_t dual_p1, dual_w1, dual_p2, dual_w2; // The two buffers in dual modulus mode
+    int64_t dual_offset;     // Where the B buffer starts in synth_buffer
+    uint32_t dual_n_b;       // Number of B buffers in the sequence
+    double clock_plan;       // 0 - keep the clock, > 0 - use this clock, < 0 - choose per frequency
+    clock_setting_t clock_target; // The clock for the buffers being planned
+    bool clock_pending;      // clock_target is set when the chain has ramped down
+    bool calc_keep_key;      // Keep the key schedule, see apply_correction()
 
     void add_pio_program(const pio_program_t *prog);
     void remove_pio_program();
     void fill_synth_buffer_silent();
-    void fill_synth_buffer_sigma_delta();
-    void fill_synth_buffer_sigma_delta_3s();
-    void fill_synth_buffer_compare();
+    void fill_synth_buffer_sigma_delta(fill_job_t *job, int end);
+    void fill_synth_buffer_sigma_delta_3s(fill_job_t *job, int end);
+    void fill_synth_buffer_compare(fill_job_t *job, int end);
+    void fill_buffers(fill_job_t *job, int end);
+    bool fill_slice();
+    double cal_clock(double clk) {return clk * (1.0 + ppm * 1e-6);};
+    rational_t plan_ratio(double clk);
+    void rate_clock(clock_setting_t *cs);
+    clock_setting_t plan_clock();
+    bool set_clock(const clock_setting_t *cs);
+    void silence_toggle();
+    void plan_buffers();
+    void finish_buffers();
+    bool plan_dual_modulus();
+    void finish_dual_modulus();
+    void start_serialiser();
     void setup_dma();
+    void stop_dma();
     void unclaim_dma();
 };
\ No newline at end of file
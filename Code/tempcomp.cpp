@@ -0,0 +1,156 @@
+#include <arduino.h>
+#include "tempcomp.h"
+#include "config.h"
+#include "transmitter_PiPico.h"
+#include "log.h"
+#include "idle.h"
+
+// The sensor is noisy and the crystal follows the board temperature slowly, so the samples are 
+// averaged and filtered. When the compensation has moved away from what the synth uses by more 
+// than tc_threshold_hz at the carrier, a correction waits for a key up period long enough to 
+// recalculate the buffers in, so no key down is cut.
+static const uint32_t tc_period_ms = 10000;  // Between samples
+static const int tc_readings = 16;           // ADC readings per sample
+static const float tc_filter = 0.25;         // Weight of a new sample
+static const double tc_threshold_hz = 0.5;
+static const double tc_silence_us = 250000;  // Shortest key up period to correct in
+static const uint32_t tc_poll_ms = 20;       // Poll interval while waiting for it
+
+static float tc_temp = NAN;                  // Filtered temperature
+static uint32_t tc_sample_ms = 0;
+static bool tc_sampled = false;
+static bool tc_pending = false;              // Waiting for a silence
+static bool tc_running = false;              // Correction being applied
+static uint32_t tc_start_ms;
+static uint64_t tc_start_dead_air_us;
+
+// Statistics
+static uint32_t tc_corrections = 0;
+static uint32_t tc_recalculations = 0;
+static uint32_t tc_time_max_ms = 0;
+static uint64_t tc_dead_air_us = 0;
+
+
+// The filtered temperature in degrees C, NAN before the first sample
+float tc_temperature()
+{
+  return tc_temp;
+}
+
+
+// Drift of the crystal in ppm at the temperature t, linear between the points of the curve
+double tc_curve_ppm(float t)
+{
+  float x = (t - TC_T_MIN)/TC_T_STEP;
+
+  if(isnan(t)) {
+    return 0;
+  }
+  if(x <= 0) {
+    return current_config.tc_ppm[0];
+  }
+  if(x >= TC_POINTS - 1) {
+    return current_config.tc_ppm[TC_POINTS - 1];
+  }
+  int ii = (int)x;
+  float w = x - ii;
+  return (1 - w)*current_config.tc_ppm[ii] + w*current_config.tc_ppm[ii + 1];
+}
+
+
+// The error of the system clock now, the calibration plus the drift
+double tc_total_ppm()
+{
+  return current_config.ppm + tc_curve_ppm(tc_temp);
+}
+
+
+static void tc_sample()
+{
+  float t = 0;
+
+  for(int ii = 0; ii < tc_readings; ii++) {
+    t += analogReadTemp();
+  }
+  t /= tc_readings;
+  tc_temp = isnan(tc_temp) ? t : tc_temp + tc_filter*(t - tc_temp);
+  tc_sample_ms = millis();
+  tc_sampled = true;
+}
+
+
+static void tc_start_correction()
+{
+  double ppm = tc_total_ppm();
+
+  LOG_INFO("Temperature %.1f C, correcting the frequency by %.2f Hz (%.3f ppm)", tc_temp, 
+           (ppm - rf_synth->get_ppm())*1e-6*rf_synth->get_frequency(), ppm);
+  tc_pending = false;
+  tc_start_ms = millis();
+  tc_start_dead_air_us = rf_synth->get_dead_air_us();
+  rf_synth->set_ppm(ppm);
+  rf_synth->apply_correction();
+  tc_corrections++;
+  if(rf_synth->get_settings_progress() >= 0) {
+    tc_recalculations++;
+    tc_running = true;
+  }
+}
+
+
+static void tc_finish_correction()
+{
+  uint32_t ms = millis() - tc_start_ms;
+  uint64_t dead_air_us = rf_synth->get_dead_air_us() - tc_start_dead_air_us;
+
+  tc_running = false;
+  tc_dead_air_us += dead_air_us;
+  if(ms > tc_time_max_ms) {
+    tc_time_max_ms = ms;
+  }
+  LOG_INFO("Temperature correction done after %lu ms, %lu us dead air", (unsigned long)ms, 
+           (unsigned long)dead_air_us);
+}
+
+
+// Sample the temperature when it is time, and correct the frequency when it has drifted. 
+// Call often from loop().
+void tc_poll()
+{
+  if(!tc_sampled || millis() - tc_sample_ms >= tc_period_ms) {
+    tc_sample();
+    if(rf_synth && fabs(tc_total_ppm() - rf_synth->get_ppm())*1e-6*rf_synth->get_frequency() > tc_threshold_hz) {
+      tc_pending = true;
+    }
+  }
+  if(!rf_synth) {
+    return;
+  }
+  if(tc_running && rf_synth->get_settings_progress() < 0) {
+    tc_finish_correction();
+  }
+  if(tc_pending && !tc_running && rf_synth->get_settings_progress() < 0 && 
+     (rf_synth->get_mode() == 0 || rf_synth->key_up_us() >= tc_silence_us)) {
+    tc_start_correction();
+  }
+  if(tc_pending || tc_running) {
+    idle_wake_in_ms(tc_poll_ms);
+  } else {
+    idle_wake_in_ms(tc_period_ms - (millis() - tc_sample_ms));
+  }
+}
+
+
+void tc_print_stats()
+{
+  Serial.printf("Temperature: %.1f C, drift %.3f ppm, calibration %.3f ppm, synth %.3f ppm\n", 
+                tc_temp, tc_curve_ppm(tc_temp), current_config.ppm, rf_synth->get_ppm());
+  Serial.print("Curve (C:ppm):");
+  for(int ii = 0; ii < TC_POINTS; ii++) {
+    Serial.printf(" %.0f:%.2f", TC_T_MIN + ii*TC_T_STEP, current_config.tc_ppm[ii]);
+  }
+  Serial.println();
+  Serial.printf("Corrections: %lu, %lu with recalculated buffers, max %lu ms, %.1f ms dead air\n", 
+                (unsigned long)tc_corrections, (unsigned long)tc_recalculations, 
+                (unsigned long)tc_time_max_ms, tc_dead_air_us*1e-3);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+// Temperature compensation of the crystal. The on-chip temperature sensor is sampled from loop() 
+// with tc_poll(), and the curve of current_config.tc_ppm gives the drift of the crystal, on top of 
+// the calibration current_config.ppm. Larger changes are applied in a silence of the keying, see 
+// synth::apply_correction().
+float tc_temperature();
+double tc_curve_ppm(float t);
+double tc_total_ppm();
+void tc_poll();
+void tc_print_stats();
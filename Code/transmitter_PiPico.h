@@ -24,5 +24,4 @@ extern const int SW0_Pin;
 extern const int LED_Pin;
 
 
-void initMorseRate(uint32_t WPM);
 double read_batt();
\ No newline at end of file
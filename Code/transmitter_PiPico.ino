@@ -75,11 +75,19 @@
 #include "commands.h"
 #include "transmitter_PiPico.h"
 #include "config.h"
+#include "morse.h"
+#include "log.h"
+#include "prof.h"
+#include "idle.h"
+#include "tempcomp.h"
+#include "binproto.h"
 #include <EEPROM.h>
 
 static const uint32_t POWER_BANK_PULSE_MS = 500;          // Length of power bank keep-alive pulse
 static const uint32_t POWER_BANK_PULSE_PERIOD_MS = 25000; // Time between power bank keep-alive pulses
+static const uint32_t BUTTON_DEBOUNCE_MS = 10;            // Time the button must be stable
 static const uint32_t LCD_STATIC_TIME = 3000;             // Time between each LCD change
+static const uint32_t MORSE_LOOKAHEAD = 4;                // Number of morse runs to queue ahead
 
 bool key_down = false; // Whether to transmit continuously
 
@@ -114,62 +122,24 @@ Bounce btn1 = Bounce();
 elapsedMillis global_time;
 
 uint32_t resistor_time;
-
-
-// Morse code constants
-int32_t msPerUnit = 120;           // Morse rate, 120 ms per unit = 10 WPM
-int32_t msPerDot = msPerUnit;      // Duration of a dot
-int32_t msPerDash = msPerUnit * 3; // Duration of a dash
-int32_t msPiecePause = msPerUnit;  // Pause between pieces of a character
-int32_t msCharPause = msPerUnit * 3; // Pause between characters
-int32_t msWordPause = msPerUnit * 7; // Pause between words
-
-// Conversion table from ASCII to morse code.
-// Dashes are encoded as ones, and dots as zeros in the LSBs.
-// The MorseLengths array tells how many pieces each character has.
-static const uint8_t MorseCodes[] = {
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x06, 0x12, 0x09, 0x09, 0x0C, 0x00, 0x1E,
-  0x16, 0x2D, 0x00, 0x0A, 0x33, 0x21, 0x15, 0x12, 0x1F, 0x0F,
-  0x07, 0x03, 0x01, 0x00, 0x10, 0x18, 0x1C, 0x1E, 0x38, 0x2A,
-  0x00, 0x00, 0x00, 0x0C, 0x1A, 0x01, 0x08, 0x0A, 0x04, 0x00,
-  0x02, 0x06, 0x00, 0x00, 0x07, 0x05, 0x04, 0x03, 0x02, 0x07,
-  0x06, 0x0D, 0x02, 0x00, 0x01, 0x01, 0x01, 0x03, 0x09, 0x0B,
-  0x0C, 0x00, 0x00, 0x00, 0x00, 0x0D, 0x1E, 0x01, 0x08, 0x0A,
-  0x04, 0x00, 0x02, 0x06, 0x00, 0x00, 0x07, 0x05, 0x04, 0x03,
-  0x02, 0x07, 0x06, 0x0D, 0x02, 0x00, 0x01, 0x01, 0x01, 0x03,
-  0x09, 0x0B, 0x0C, 0x00, 0x00, 0x00, 0x15, 0x00
-};
-
-static const uint8_t MorseLengths[] = {
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x05, 0x06, 0x05, 0x07, 0x05, 0x00, 0x06,
-  0x05, 0x06, 0x00, 0x05, 0x06, 0x06, 0x06, 0x05, 0x05, 0x05,
-  0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06,
-  0x00, 0x00, 0x00, 0x06, 0x06, 0x02, 0x04, 0x04, 0x03, 0x01,
-  0x04, 0x03, 0x04, 0x02, 0x04, 0x03, 0x04, 0x02, 0x02, 0x03,
-  0x04, 0x04, 0x03, 0x03, 0x01, 0x03, 0x04, 0x03, 0x04, 0x04,
-  0x04, 0x00, 0x00, 0x00, 0x00, 0x06, 0x06, 0x02, 0x04, 0x04,
-  0x03, 0x01, 0x04, 0x03, 0x04, 0x02, 0x04, 0x03, 0x04, 0x02,
-  0x02, 0x03, 0x04, 0x04, 0x03, 0x03, 0x01, 0x03, 0x04, 0x03,
-  0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00
-};
+static volatile uint32_t button_edge_ms; // Time of the last button edge
+static volatile bool button_bouncing = false;
 
 
 void lcd_show_status();
 void lcd_show_splash();
+void queueMorse();
+void button_edge();
 
 
 void start_transmitting()
 {
   if(!rf_synth) {
     // Initialize synth object, should not be necessary here
-    rf_synth = new synth(First_RF_Pin, current_config.frequency);
+    rf_synth = new synth(First_RF_Pin, current_config.frequency, tc_total_ppm());
   }
+  // The morse segments already queued would otherwise key the output down and up again
+  rf_synth->key_flush();
   rf_synth->enable_output();
 }
 
@@ -191,7 +161,6 @@ void setup()
   EEPROM.begin(256);
   load_EEPROM_config();
   read_switches();
-  initMorseRate(current_config.wpm);
   analogReadResolution(12);
 
   lcd.begin(8, 2);
@@ -223,10 +192,12 @@ void setup()
   resistor_time = global_time;
 
   btn1.attach(Button1_Pin, INPUT);
-  btn1.interval(10);
+  btn1.interval(BUTTON_DEBOUNCE_MS);
+  attachInterrupt(digitalPinToInterrupt(Button1_Pin), button_edge, CHANGE);
 
   digitalWrite(Morse_Debug_Pin, LOW);
   
+  tc_poll(); // The first temperature sample, so that the synth starts compensated
   start_transmitting(); // The rf_synth object is allocated here
 
   print_config();
@@ -234,24 +205,7 @@ void setup()
   Serial.println("End of setup");
   Serial.flush();
   //test_rational_approx();
-}
-
-
-// Change the rate of the morse code in words per minute.
-void initMorseRate(uint32_t WPM)
-{
-  if(WPM < 5) {
-    WPM = 5;
-  }
-  if(WPM > 100) {
-    WPM = 100;
-  }
-  msPerUnit = 1000 * 60 / (WPM * 50); // ms per minute / WPM / units per word
-  msPerDot = msPerUnit;      // Duration of a dot
-  msPerDash = msPerUnit * 3; // Duration of a dash
-  msPiecePause = msPerUnit;  // Pause between pieces of a character
-  msCharPause = msPerUnit * 3; // Pause between characters
-  msWordPause = msPerUnit * 7; // Pause between words
+  //test_rational_approx_constrained();
 }
 
 
@@ -314,7 +268,7 @@ void lcd_show_splash()
 
 // Call this function repeatedly to update the LCD.
 // It toggles between two screens every two seconds.
-// Returns quickly when no LCD update is required.
+// Returns quickly when no LCD update is required, and tells idle_sleep() when the next one is.
 void lcd_show_status()
 {
   static uint32_t lcd_time = global_time;
@@ -377,32 +331,65 @@ void lcd_show_status()
     lcd_time = global_time;
     state = 0;
   }
+  idle_wake_in_ms(lcd_time + LCD_STATIC_TIME + 1 - global_time);
 }
 
 
 void loop()
 {
-  static uint32_t state1 = 0;
-  static uint32_t state2 = 0;
-
-  cmd.poll();
+  PROF_BEGIN(PROF_LOOP);
+  PROF_BEGIN(PROF_LOG);
+  log_drain();
+  PROF_END(PROF_LOG);
+  PROF_BEGIN(PROF_CMD);
+  bin_poll();
+  PROF_END(PROF_CMD);
+  PROF_BEGIN(PROF_SETTINGS);
+  if(rf_synth->poll_settings()) {
+    idle_wake_in_ms(0);
+  }
+  PROF_END(PROF_SETTINGS);
+  PROF_BEGIN(PROF_STATS);
+  rf_synth->poll_stats();
+  PROF_END(PROF_STATS);
+  PROF_BEGIN(PROF_LCD);
   lcd_show_status();
+  PROF_END(PROF_LCD);
+  PROF_BEGIN(PROF_TEMP);
+  tc_poll();
+  PROF_END(PROF_TEMP);
 
+  PROF_BEGIN(PROF_POWER);
   if (digitalRead(Resistor_Pin) == HIGH) {
     if (global_time > resistor_time + POWER_BANK_PULSE_MS) {
       digitalWrite(Resistor_Pin, LOW);
       digitalWrite(LED_Pin, LOW);
-      Serial.println("Power pulse OFF");
+      LOG_INFO("Power pulse OFF");
+    } else {
+      idle_wake_in_ms(resistor_time + POWER_BANK_PULSE_MS + 1 - global_time);
     }
   } else {
     if (global_time > resistor_time + POWER_BANK_PULSE_PERIOD_MS) {
       digitalWrite(Resistor_Pin, HIGH);
       digitalWrite(LED_Pin, HIGH);
-      Serial.println("Power pulse ON");
+      LOG_INFO("Power pulse ON");
       resistor_time = global_time;
+      idle_wake_in_ms(POWER_BANK_PULSE_MS + 1);
+    } else {
+      idle_wake_in_ms(resistor_time + POWER_BANK_PULSE_PERIOD_MS + 1 - global_time);
     }
   }
+  PROF_END(PROF_POWER);
 
+  PROF_BEGIN(PROF_BUTTON);
+  if(button_bouncing) {
+    // Poll until the button has been stable long enough for the debouncer
+    if(millis() - button_edge_ms < 2*BUTTON_DEBOUNCE_MS) {
+      idle_wake_in_ms(1);
+    } else {
+      button_bouncing = false;
+    }
+  }
   btn1.update();
   if(btn1.fell()) {
     read_switches();
@@ -411,233 +398,71 @@ void loop()
     lcd.setCursor(0, 1); // bottom left
     lcd.print("...");
     rf_synth->set_frequency(current_config.frequency);
+    rf_synth->set_ppm(tc_total_ppm());
     rf_synth->apply_settings();    
   }
+  PROF_END(PROF_BUTTON);
 
+  PROF_BEGIN(PROF_MORSE);
   if(key_down) {
     start_transmitting();
-    return;
-  }
-
-  if (state1 < 10) {
-    // Send the fox string ten times, then the call sign
-    initMorseRate(current_config.wpm); // Normal speed
-    switch (state2) {
-      case 0:
-        // Transmit the fox string
-        if (sendMorseString(current_config.fox_string)) {
-          // String has been fully transmitted
-          state2++;
-        }
-        break;
-      case 1:
-        // Pause
-        if (sendWordPause()) {
-          state2 = 0;
-          state1++;
-        }
-        break;
-      default:
-        state2 = 0;
-    }
   } else {
-    if(strlen(current_config.call) == 0) {
-      // No callsign to transmit
-      state2 = 0;
-      state1 = 0;      
-    } else {
-      initMorseRate(2*current_config.wpm); // Fast
-      switch (state2) {
-        case 0:
-          // Send  a string
-          if (sendMorseString(current_config.call)) {
-            state2++;
-          }
-          break;
-        case 1:
-          // Pause, pulse the LED and the power bank load
-          digitalWrite(LED_Pin, HIGH);
-          digitalWrite(Resistor_Pin, HIGH);
-          if (sendWordPause()) {
-            // Done with the pause
-            digitalWrite(LED_Pin, LOW);
-            digitalWrite(Resistor_Pin, LOW);
-            state2 = 0;
-            state1 = 0;
-          }
-          break;
-        default:
-          state2 = 0;
-      }
-    }
+    queueMorse();
   }
-}
-
-
-// Send a string of morse characters.
-// Keep calling this function (with the same string) many times per unit 
-// interval until it returns true to signal that the transmission is done.
-int sendMorseString(const char *str)
-{
-  static int state = 0;
-  static uint32_t charNo = 0;
-  uint8_t currentChar;
-  static uint8_t currentCode;
-  static uint8_t currentLen;
-
-  if (charNo >= strlen(str)) {
-    // Done sending all characters, clean up and return 1
-    charNo = 0;
-    return 1;
+  PROF_END(PROF_MORSE);
+  if(log_pending()) {
+    idle_wake_in_ms(1);
   }
-
-  if (state == 0) {
-    // Start sending next character
-    currentChar = str[charNo];
-    if (currentChar == ' ') {
-      // Space, send a pause
-      state = 2;
-      sendPause(msWordPause - msCharPause);
-    } else {
-      // Not a space
-      currentCode = MorseCodes[currentChar];
-      currentLen = MorseLengths[currentChar];
-      if (currentLen > 0) {
-        // Valid character
-        state = 1;
-        sendMorseLetter(currentCode, currentLen);
-      } else {
-        // Invalid character, just advance to the next one and let next call take care of it
-        charNo++;
-      }
-    }
-
-  } else if (state == 1) {
-    // We are already sending a character, see if we are done with this one
-    if (sendMorseLetter(currentCode, currentLen)) {
-      // Yes, we are done with the character, advance to next one
-      charNo++;
-      state = 0;
-    }
-
-  } else if (state == 2) {
-    // We are sending a pause
-    if (sendPause(msWordPause - msCharPause)) {
-      // Done with the pause
-      charNo++;
-      state = 0;
-    }
-  }
-  return 0;
+  PROF_END(PROF_LOOP);
+  idle_sleep();
 }
 
 
-// Add the delay difference between a character delay and a word delay.
-// Keep calling this function repeatedly until it returns true to signal that the delay is done.
-int sendWordPause()
+// Wake up the main loop to debounce the button
+void button_edge()
 {
-  return sendPause(msWordPause - msCharPause);
+  button_edge_ms = millis();
+  button_bouncing = true;
 }
 
 
-// Add a delay of 'pause' ms.
-// Keep calling this function repeatedly until it returns true to signal that the delay is done.
-int sendPause(uint32_t pause)
+// Keep the keying engine fed with the compiled fox cycle. The schedule is recompiled when the 
+// fox string, call sign or rate has changed. Also pulse the LED and the power bank load 
+// during the pause after the call sign.
+void queueMorse()
 {
-  static int state = 0;
-  static uint32_t nextEventTime;
-
-  if (state == 0) {
-    nextEventTime = global_time + pause;
-    state = 1;
-  } else {
-    if (global_time > nextEventTime) {
-      // We are done
-      state = 0;
-      return 1;
+  static morse_schedule_t schedule;
+  static morse_player_t player;
+  static uint32_t pulseSegment = 0;    // Key segment that starts the pulse
+  static uint32_t pulseEndSegment = 0; // Key segment that ends it
+  const morse_run_t *run;
+  uint32_t segment;
+
+  while (rf_synth->key_queued() < MORSE_LOOKAHEAD) {
+    if (!morse_schedule_matches(&schedule, current_config.wpm, current_config.fox_string, current_config.call)) {
+      morse_compile(&schedule, current_config.wpm, current_config.fox_string, current_config.call);
+      morse_player_reset(&player);
     }
-  }
-  return 0;
-}
-
-
-// Send a morse letter encoded as the 'len' LSBs of 'code'. A dot is encoded as a 0 and a dash as a 1.
-// The most significant of the bits is sent first, so P (.--.) would be specified as code = 0x06 and len = 4.
-// Keep calling this function repeatedly until it returns true to signal that the transmission is done.
-// Changing whether a signal is sent or not can only happen when the function is called. So it should be called
-// at least five times more frequently than the 'msPerUnit' constant specifies.
-int sendMorseLetter(uint32_t code, uint32_t len)
-{
-  static int state = 0;
-  static int currentBit = 0;
-  static uint32_t nextEventTime;
-  static uint32_t stateBegin;
-
-  if (state == 0) {
-    /*
-    Serial.print(F("Code: "));
-    Serial.print(code, BIN);
-    Serial.print(F(" Len: "));
-    Serial.println(len, DEC);
-    */
-    // Start of transmission of this character, start transmitting
-    stateBegin = global_time;
-    start_transmitting();
-    currentBit = len;
-    state = 1;
-    if (code & (1 << (currentBit - 1))) {
-      // Transmitting a dash
-      nextEventTime = stateBegin + msPerDash;
-    } else {
-      // Transmitting a dot
-      nextEventTime = stateBegin + msPerDot;
+    run = morse_next(&schedule, &player);
+    if (run == NULL) {
+      break;
     }
-
-  } else {
-    // Transmission has already started
-    if (global_time < nextEventTime) {
-      // It is not yet time to change anything, return immediately
-      return 0;
-    }
-    // Time to do something
-    switch (state) {
-
-      case 1:
-        // End transmission of this piece of a character
-        stateBegin = nextEventTime;
-        stop_transmitting();
-        currentBit--;
-        state = 2;
-        nextEventTime = stateBegin + msPiecePause;
-        break;
-
-      case 2:
-        // End of pause after a piece of a character
-        stateBegin = nextEventTime;
-        // Was it the last piece?
-        if (currentBit == 0) {
-          // Yes, need to wait some more for spacing between characters
-          nextEventTime = stateBegin + msCharPause - msPiecePause;
-          state = 3;
-        } else {
-          // No, start next piece of this character
-          start_transmitting();
-          state = 1;
-          if (code & (1 << (currentBit - 1))) {
-            // Transmitting a dash
-            nextEventTime = stateBegin + msPerDash;
-          } else {
-            // Transmitting a dot
-            nextEventTime = stateBegin + msPerDot;
-          }
-        }
-        break;
-
-      case 3:
-        // We have reached the end of the character and the pause after it
-        state = 0;
-        return 1;
+    segment = rf_synth->key_queue_segment(run->flags & MORSE_KEY_DOWN, morse_run_us(&schedule, run));
+    if (run->flags & MORSE_PULSE) {
+      pulseSegment = segment;
     }
   }
-  return 0;
+
+  if (pulseSegment != 0 && rf_synth->key_started(pulseSegment)) {
+    digitalWrite(LED_Pin, HIGH);
+    digitalWrite(Resistor_Pin, HIGH);
+    pulseEndSegment = pulseSegment + 1;
+    pulseSegment = 0;
+  }
+  if (pulseEndSegment != 0 && rf_synth->key_started(pulseEndSegment)) {
+    // Done with the pause
+    digitalWrite(LED_Pin, LOW);
+    digitalWrite(Resistor_Pin, LOW);
+    pulseEndSegment = 0;
+  }
 }